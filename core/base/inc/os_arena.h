@@ -0,0 +1,101 @@
+/************************************************************************
+ *File name: os_arena.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_ARENA_H
+#define OS_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Region allocator for per-message / per-transaction memory.
+ *
+ * Memory is carved from chunks with a bump pointer and is never freed
+ * one by one: os_arena_reset()/os_arena_rewind() release everything
+ * allocated after a point at once. Chunks are os_buf clusters, so they
+ * are recycled through the buf pool instead of the heap; only blocks
+ * beyond OS_CLUSTER_BIG_SIZE come from os_malloc().
+ */
+#define OS_ARENA_DEFAULT_CHUNK  2048
+#define OS_ARENA_ALIGN          16
+
+typedef struct os_arena_chunk_s os_arena_chunk_t;
+
+typedef struct os_arena_s {
+    unsigned char *ptr;
+    unsigned char *end;
+
+    os_arena_chunk_t *chunk;    /* current chunk, linked to older ones */
+    os_arena_chunk_t *large;    /* dedicated chunks, newest first */
+
+    os_buf_pool_t *pool;
+    unsigned int chunk_size;
+    size_t used;
+
+    const char *file_line;
+} os_arena_t;
+
+typedef struct os_arena_mark_s {
+    os_arena_chunk_t *chunk;
+    os_arena_chunk_t *large;
+    unsigned char *ptr;
+    size_t used;
+} os_arena_mark_t;
+
+/* pool == NULL uses the default buf pool, chunk_size == 0 uses OS_ARENA_DEFAULT_CHUNK */
+#define os_arena_create(pool, chunk_size) os_arena_create_debug(pool, chunk_size, OS_FILE_LINE)
+os_arena_t *os_arena_create_debug(os_buf_pool_t *pool, unsigned int chunk_size, const char *file_line);
+void os_arena_destroy(os_arena_t *arena);
+void os_arena_reset(os_arena_t *arena);
+
+void *os_arena_alloc_slow(os_arena_t *arena, size_t size);
+
+static os_inline void *os_arena_alloc(os_arena_t *arena, size_t size)
+{
+    unsigned char *p = arena->ptr;
+
+    size = (size + OS_ARENA_ALIGN - 1) & ~((size_t)OS_ARENA_ALIGN - 1);
+    if (os_likely(size && (size_t)(arena->end - p) >= size)) {
+        arena->ptr = p + size;
+        arena->used += size;
+        return p;
+    }
+
+    return os_arena_alloc_slow(arena, size);
+}
+
+void *os_arena_calloc(os_arena_t *arena, size_t nmemb, size_t size);
+char *os_arena_strdup(os_arena_t *arena, const char *s);
+char *os_arena_strndup(os_arena_t *arena, const char *s, size_t n);
+void *os_arena_memdup(os_arena_t *arena, const void *m, size_t n);
+
+void os_arena_mark(os_arena_t *arena, os_arena_mark_t *mark);
+void os_arena_rewind(os_arena_t *arena, const os_arena_mark_t *mark);
+
+bool os_arena_contains(os_arena_t *arena, const void *ptr);
+
+/*
+ * cJSON adapter: while an arena is attached, every cJSON allocation made
+ * by the calling thread comes from it and cJSON_Delete() is a no-op, so
+ * delete items built on the heap only while detached. Other threads and
+ * detached callers keep using malloc().
+ */
+void os_arena_cjson_attach(os_arena_t *arena);
+void os_arena_cjson_detach(void);
+
+void os_arena_show_avail(os_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+/************************************************************************
+ *File name: os_atomic.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_ATOMIC_H
+#define OS_ATOMIC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Thin wrappers over the gcc/clang __atomic builtins.
+ * Plain integer/pointer fields can be used with these macros directly.
+ */
+#define OS_MO_RELAXED __ATOMIC_RELAXED
+#define OS_MO_ACQUIRE __ATOMIC_ACQUIRE
+#define OS_MO_RELEASE __ATOMIC_RELEASE
+#define OS_MO_ACQ_REL __ATOMIC_ACQ_REL
+#define OS_MO_SEQ_CST __ATOMIC_SEQ_CST
+
+#define os_atomic_load(ptr)             __atomic_load_n((ptr), OS_MO_ACQUIRE)
+#define os_atomic_load_relaxed(ptr)     __atomic_load_n((ptr), OS_MO_RELAXED)
+#define os_atomic_store(ptr, val)       __atomic_store_n((ptr), (val), OS_MO_RELEASE)
+#define os_atomic_store_relaxed(ptr, val) __atomic_store_n((ptr), (val), OS_MO_RELAXED)
+#define os_atomic_xchg(ptr, val)        __atomic_exchange_n((ptr), (val), OS_MO_ACQ_REL)
+
+#define os_atomic_add_fetch(ptr, val)   __atomic_add_fetch((ptr), (val), OS_MO_ACQ_REL)
+#define os_atomic_sub_fetch(ptr, val)   __atomic_sub_fetch((ptr), (val), OS_MO_ACQ_REL)
+#define os_atomic_fetch_add(ptr, val)   __atomic_fetch_add((ptr), (val), OS_MO_ACQ_REL)
+#define os_atomic_fetch_sub(ptr, val)   __atomic_fetch_sub((ptr), (val), OS_MO_ACQ_REL)
+#define os_atomic_inc(ptr)              os_atomic_add_fetch((ptr), 1)
+#define os_atomic_dec(ptr)              os_atomic_sub_fetch((ptr), 1)
+
+/* @return true if *ptr was *expected and has been replaced by desired,
+ * otherwise *expected is updated with the current value */
+#define os_atomic_cas(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), false, \
+            OS_MO_ACQ_REL, OS_MO_ACQUIRE)
+#define os_atomic_cas_weak(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), true, \
+            OS_MO_ACQ_REL, OS_MO_ACQUIRE)
+
+#define os_atomic_thread_fence()        __atomic_thread_fence(OS_MO_SEQ_CST)
+#define os_compiler_barrier()           __asm__ __volatile__("" ::: "memory")
+
+#if defined(__x86_64__) || defined(__i386__)
+#define os_cpu_relax()                  __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#define os_cpu_relax()                  __asm__ __volatile__("yield" ::: "memory")
+#else
+#define os_cpu_relax()                  os_compiler_barrier()
+#endif
+
+#ifndef OS_CACHELINE_SIZE
+#define OS_CACHELINE_SIZE 64
+#endif
+#define OS_CACHELINE_ALIGNED __attribute__((aligned(OS_CACHELINE_SIZE)))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
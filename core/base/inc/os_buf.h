@@ -16,6 +16,9 @@
 extern "C" {
 #endif
 
+/* the largest cluster, and so the largest os_buf_alloc() */
+#define OS_CLUSTER_BIG_SIZE    (1024*1024)
+
 typedef struct os_cluster_s {
     unsigned char *buffer;
     unsigned int size;
@@ -0,0 +1,82 @@
+/************************************************************************
+ *File name: os_fiber.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_FIBER_H
+#define OS_FIBER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stackful fibers on top of an os_pollset.
+ *
+ * A fiber that would block on a socket or sleep registers interest in
+ * the pollset or a timer and switches back to the scheduler, so session
+ * code reads sequentially. Stacks come from a pool of mmap()ed regions
+ * with a PROT_NONE guard page below each, so an overflow faults instead
+ * of corrupting a neighbour. The guard splits every stack into two
+ * mappings, so beyond roughly 32k fibers vm.max_map_count (65530 by
+ * default) has to be raised.
+ *
+ * The scheduler belongs to the pollset thread. Drive it with:
+ *
+ *     for ( ;; ) {
+ *         os_pollset_poll(pollset, os_fiber_sched_timeout(sched));
+ *         os_fiber_sched_run(sched);
+ *     }
+ *
+ * Sockets passed to os_fiber_read/write must be non-blocking.
+ */
+typedef struct os_fiber_sched_s os_fiber_sched_t;
+typedef struct os_fiber_s os_fiber_t;
+typedef void (*os_fiber_f)(void *data);
+
+typedef struct os_fiber_config_s {
+    size_t stack_size;          /* usable bytes, 0: 64 KB */
+    unsigned int stack_cache;   /* unused stacks kept mapped, 0: 64 */
+} os_fiber_config_t;
+
+os_fiber_sched_t *os_fiber_sched_create(
+        os_pollset_t *pollset, const os_fiber_config_t *conf);
+/* fibers still suspended are dropped without unwinding */
+void os_fiber_sched_destroy(os_fiber_sched_t *sched);
+
+/* run every ready fiber once and fire expired timers */
+void os_fiber_sched_run(os_fiber_sched_t *sched);
+/* 0 if a fiber is ready, time to the next timer, or OS_INFINITE_TIME */
+os_time_t os_fiber_sched_timeout(os_fiber_sched_t *sched);
+unsigned int os_fiber_sched_count(os_fiber_sched_t *sched);
+
+/* the fiber first runs from os_fiber_sched_run() */
+os_fiber_t *os_fiber_spawn(os_fiber_sched_t *sched, os_fiber_f fn, void *data);
+
+/* the calling fiber, NULL outside fibers */
+os_fiber_t *os_fiber_self(void);
+void os_fiber_yield(void);
+void os_fiber_sleep(os_time_t timeout);
+
+/*
+ * Suspend until fd is ready for when (OS_POLLIN or OS_POLLOUT).
+ * @return OS_OK, OS_TIMEUP, or OS_ERROR if it cannot be polled
+ */
+int os_fiber_wait(os_socket_t fd, short when, os_time_t timeout);
+
+/* like os_read(), but suspends instead of failing with EAGAIN */
+ssize_t os_fiber_read(os_socket_t fd, void *buf, size_t len);
+/* writes all of buf, suspending as needed; @return len or OS_ERROR */
+ssize_t os_fiber_write(os_socket_t fd, const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+/************************************************************************
+ *File name: os_flat_hash.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_FLAT_HASH_H
+#define OS_FLAT_HASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open-addressing hash map with fixed size keys and values stored
+ * inline (Swiss table layout). One control byte per slot holds 7 bits
+ * of the hash, and 16 control bytes are matched at once with SSE2, so a
+ * lookup usually touches one control group and one slot.
+ *
+ * Pointers returned by os_flat_hash_get() stay valid until the next
+ * insertion of a new key, which may move every slot.
+ */
+typedef struct os_flat_hash_s os_flat_hash_t;
+
+/*
+ * os_flat_hash_first() reuses the iterator embedded in the table; give
+ * os_flat_hash_first_r() one of your own to nest or interleave walks.
+ */
+typedef struct os_flat_hash_index_s {
+    os_flat_hash_t *ht;
+    size_t i;
+} os_flat_hash_index_t;
+
+/* 64-bit hash of a ksize byte key; seed is random per table */
+typedef uint64_t (*os_flat_hashfunc_t)(const void *key, uint64_t seed);
+
+os_flat_hash_t *os_flat_hash_make(size_t ksize, size_t vsize);
+os_flat_hash_t *os_flat_hash_make_custom(
+        size_t ksize, size_t vsize, os_flat_hashfunc_t hash_func);
+void os_flat_hash_destroy(os_flat_hash_t *ht);
+
+/* grow so that n keys fit without rehashing */
+void os_flat_hash_reserve(os_flat_hash_t *ht, unsigned int n);
+
+/* insert or replace; val may be NULL when vsize is 0 */
+void os_flat_hash_set(os_flat_hash_t *ht, const void *key, const void *val);
+/* @return pointer to the stored value, NULL if not found */
+void *os_flat_hash_get(os_flat_hash_t *ht, const void *key);
+/* os_flat_hash_get() for n keys, control groups and slots prefetched */
+void os_flat_hash_get_burst(os_flat_hash_t *ht,
+        const void * const keys[], unsigned int n, void *vals[]);
+/* @return OS_OK if removed, OS_ERROR if not found */
+int os_flat_hash_remove(os_flat_hash_t *ht, const void *key);
+
+unsigned int os_flat_hash_count(os_flat_hash_t *ht);
+void os_flat_hash_clear(os_flat_hash_t *ht);
+
+os_flat_hash_index_t *os_flat_hash_first(os_flat_hash_t *ht);
+os_flat_hash_index_t *os_flat_hash_first_r(
+        os_flat_hash_t *ht, os_flat_hash_index_t *hi);
+os_flat_hash_index_t *os_flat_hash_next(os_flat_hash_index_t *hi);
+const void *os_flat_hash_this_key(os_flat_hash_index_t *hi);
+void *os_flat_hash_this_val(os_flat_hash_index_t *hi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
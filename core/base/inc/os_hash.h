@@ -36,12 +36,33 @@ extern "C" {
 
 typedef struct os_hash_t os_hash_t;
 typedef struct os_hash_index_t os_hash_index_t;
+typedef struct os_hash_entry_t os_hash_entry_t;
+
+/*
+ * os_hash_first() reuses the iterator embedded in the table; give
+ * os_hash_first_r() one of your own to nest or interleave iterations.
+ * The current entry may be deleted while iterating.
+ */
+struct os_hash_index_t {
+    os_hash_t          *ht;
+    os_hash_entry_t    *this, *next;
+    unsigned int        index;
+};
+
 typedef unsigned int (*os_hashfunc_t)(const char *key, int *klen);
+/* times-33, one byte per step */
 unsigned int os_hashfunc_default(const char *key, int *klen);
+/* os_hash64() with a random per-process seed */
+unsigned int os_hashfunc_fast(const char *key, int *klen);
+
+/* wyhash: 64-bit keyed hash, 16-48 bytes per step */
+uint64_t os_hash64(const void *key, size_t len, uint64_t seed);
 
 os_hash_t *os_hash_make(void);
 os_hash_t *os_hash_make_custom(os_hashfunc_t os_hash_func);
 void os_hash_destroy(os_hash_t *ht);
+/* pre-size for n keys, resizes synchronously */
+void os_hash_reserve(os_hash_t *ht, unsigned int n);
 
 #define os_hash_set(ht, key, klen, val) os_hash_set_debug(ht, key, klen, val, OS_FILE_LINE)
 void os_hash_set_debug(os_hash_t *ht, const void *key, int klen, const void *val, const char *file_line);
@@ -52,7 +73,21 @@ void *os_hash_get_debug(os_hash_t *ht, const void *key, int klen, const char *fi
 #define os_hash_get_or_set(ht, key, klen, val) os_hash_get_or_set_debug(ht, key, klen, val, OS_FILE_LINE)
 void *os_hash_get_or_set_debug(os_hash_t *ht,const void *key, int klen, const void *val, const char *file_line);
 
+/*
+ * Batched access: all keys are hashed and their buckets prefetched
+ * before the first one is resolved. klens may be NULL if every key is
+ * a string; get stores NULL for missing keys.
+ */
+void os_hash_set_bulk(os_hash_t *ht, const void * const keys[],
+        const int klens[], const void * const vals[], unsigned int n);
+void os_hash_get_bulk(os_hash_t *ht, const void * const keys[],
+        const int klens[], void *vals[], unsigned int n);
+/* same for a burst of keys that share one length, e.g. packet tuples */
+void os_hash_get_burst(os_hash_t *ht,
+        const void * const keys[], int klen, unsigned int n, void *vals[]);
+
 os_hash_index_t *os_hash_first(os_hash_t *ht);
+os_hash_index_t *os_hash_first_r(os_hash_t *ht, os_hash_index_t *hi);
 os_hash_index_t *os_hash_next(os_hash_index_t *hi);
 void os_hash_this(os_hash_index_t *hi, const void **key, int *klen, void **val);
 
@@ -60,6 +95,7 @@ const void* os_hash_this_key(os_hash_index_t *hi);
 int os_hash_this_key_len(os_hash_index_t *hi);
 void* os_hash_this_val(os_hash_index_t *hi);
 unsigned int os_hash_count(os_hash_t *ht);
+/* drop every entry; O(buckets), entries go back to the free list */
 void os_hash_clear(os_hash_t *ht);
 
 typedef int (os_hash_do_callback_fn_t)(void *rec, const void *key, int klen, const void *value);
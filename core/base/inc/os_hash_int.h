@@ -0,0 +1,59 @@
+/************************************************************************
+ *File name: os_hash_int.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_HASH_INT_H
+#define OS_HASH_INT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Integer-key maps: os_hash_u32_t and os_hash_u64_t.
+ *
+ * Keys and value pointers are stored inline in one open-addressing
+ * array (linear probing, Fibonacci hashing, backward-shift deletion),
+ * so a lookup is a multiply, a shift and usually one cache line.
+ *
+ * Semantics follow os_hash_t: a NULL value deletes the key, and the
+ * current entry may be deleted while iterating.
+ */
+#define OS_HASH_INT_DECLARE(name, ktype) \
+    typedef struct os_##name##_s os_##name##_t; \
+    typedef struct os_##name##_index_s os_##name##_index_t; \
+    \
+    os_##name##_t *os_##name##_make(void); \
+    void os_##name##_destroy(os_##name##_t *ht); \
+    void os_##name##_reserve(os_##name##_t *ht, unsigned int n); \
+    \
+    void os_##name##_set(os_##name##_t *ht, ktype key, const void *val); \
+    void *os_##name##_get(os_##name##_t *ht, ktype key); \
+    void *os_##name##_get_or_set(os_##name##_t *ht, ktype key, const void *val); \
+    /* os_##name##_get() for n keys, home slots prefetched first */ \
+    void os_##name##_get_burst(os_##name##_t *ht, \
+            const ktype keys[], unsigned int n, void *vals[]); \
+    \
+    os_##name##_index_t *os_##name##_first(os_##name##_t *ht); \
+    os_##name##_index_t *os_##name##_next(os_##name##_index_t *hi); \
+    ktype os_##name##_this_key(os_##name##_index_t *hi); \
+    void *os_##name##_this_val(os_##name##_index_t *hi); \
+    \
+    unsigned int os_##name##_count(os_##name##_t *ht); \
+    void os_##name##_clear(os_##name##_t *ht);
+
+OS_HASH_INT_DECLARE(hash_u32, uint32_t)
+OS_HASH_INT_DECLARE(hash_u64, uint64_t)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
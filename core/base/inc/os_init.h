@@ -29,26 +29,35 @@
 #define OS_USE_CMLOG
 #define CMLOG_ALLOW_CONSOLE_LOGS
 #define CMLOG_ALLOW_CLOCK_TIME
+//#define OS_OBJECT_REF_DEBUG
 
 #include "os_platform.h"
 
 //API
 #include "os_types.h"
+#include "os_atomic.h"
 
 #include "os_spool.h"
 #include "os_abort.h"
 #include "os_list.h"
 #include "os_hash.h"
+#include "os_flat_hash.h"
+#include "os_hash_int.h"
 #include "os_rbtree.h"
 #include "os_errno.h"
 #include "os_random.h"
 #include "os_time.h"
 #include "os_thread.h"
+#include "os_lock.h"
 #include "os_str.h"
 #include "os_buf.h"
+#include "os_slab.h"
 #include "os_mem.h"
+#include "os_arena.h"
+#include "os_rcu.h"
 #include "os_clog.h"
 #include "os_sockaddr.h"
+#include "os_lpm.h"
 #include "os_socket.h"
 #include "os_sockopt.h"
 #include "os_sockpair.h"
@@ -56,8 +65,11 @@
 #include "os_sctp.h"
 #include "os_poll.h"
 #include "os_notify.h"
+#include "os_resolver.h"
+#include "os_fiber.h"
 #include "os_queue.h"
 #include "os_ring.h"
+#include "os_task.h"
 
 #undef OS_BASE_INSIDE
 
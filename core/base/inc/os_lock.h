@@ -0,0 +1,134 @@
+/************************************************************************
+ *File name: os_lock.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_LOCK_H
+#define OS_LOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lightweight locks for short critical sections.
+ *
+ * os_spinlock_t  FIFO ticket lock, never sleeps. For sections of a few
+ *                instructions on threads that are not preempted inside.
+ * os_mutex_t     futex mutex: spins briefly, then sleeps in the kernel.
+ *                Uncontended lock/unlock is one atomic each.
+ * os_rwlock_t    futex reader-writer lock; a waiting writer holds off
+ *                new readers so writers cannot starve.
+ *
+ * Every lock keeps contention counters, updated while the lock is held
+ * so they cost no extra atomics. Read acquisitions of an rwlock are not
+ * counted, only their contention.
+ */
+typedef struct os_lock_stat_s {
+    uint64_t acquired;      /* exclusive acquisitions */
+    uint64_t contended;     /* acquisitions that had to wait */
+    uint64_t spins;         /* busy-wait rounds while waiting */
+    uint64_t sleeps;        /* futex waits while waiting */
+} os_lock_stat_t;
+
+#define OS_LOCK_SPIN 100    /* rounds before yielding or sleeping, 0 on one CPU */
+
+typedef struct os_spinlock_s {
+    uint32_t next;
+    uint32_t owner;
+    os_lock_stat_t stat;
+} os_spinlock_t;
+
+typedef struct os_mutex_s {
+    uint32_t state;         /* 0 free, 1 locked, 2 locked with sleepers */
+    os_lock_stat_t stat;
+} os_mutex_t;
+
+typedef struct os_rwlock_s {
+    uint32_t state;         /* writer and writer-waiting bits, readers */
+    uint32_t seq;           /* futex word, bumped on release */
+    unsigned int waiters;
+    os_lock_stat_t stat;
+} os_rwlock_t;
+
+void os_spinlock_init(os_spinlock_t *lock);
+void os_spinlock_lock_slow(os_spinlock_t *lock, uint32_t ticket);
+
+static os_inline void os_spinlock_lock(os_spinlock_t *lock)
+{
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, OS_MO_RELAXED);
+
+    if (os_unlikely(os_atomic_load(&lock->owner) != ticket))
+        os_spinlock_lock_slow(lock, ticket);
+    lock->stat.acquired++;
+}
+
+static os_inline bool os_spinlock_trylock(os_spinlock_t *lock)
+{
+    uint32_t owner = os_atomic_load(&lock->owner);
+    uint32_t next = owner;
+
+    if (!os_atomic_cas(&lock->next, &next, owner + 1))
+        return false;
+    lock->stat.acquired++;
+    return true;
+}
+
+static os_inline void os_spinlock_unlock(os_spinlock_t *lock)
+{
+    os_atomic_store(&lock->owner, os_atomic_load_relaxed(&lock->owner) + 1);
+}
+
+void os_mutex_init(os_mutex_t *lock);
+void os_mutex_lock_slow(os_mutex_t *lock);
+void os_mutex_unlock_slow(os_mutex_t *lock);
+
+static os_inline void os_mutex_lock(os_mutex_t *lock)
+{
+    uint32_t c = 0;
+
+    if (os_unlikely(!os_atomic_cas(&lock->state, &c, 1)))
+        os_mutex_lock_slow(lock);
+    lock->stat.acquired++;
+}
+
+static os_inline bool os_mutex_trylock(os_mutex_t *lock)
+{
+    uint32_t c = 0;
+
+    if (!os_atomic_cas(&lock->state, &c, 1))
+        return false;
+    lock->stat.acquired++;
+    return true;
+}
+
+static os_inline void os_mutex_unlock(os_mutex_t *lock)
+{
+    if (os_unlikely(os_atomic_fetch_sub(&lock->state, 1) != 1))
+        os_mutex_unlock_slow(lock);
+}
+
+void os_rwlock_init(os_rwlock_t *lock);
+void os_rwlock_rdlock(os_rwlock_t *lock);
+bool os_rwlock_tryrdlock(os_rwlock_t *lock);
+void os_rwlock_rdunlock(os_rwlock_t *lock);
+void os_rwlock_wrlock(os_rwlock_t *lock);
+bool os_rwlock_trywrlock(os_rwlock_t *lock);
+void os_rwlock_wrunlock(os_rwlock_t *lock);
+
+/* racy snapshot, good enough for monitoring */
+#define os_lock_stat(__lOCK) (&(__lOCK)->stat)
+void os_lock_stat_reset(os_lock_stat_t *stat);
+void os_lock_stat_show(const char *name, const os_lock_stat_t *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/************************************************************************
+ *File name: os_lpm.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_LPM_H
+#define OS_LPM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Longest-prefix-match table for os_ipsubnet_t prefixes.
+ *
+ * IPv4 uses DIR-24-8: one 2^24 entry table indexed by the top 24 bits,
+ * plus 256 entry groups for prefixes longer than /24, so a lookup is at
+ * most two memory reads. IPv6 uses a multibit trie with 8-bit strides,
+ * at most 16 reads.
+ *
+ * Each prefix carries a non-NULL user pointer returned on match.
+ * Lookups and updates must not run concurrently.
+ */
+typedef struct os_lpm_s os_lpm_t;
+
+os_lpm_t *os_lpm_create(void);
+void os_lpm_destroy(os_lpm_t *lpm);
+
+/* insert or replace; the mask must be contiguous */
+int os_lpm_add(os_lpm_t *lpm, const os_ipsubnet_t *subnet, void *data);
+/* @return OS_OK if removed, OS_ERROR if not present */
+int os_lpm_delete(os_lpm_t *lpm, const os_ipsubnet_t *subnet);
+/* exact-prefix lookup, NULL if not present */
+void *os_lpm_find(os_lpm_t *lpm, const os_ipsubnet_t *subnet);
+unsigned int os_lpm_count(os_lpm_t *lpm);
+
+/* @return data of the longest matching prefix, NULL if none */
+void *os_lpm_lookup(os_lpm_t *lpm, const os_sockaddr_t *addr);
+/* addr in network byte order */
+void *os_lpm_lookup_v4(os_lpm_t *lpm, uint32_t addr);
+void *os_lpm_lookup_v6(os_lpm_t *lpm, const struct in6_addr *addr);
+
+/* table entries for the whole batch are prefetched before resolving */
+void os_lpm_lookup_burst(os_lpm_t *lpm,
+        const os_sockaddr_t * const addrs[], unsigned int n, void *datas[]);
+void os_lpm_lookup_v4_burst(os_lpm_t *lpm,
+        const uint32_t addrs[], unsigned int n, void *datas[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
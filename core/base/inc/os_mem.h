@@ -55,7 +55,7 @@ void *os_realloc_debug( void *ptr, size_t size, const char *file_line);
 int os_free_debug(void *ptr);
 
 /*****************************************
- * Memory Pool - Use buf library
+ * Memory Pool - Use slab allocator
  *****************************************/
 
 #define os_malloc(size) os_malloc_debug(size, OS_FILE_LINE)
@@ -349,6 +349,14 @@ typedef intptr_t os_ssize_t;
 #define os_unlikely(v) v
 #endif
 
+#if defined(__GNUC__)
+#define os_prefetch(addr) __builtin_prefetch((addr), 0, 3)
+#define os_prefetch_w(addr) __builtin_prefetch((addr), 1, 3)
+#else
+#define os_prefetch(addr) ((void)(addr))
+#define os_prefetch_w(addr) ((void)(addr))
+#endif
+
 #if __GNUC__ > 2 || (__GNUC__ == 2 && __GNUC_MINOR__ > 4)
 #if !defined (__clang__) && OS_GNUC_CHECK_VERSION (4, 4)
 #define OS_GNUC_PRINTF(f, v) __attribute__ ((format (gnu_printf, f, v)))
@@ -499,11 +507,22 @@ PRIVATE os_inline os_uint24_t os_htobe24(os_uint24_t x)
 
 #define os_uint64_to_uint32(x) ((x >= 0xffffffffUL) ? 0xffffffffU : x)
 
-#define OS_OBJECT_REF(__oBJ) \
-    ((__oBJ)->reference_count)++;  os_log(DEBUG, "[REF] %d", ((__oBJ)->reference_count))
-#define OS_OBJECT_UNREF(__oBJ) \
-    os_log(DEBUG, "[UNREF] %d", ((__oBJ)->reference_count)); ((__oBJ)->reference_count)--
-#define OS_OBJECT_IS_REF(__oBJ) ((__oBJ)->reference_count > 1)
+/* reference_count is updated atomically, no lock is needed around REF/UNREF.
+ * Both macros evaluate to the new reference count. */
+#ifdef OS_OBJECT_REF_DEBUG
+#define OS_OBJECT_REF_LOG(__sTR, __cNT) os_log(DEBUG, __sTR " %d", (int)(__cNT))
+#else
+#define OS_OBJECT_REF_LOG(__sTR, __cNT) ((void)0)
+#endif
+#define OS_OBJECT_REF(__oBJ) ({ \
+    unsigned int __rEF = os_atomic_add_fetch(&(__oBJ)->reference_count, 1); \
+    OS_OBJECT_REF_LOG("[REF]", __rEF); \
+    __rEF; })
+#define OS_OBJECT_UNREF(__oBJ) ({ \
+    unsigned int __rEF = os_atomic_sub_fetch(&(__oBJ)->reference_count, 1); \
+    OS_OBJECT_REF_LOG("[UNREF]", __rEF); \
+    __rEF; })
+#define OS_OBJECT_IS_REF(__oBJ) (os_atomic_load(&(__oBJ)->reference_count) > 1)
 
 #ifdef __cplusplus
 }
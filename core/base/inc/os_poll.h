@@ -24,6 +24,11 @@ void os_pollset_destroy(os_pollset_t *pollset);
 #define OS_POLLIN      0x01
 #define OS_POLLOUT     0x02
 
+/*
+ * Only the os_poll_t pool is thread-safe; the backend's fd map is not.
+ * Add and remove from the thread running os_pollset_poll(), other
+ * threads hand the work over and wake it with os_pollset_notify().
+ */
 os_poll_t *os_pollset_add(os_pollset_t *pollset, short when, os_socket_t fd, os_poll_handler_f handler, void *data);
 void os_pollset_remove(os_poll_t *poll);
 
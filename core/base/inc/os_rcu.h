@@ -0,0 +1,85 @@
+/************************************************************************
+ *File name: os_rcu.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_RCU_H
+#define OS_RCU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Quiescent-state based RCU.
+ *
+ * Reader threads register once and then read shared data without any
+ * lock. Between two calls to os_rcu_quiescent() a reader may hold
+ * pointers obtained from RCU-protected structures; after the call it
+ * must not. The pollset reports a quiescent state on every
+ * os_pollset_poll() and goes offline while blocked in the kernel, so
+ * reactor threads only need os_rcu_thread_register().
+ *
+ * Writers unlink an object, then hand it to os_rcu_retire(); it is
+ * freed once every online reader has passed a quiescent state.
+ */
+#define OS_RCU_MAX_THREADS 64
+
+typedef void (*os_rcu_free_f)(void *ptr);
+
+void os_rcu_init(void);
+void os_rcu_final(void);
+
+int os_rcu_thread_register(void);
+void os_rcu_thread_unregister(void);
+bool os_rcu_thread_registered(void);
+
+void os_rcu_quiescent(void);
+void os_rcu_thread_offline(void);
+void os_rcu_thread_online(void);
+
+/* wait until every online reader has passed a quiescent state */
+void os_rcu_synchronize(void);
+
+/* defer fn(ptr) until readers can no longer hold ptr */
+void os_rcu_retire(void *ptr, os_rcu_free_f fn);
+/* free retired objects whose grace period has elapsed, never blocks */
+void os_rcu_reclaim(void);
+/* synchronize and free everything retired so far */
+void os_rcu_barrier(void);
+
+/*
+ * Read-mostly hash map on top of RCU.
+ *
+ * os_rcu_hash_get()/os_rcu_hash_do() are wait-free and may run on any
+ * registered thread. Writers are serialized by an internal mutex and
+ * publish with atomic pointer stores; replaced or deleted nodes and
+ * outgrown bucket arrays are retired through RCU. Values are owned by
+ * the caller, who retires them the same way.
+ */
+typedef struct os_rcu_hash_s os_rcu_hash_t;
+
+os_rcu_hash_t *os_rcu_hash_make(void);
+void os_rcu_hash_destroy(os_rcu_hash_t *ht);
+
+/* val == NULL deletes the key, klen may be OS_HASH_KEY_STRING */
+void os_rcu_hash_set(os_rcu_hash_t *ht, const void *key, int klen, const void *val);
+void *os_rcu_hash_get(os_rcu_hash_t *ht, const void *key, int klen);
+/* os_rcu_hash_get() for n keys of one length, buckets prefetched first */
+void os_rcu_hash_get_burst(os_rcu_hash_t *ht,
+        const void * const keys[], int klen, unsigned int n, void *vals[]);
+unsigned int os_rcu_hash_count(os_rcu_hash_t *ht);
+
+int os_rcu_hash_do(os_hash_do_callback_fn_t *comp, void *rec, os_rcu_hash_t *ht);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+/************************************************************************
+ *File name: os_resolver.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_RESOLVER_H
+#define OS_RESOLVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Asynchronous os_getaddrinfo().
+ *
+ * Lookups run on helper threads; results come back through an eventfd
+ * registered in the pollset, and callbacks run on the pollset thread.
+ * Answers are cached for conf.ttl. A cache hit or a numeric address is
+ * answered before os_resolver_getaddrinfo() returns.
+ *
+ * With conf.hosts_file set, names are resolved from that file only and
+ * DNS is never queried, which keeps tests deterministic. Otherwise the
+ * system resolver is used, so resolv.conf may point at a stub server.
+ *
+ * The resolver, like the pollset, belongs to one thread.
+ */
+typedef struct os_resolver_s os_resolver_t;
+
+typedef struct os_resolver_config_s {
+    int threads;            /* 0: 2 threads */
+    unsigned int queue;     /* max lookups in flight, 0: 256 */
+    os_time_t ttl;          /* cache lifetime, 0: no cache */
+    const char *hosts_file; /* non-NULL: hosts-only mode */
+} os_resolver_config_t;
+
+/*
+ * rv is OS_OK with a list the callback owns (os_freeaddrinfo), or
+ * OS_ERROR with NULL.
+ */
+typedef void (*os_resolve_cb_f)(int rv, os_sockaddr_t *sa_list, void *data);
+
+os_resolver_t *os_resolver_create(
+        os_pollset_t *pollset, const os_resolver_config_t *conf);
+void os_resolver_destroy(os_resolver_t *resolver);
+
+/* @return OS_ERROR if the request could not be queued, cb is not called */
+int os_resolver_getaddrinfo(os_resolver_t *resolver,
+        int family, const char *hostname, uint16_t port, int flags,
+        os_resolve_cb_f cb, void *data);
+
+/* pending lookups for data complete without calling back */
+void os_resolver_cancel(os_resolver_t *resolver, void *data);
+void os_resolver_flush(os_resolver_t *resolver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
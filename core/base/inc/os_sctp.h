@@ -63,10 +63,21 @@ typedef struct os_sctp_sock_s {
         os_poll_t  *write;         /* Write Poll */
     } poll;
 
-    os_list_t      write_queue;    /* Write Queue for Sending S1AP message */
+    /*
+     * One queue per stream, grown as stream numbers show up, so a
+     * backlog on one stream does not hold up the others. A zeroed
+     * struct is ready to use.
+     */
+    struct {
+        os_list_t  *queue;         /* indexed by stream number */
+        unsigned int streams;      /* queues allocated */
+        unsigned int next;         /* round-robin position */
+        unsigned int pending;      /* messages on all queues */
+    } write;
 } os_sctp_sock_t;
 
 typedef struct os_sctp_info_s {
+    uint32_t assoc_id;
     uint32_t ppid;
     uint16_t stream_no;
     uint16_t inbound_streams;
@@ -88,8 +99,109 @@ int os_sctp_initmsg(os_sock_t *sock, os_sockopt_t *option);
 int os_sctp_nodelay(os_sock_t *sock, int on);
 int os_sctp_so_linger(os_sock_t *sock, int l_linger);
 int os_sctp_sendmsg(os_sock_t *sock, const void *msg, size_t len, os_sockaddr_t *to, uint32_t ppid, uint16_t stream_no);
+/* at most this many messages per os_sctp_sendmmsg() */
+#define OS_SCTP_SEND_BATCH 16
+/*
+ * Send count buffers in one system call, each on its own stream/PPID.
+ * @return the number sent, or -1 if the first could not be
+ */
+int os_sctp_sendmmsg(os_sock_t *sock, os_buf_t **bufs, int count);
 int os_sctp_recvmsg(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from, os_sctp_info_t *sinfo, int *msg_flags);
 int os_sctp_recvdata(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from, os_sctp_info_t *sinfo);
+
+/*
+ * Receive one message straight into an os_buf sized from the socket's
+ * next pending message, reassembling partial deliveries. *buf carries
+ * a partly received message between calls: start with NULL and pass
+ * back whatever OS_RETRY left there. On OS_OK *buf is the message,
+ * with os_sctp_ppid_in_buf() and os_sctp_stream_no_in_buf() set.
+ * Messages over OS_CLUSTER_BIG_SIZE are drained and fail with OS_ERROR.
+ * @return OS_OK, OS_RETRY if the socket would block, OS_DONE if the
+ *         peer has closed, OS_ERROR (*buf freed)
+ */
+int os_sctp_recv_buf(os_sock_t *sock, os_buf_pool_t *pool,
+        os_buf_t **buf, os_sockaddr_t *from, os_sctp_info_t *sinfo);
+
+/*
+ * Notifications read by os_sctp_recv_buf() go to the handler registered
+ * for their sn_type, or are logged. Register before reading; a NULL
+ * handler unregisters.
+ */
+union sctp_notification;
+typedef void (*os_sctp_notify_f)(os_sock_t *sock,
+        const union sctp_notification *not, void *data);
+int os_sctp_notify_register(uint16_t type, os_sctp_notify_f handler, void *data);
+
+/* a new socket for one association of a SOCK_SEQPACKET socket */
+os_sock_t *os_sctp_peeloff(os_sock_t *sock, uint32_t assoc_id);
+/* stream counts of one association, from SCTP_STATUS */
+int os_sctp_assoc_streams(os_sock_t *sock, uint32_t assoc_id,
+        uint16_t *inbound, uint16_t *outbound);
+
+/*
+ * Associations of a one-to-many (SOCK_SEQPACKET) socket, keyed by
+ * assoc_id, so a received message finds its peer in O(1) whatever the
+ * number of peers. A table takes the SCTP_ASSOC_CHANGE and
+ * SCTP_PEER_ADDR_CHANGE notifications of its own socket; those of other
+ * sockets still go to os_sctp_notify_register() handlers or the log.
+ */
+typedef enum {
+    OS_SCTP_ASSOC_UP,       /* COMM_UP or RESTART */
+    OS_SCTP_ASSOC_DOWN,     /* COMM_LOST, SHUTDOWN_COMP, CANT_STR_ASSOC */
+    OS_SCTP_ASSOC_ADDR,     /* peer address change, see addr */
+} os_sctp_assoc_event_e;
+
+typedef struct os_sctp_assoc_s {
+    uint32_t        id;
+    os_sockaddr_t   addr;           /* primary peer address, if known */
+    uint16_t        inbound_streams;
+    uint16_t        outbound_streams;
+
+    struct {
+        uint64_t    rx_msgs;
+        uint64_t    rx_bytes;
+        uint64_t    tx_msgs;
+        uint64_t    tx_bytes;
+        uint64_t    addr_changes;
+    } stat;
+
+    void            *data;          /* for the user */
+} os_sctp_assoc_t;
+
+typedef struct os_sctp_assoc_table_s os_sctp_assoc_table_t;
+/* the association is freed once a DOWN event handler returns */
+typedef void (*os_sctp_assoc_f)(os_sctp_assoc_table_t *table,
+        os_sctp_assoc_t *assoc, os_sctp_assoc_event_e event, void *data);
+
+os_sctp_assoc_table_t *os_sctp_assoc_table_create(
+        os_sock_t *sock, os_sctp_assoc_f handler, void *data);
+void os_sctp_assoc_table_destroy(os_sctp_assoc_table_t *table);
+unsigned int os_sctp_assoc_count(os_sctp_assoc_table_t *table);
+
+os_sctp_assoc_t *os_sctp_assoc_find(
+        os_sctp_assoc_table_t *table, uint32_t assoc_id);
+/*
+ * Account a received message to its association, which is added if
+ * its COMM_UP has not been seen; its stream counts are then read with
+ * SCTP_STATUS and stay 0 if that fails.
+ */
+os_sctp_assoc_t *os_sctp_assoc_rx(os_sctp_assoc_table_t *table,
+        const os_sctp_info_t *sinfo, const os_sockaddr_t *from,
+        unsigned int len);
+
+static os_inline void os_sctp_assoc_tx(os_sctp_assoc_t *assoc, unsigned int len)
+{
+    assoc->stat.tx_msgs++;
+    assoc->stat.tx_bytes += len;
+}
+
+/*
+ * Move an association to its own socket, e.g. to serve a busy peer
+ * from another reactor. It leaves the table and is freed.
+ */
+os_sock_t *os_sctp_assoc_peeloff(os_sctp_assoc_table_t *table,
+        os_sctp_assoc_t *assoc);
+
 int os_sctp_senddata(os_sock_t *sock, os_buf_t *buf, os_sockaddr_t *addr);
 void os_sctp_write_to_buffer(os_pollset_t *pollset, os_sctp_sock_t *sctp, os_buf_t *buf);
 void os_sctp_flush_and_destroy(os_sctp_sock_t *sctp);
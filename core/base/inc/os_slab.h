@@ -0,0 +1,50 @@
+/************************************************************************
+ *File name: os_slab.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_SLAB_H
+#define OS_SLAB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Thread-caching slab allocator behind os_malloc()/os_free().
+ *
+ * Small requests (up to OS_SLAB_MAX_SIZE) are served from per-thread
+ * free lists of fixed size classes, refilled in batches from a
+ * per-class central list. Larger requests are mapped with mmap().
+ * Every block remembers its allocation site so that os_slab_final()
+ * can report leaks by file_line.
+ */
+#define OS_SLAB_MIN_SIZE    16
+#define OS_SLAB_MAX_SIZE    4096
+
+void os_slab_init(void);
+/* spans stay mapped until other threads' caches are gone at their exit */
+void os_slab_final(void);
+
+void *os_slab_alloc(size_t size, const char *file_line);
+void os_slab_free(void *ptr);
+size_t os_slab_size(const void *ptr);
+/* change the size in place if it stays in the same class; @return false if not */
+bool os_slab_resize(void *ptr, size_t size);
+
+/* return the calling thread's cached blocks to the central lists */
+void os_slab_thread_flush(void);
+
+void os_slab_show_avail(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -109,6 +109,90 @@ int os_inet_pton(int family, const char *src, void *sa);
 socklen_t os_sockaddr_len(const void *sa);
 bool os_sockaddr_is_equal(const void *p, const void *q);
 
+/*
+ * Compact canonical form of an address and port: 20 bytes instead of
+ * the sockaddr_storage union, with no pointers. IPv4 addresses take
+ * the first 4 bytes of addr, the rest is zero.
+ */
+typedef struct os_sockaddr_key_s {
+    uint16_t family;
+    uint16_t port;      /* network byte order */
+    uint8_t addr[16];
+} os_sockaddr_key_t;
+
+static os_inline void os_sockaddr_key(os_sockaddr_key_t *key, const void *sa)
+{
+    const os_sockaddr_t *addr = sa;
+
+    memset(key, 0, sizeof *key);
+    key->family = addr->os_sa_family;
+
+    switch (key->family) {
+    case AF_INET:
+        key->port = addr->sin.sin_port;
+        memcpy(key->addr, &addr->sin.sin_addr, sizeof(struct in_addr));
+        break;
+    case AF_INET6:
+        key->port = addr->sin6.sin6_port;
+        memcpy(key->addr, &addr->sin6.sin6_addr, sizeof(struct in6_addr));
+        break;
+    default:
+        break;
+    }
+}
+
+static os_inline bool os_sockaddr_key_is_equal(
+        const os_sockaddr_key_t *a, const os_sockaddr_key_t *b)
+{
+    uint64_t a0, a1, b0, b1;
+    uint32_t ah, bh;
+
+    memcpy(&ah, a, 4); memcpy(&a0, a->addr, 8); memcpy(&a1, a->addr + 8, 8);
+    memcpy(&bh, b, 4); memcpy(&b0, b->addr, 8); memcpy(&b1, b->addr + 8, 8);
+
+    return ((ah ^ bh) | (a0 ^ b0) | (a1 ^ b1)) == 0;
+}
+
+/* two folded 64x64->128 multiplies, as in wyhash, over the three words */
+static os_inline uint64_t os_sockaddr_key_hash(
+        const os_sockaddr_key_t *key, uint64_t seed)
+{
+#if defined(__SIZEOF_INT128__)
+    uint64_t a0, a1, h;
+    uint32_t head;
+    __uint128_t r;
+
+    memcpy(&head, key, 4);
+    memcpy(&a0, key->addr, 8);
+    memcpy(&a1, key->addr + 8, 8);
+
+    r = (__uint128_t)(a0 ^ seed ^ 0x2d358dccaa6c78a5ULL) *
+        (a1 ^ 0x8bb84b93962eacc9ULL);
+    h = (uint64_t)r ^ (uint64_t)(r >> 64);
+    r = (__uint128_t)(h ^ head ^ 0x4b33a62ed433d4a3ULL) * 0x4d5a2da51de1aa47ULL;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    return os_hash64(key, sizeof(*key), seed);
+#endif
+}
+
+/*
+ * Map from address and port to a caller object, for demultiplexing
+ * peers on one-to-many SCTP and UDP sockets. Entries are stored inline
+ * in an os_flat_hash_t keyed by os_sockaddr_key_t, so the table can be
+ * walked with os_flat_hash_first()/next().
+ */
+typedef os_flat_hash_t os_sockaddr_map_t;
+
+os_sockaddr_map_t *os_sockaddr_map_make(void);
+void os_sockaddr_map_destroy(os_sockaddr_map_t *map);
+/* obj == NULL deletes the address */
+void os_sockaddr_map_set(os_sockaddr_map_t *map, const void *sa, void *obj);
+void *os_sockaddr_map_get(os_sockaddr_map_t *map, const void *sa);
+void *os_sockaddr_map_get_key(os_sockaddr_map_t *map, const os_sockaddr_key_t *key);
+unsigned int os_sockaddr_map_count(os_sockaddr_map_t *map);
+
 int os_ipsubnet(os_ipsubnet_t *ipsub,
         const char *ipstr, const char *mask_or_numbits);
 
@@ -18,11 +18,16 @@ extern "C" {
 
 typedef unsigned int os_index_t;
 
+/* generation << 32 | index, 0 is never a valid handle */
+typedef uint64_t os_handle_t;
+#define OS_HANDLE_INVALID 0
+
 #define OS_POOL(pool, type) \
     struct { \
         const char *name; \
         int head, tail, size, avail; \
         type **free, *array, **index; \
+        uint32_t *gen; \
     } pool
 
 #define os_pool_init(pool, _size) do { \
@@ -34,6 +39,8 @@ typedef unsigned int os_index_t;
     os_assert((pool)->array); \
     (pool)->index = malloc(sizeof(*(pool)->index) * _size); \
     os_assert((pool)->index); \
+    (pool)->gen = calloc(_size, sizeof(*(pool)->gen)); \
+    os_assert((pool)->gen); \
     (pool)->size = (pool)->avail = _size; \
     (pool)->head = (pool)->tail = 0; \
     for (i = 0; i < _size; i++) { \
@@ -49,6 +56,7 @@ typedef unsigned int os_index_t;
     free((pool)->free); \
     free((pool)->array); \
     free((pool)->index); \
+    free((pool)->gen); \
 } while (0)
 
 #define os_pool_index(pool, node) (((node) - (pool)->array)+1)
@@ -74,12 +82,142 @@ typedef unsigned int os_index_t;
         (pool)->free[(pool)->tail] = (void*)(node); \
         (pool)->tail = ((pool)->tail + 1) % ((pool)->size); \
         (pool)->index[os_pool_index(pool, node)-1] = NULL; \
+        (pool)->gen[os_pool_index(pool, node)-1]++; \
     } \
 } while (0)
 
+/*
+ * Generational handles: a handle taken from a node resolves back to it
+ * until the node is freed, after which os_pool_handle_get() returns NULL
+ * even if the slot has been reused. Works on OS_POOL and OS_CPOOL.
+ */
+#define os_pool_handle(pool, node) \
+    (((os_handle_t)os_atomic_load_relaxed( \
+            &(pool)->gen[os_pool_index(pool, node)-1]) << 32) | \
+        (os_handle_t)os_pool_index(pool, node))
+
+/*
+ * The generation is read again after the node, like a seqlock, so a
+ * node freed and reallocated between the two loads is not returned.
+ */
+#define os_pool_handle_get(pool, handle) ({ \
+    os_handle_t __h = (handle); \
+    uint32_t __i = (uint32_t)__h; \
+    __typeof__((pool)->array) __n = NULL; \
+    if (__i > 0 && __i <= (uint32_t)(pool)->size && \
+            os_atomic_load(&(pool)->gen[__i-1]) == (uint32_t)(__h >> 32)) { \
+        __n = os_atomic_load(&(pool)->index[__i-1]); \
+        if (os_atomic_load(&(pool)->gen[__i-1]) != (uint32_t)(__h >> 32)) \
+            __n = NULL; \
+    } \
+    __n; \
+})
+
 #define os_pool_size(pool) ((pool)->size)
 #define os_pool_avail(pool) ((pool)->avail)
 
+/* @return the number of nodes allocated, stops at the first failure */
+#define os_pool_alloc_bulk(pool, nodes, n) ({ \
+    int __i; \
+    for (__i = 0; __i < (int)(n); __i++) { \
+        os_pool_alloc(pool, &(nodes)[__i]); \
+        if (!(nodes)[__i]) \
+            break; \
+    } \
+    __i; \
+})
+
+#define os_pool_free_bulk(pool, nodes, n) do { \
+    int __i; \
+    for (__i = 0; __i < (int)(n); __i++) \
+        os_pool_free(pool, (nodes)[__i]); \
+} while (0)
+
+/////////////////////////////////////////////////////////
+/*
+ * OS_CPOOL: thread-safe variant of OS_POOL.
+ *
+ * Free nodes live on a lock-free stack of array indices whose top carries
+ * an ABA tag, and every thread keeps a small cache of indices per pool.
+ * os_pool_index()/os_pool_find()/os_pool_size() work on both kinds of pool.
+ * When the stack runs dry, allocation drains the other threads' caches
+ * before giving up; pools smaller than 16 * OS_CPOOL_MIN_CACHE do not
+ * cache at all.
+ */
+#define OS_CPOOL_MAX_THREADS 64
+#define OS_CPOOL_CACHE_SIZE  64
+#define OS_CPOOL_MIN_CACHE   4
+
+typedef struct os_cpool_cache_s os_cpool_cache_t;
+
+typedef struct os_cpool_core_s {
+    uint64_t top OS_CACHELINE_ALIGNED; /* tag << 32 | (index + 1) */
+    int count;
+
+    uint32_t *next OS_CACHELINE_ALIGNED;
+    unsigned char *array;
+    void **index;
+    uint32_t *gen;
+    size_t elem_size;
+    int size;
+    int cache_size;
+    const char *name;
+
+    os_cpool_cache_t *cache[OS_CPOOL_MAX_THREADS];
+} os_cpool_core_t;
+
+void os_cpool_core_init(os_cpool_core_t *core, const char *name,
+        void *array, size_t elem_size, void **index, uint32_t *gen, int size);
+void os_cpool_core_final(os_cpool_core_t *core);
+void *os_cpool_core_alloc(os_cpool_core_t *core);
+void os_cpool_core_free(os_cpool_core_t *core, void *node);
+int os_cpool_core_alloc_bulk(os_cpool_core_t *core, void **nodes, int n);
+void os_cpool_core_free_bulk(os_cpool_core_t *core, void **nodes, int n);
+int os_cpool_core_avail(os_cpool_core_t *core);
+
+#define OS_CPOOL(pool, type) \
+    struct { \
+        const char *name; \
+        int size; \
+        type *array, **index; \
+        uint32_t *gen; \
+        os_cpool_core_t core; \
+    } pool
+
+#define os_cpool_init(pool, _size) do { \
+    (pool)->name = #pool; \
+    (pool)->size = _size; \
+    (pool)->array = malloc(sizeof(*(pool)->array) * _size); \
+    os_assert((pool)->array); \
+    (pool)->index = calloc(_size, sizeof(*(pool)->index)); \
+    os_assert((pool)->index); \
+    (pool)->gen = calloc(_size, sizeof(*(pool)->gen)); \
+    os_assert((pool)->gen); \
+    os_cpool_core_init(&(pool)->core, #pool, (pool)->array, \
+            sizeof(*(pool)->array), (void **)(pool)->index, (pool)->gen, _size); \
+} while (0)
+
+#define os_cpool_final(pool) do { \
+    os_cpool_core_final(&(pool)->core); \
+    free((pool)->array); \
+    free((pool)->index); \
+    free((pool)->gen); \
+} while (0)
+
+#define os_cpool_alloc(pool, node) do { \
+    *(node) = os_cpool_core_alloc(&(pool)->core); \
+} while (0)
+
+#define os_cpool_free(pool, node) \
+    os_cpool_core_free(&(pool)->core, (void *)(node))
+
+#define os_cpool_alloc_bulk(pool, nodes, n) \
+    os_cpool_core_alloc_bulk(&(pool)->core, (void **)(nodes), n)
+#define os_cpool_free_bulk(pool, nodes, n) \
+    os_cpool_core_free_bulk(&(pool)->core, (void **)(nodes), n)
+
+#define os_cpool_avail(pool) os_cpool_core_avail(&(pool)->core)
+
 
 //type :: uint8_t
 #define os_pool_order_id_generate(pool) do { \
@@ -112,6 +250,8 @@ typedef unsigned int os_index_t;
     os_assert((pool)->array); \
     (pool)->index = malloc(sizeof(*(pool)->index) * _size); \
     os_assert((pool)->index); \
+    (pool)->gen = calloc(_size, sizeof(*(pool)->gen)); \
+    os_assert((pool)->gen); \
     (pool)->size = (pool)->avail = _size; \
     (pool)->head = (pool)->tail = 0; \
     os_pool_order_id_generate(pool);\
@@ -128,6 +268,7 @@ typedef unsigned int os_index_t;
     free((pool)->free); \
     free((pool)->array); \
     free((pool)->index); \
+    free((pool)->gen); \
 } while (0)
 
 #ifdef __cplusplus
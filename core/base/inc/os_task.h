@@ -0,0 +1,63 @@
+/************************************************************************
+ *File name: os_task.h
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#if !defined(OS_BASE_INSIDE) && !defined(OS_BASE_COMPILATION)
+#error "This header file cannot be directly referenced."
+#endif
+
+#ifndef OS_TASK_H
+#define OS_TASK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Work-stealing scheduler for CPU-bound jobs.
+ *
+ * Every worker owns a Chase-Lev deque: it pushes and pops its own end
+ * without atomics read-modify-write, idle workers steal from the other
+ * end of a randomly chosen victim. Tasks spawned from outside the
+ * workers go through a shared injection queue.
+ *
+ * Tasks are joined through a group: os_task_spawn() adds a child to the
+ * group and os_task_wait() returns once all of them have run. A task may
+ * spawn and wait on its own group; the waiting worker runs other tasks
+ * meanwhile instead of blocking.
+ */
+typedef struct os_task_sched_s os_task_sched_t;
+
+typedef struct os_task_group_s {
+    unsigned int pending;
+} os_task_group_t;
+
+typedef void (*os_task_fn_f)(void *data);
+
+/* threads 0: one per online CPU */
+os_task_sched_t *os_task_sched_create(const os_thread_attr_t *attr, int threads);
+/* every group must have been waited on */
+void os_task_sched_destroy(os_task_sched_t *sched);
+int os_task_sched_threads(os_task_sched_t *sched);
+
+#define os_task_group_init(__gROUP) ((__gROUP)->pending = 0)
+int os_task_spawn(os_task_sched_t *sched,
+        os_task_group_t *group, os_task_fn_f fn, void *data);
+void os_task_wait(os_task_sched_t *sched, os_task_group_t *group);
+
+/*
+ * out[i] = fn(in[i], data) for every i, spread over the workers.
+ * Returns once all n results are in place, so out keeps the order of in.
+ */
+typedef os_buf_t *(*os_task_buf_f)(os_buf_t *in, void *data);
+void os_task_map_buf(os_task_sched_t *sched, os_buf_t *in[], os_buf_t *out[],
+        unsigned int n, os_task_buf_f fn, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,19 +28,37 @@ extern "C" {
 #define os_thread_mutex_unlock (void)pthread_mutex_unlock
 #define os_thread_mutex_destroy (void)pthread_mutex_destroy
 #define os_thread_cond_t pthread_cond_t
+/*
+ * Condition variables time out against CLOCK_MONOTONIC, so stepping the
+ * wall clock neither cuts a wait short nor stretches it.
+ */
+#if defined(__APPLE__)
+#define OS_THREAD_COND_CLOCK CLOCK_REALTIME
 #define os_thread_cond_init(_n) (void)pthread_cond_init((_n), NULL)
+#else
+#define OS_THREAD_COND_CLOCK CLOCK_MONOTONIC
+__attribute__((unused)) PRIVATE os_inline void os_thread_cond_init(
+        pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+#endif
 #define os_thread_cond_wait pthread_cond_wait
 __attribute__((unused)) PRIVATE os_inline int os_thread_cond_timedwait(
         pthread_cond_t *cond, pthread_mutex_t *mutex, os_time_t timeout)
 {
     int r;
     struct timespec to;
-    struct timeval tv;
     os_time_t usec;
 
-    os_gettimeofday(&tv);
+    clock_gettime(OS_THREAD_COND_CLOCK, &to);
 
-    usec = os_time_from_sec(tv.tv_sec) + tv.tv_usec + timeout;
+    usec = os_time_from_sec(to.tv_sec) + to.tv_nsec / 1000 + timeout;
 
     to.tv_sec = os_time_sec(usec);
     to.tv_nsec = os_time_usec(usec) * 1000;
@@ -96,10 +114,132 @@ PRIVATE os_inline int os_thread_cond_destroy(os_thread_cond_t *_ignored)
 }
 #endif
 
+/*
+ * Wait queue for use under a mutex, like a condition variable but with
+ * a relative timeout. On Linux it is a futex: the wait takes no clock
+ * reading and times out on CLOCK_MONOTONIC. Wakeups may be spurious,
+ * so callers re-check what they wait for.
+ */
+typedef struct os_thread_waitq_s {
+    uint32_t seq;
+    unsigned int waiters;
+#if !defined(__linux__)
+    os_thread_cond_t cond;
+#endif
+} os_thread_waitq_t;
+
+void os_thread_waitq_init(os_thread_waitq_t *wq);
+void os_thread_waitq_destroy(os_thread_waitq_t *wq);
+/* mutex held; timeout < 0 waits forever. @return OS_OK or OS_TIMEUP */
+int os_thread_waitq_wait(os_thread_waitq_t *wq,
+        os_thread_mutex_t *mutex, os_time_t timeout);
+/* mutex held */
+void os_thread_waitq_signal(os_thread_waitq_t *wq);
+void os_thread_waitq_broadcast(os_thread_waitq_t *wq);
+
+#if defined(__linux__)
+/*
+ * Sleep while *addr == expected, at most timeout (relative, < 0 forever).
+ * @return OS_OK when woken or *addr differs, OS_TIMEUP
+ */
+int os_futex_wait(uint32_t *addr, uint32_t expected, os_time_t timeout);
+/* @return the number of threads woken */
+int os_futex_wake(uint32_t *addr, int count);
+#endif
+
 typedef struct os_thread_s os_thread_t;
 
-//os_thread_t *os_thread_create(void (*func)(void *), void *data);
-//void os_thread_destroy(os_thread_t *thread, int delay);
+typedef struct os_thread_attr_s {
+    const char *name;       /* at most 15 characters are kept */
+    uint64_t cpu_mask;      /* CPUs 0..63 the thread may run on, 0: any */
+    int priority;           /* SCHED_FIFO 1..99, 0: SCHED_OTHER */
+    size_t stack_size;      /* 0: system default */
+} os_thread_attr_t;
+
+os_thread_t *os_thread_create(void (*func)(void *), void *data);
+/*
+ * Without CAP_SYS_NICE a SCHED_FIFO request falls back to SCHED_OTHER
+ * with a warning rather than failing.
+ */
+os_thread_t *os_thread_create_ex(const os_thread_attr_t *attr,
+        void (*func)(void *), void *data);
+/*
+ * A negative timeout waits forever.
+ * @return OS_OK once the thread has returned, OS_TIMEUP if still running
+ */
+int os_thread_join_timeout(os_thread_t *thread, os_time_t timeout);
+/*
+ * Wait up to delay milliseconds (forever if negative) for the thread to
+ * return, then free it. A thread that is still running is detached and
+ * frees itself later.
+ */
+void os_thread_destroy(os_thread_t *thread, int delay);
+os_thread_id_t os_thread_id(os_thread_t *thread);
+
+/*
+ * Per-thread context, found through a __thread pointer instead of
+ * pthread_getspecific(). A subsystem registers a slot once and keeps
+ * its per-thread state there; the slot's free callback runs when the
+ * thread exits, newest slot first. Threads made by os_thread_create()
+ * tear their context down before a joiner sees them finish.
+ */
+#define OS_THREAD_CTX_SLOTS 16
+
+typedef void (*os_thread_slot_free_f)(void *data);
+
+typedef struct os_thread_ctx_s {
+    unsigned int id;            /* 1, 2, ... in order of creation */
+    os_thread_t *thread;        /* NULL unless made by os_thread_create() */
+    void *slot[OS_THREAD_CTX_SLOTS];
+} os_thread_ctx_t;
+
+extern __thread os_thread_ctx_t *os_thread_ctx_self
+    __attribute__((tls_model("initial-exec")));
+
+os_thread_ctx_t *os_thread_ctx_create(void);
+/* run the free callbacks now; the context comes back if used again */
+void os_thread_ctx_exit(void);
+
+static os_inline os_thread_ctx_t *os_thread_ctx(void)
+{
+    os_thread_ctx_t *ctx = os_thread_ctx_self;
+
+    if (os_likely(ctx))
+        return ctx;
+    return os_thread_ctx_create();
+}
+
+/* once per subsystem, fn may be NULL. @return the slot or OS_ERROR */
+int os_thread_slot_register(os_thread_slot_free_f fn);
+
+/* NULL until set, does not create the context */
+static os_inline void *os_thread_slot_get(int slot)
+{
+    os_thread_ctx_t *ctx = os_thread_ctx_self;
+
+    return ctx ? ctx->slot[slot] : NULL;
+}
+
+static os_inline void os_thread_slot_set(int slot, void *data)
+{
+    os_thread_ctx()->slot[slot] = data;
+}
+
+/*
+ * Fixed set of worker threads fed through a bounded lock-free MPMC
+ * queue. Submission never blocks: a full queue returns OS_RETRY.
+ * Idle workers sleep and are woken only when they are needed.
+ */
+typedef struct os_thread_pool_s os_thread_pool_t;
+typedef void (*os_task_f)(void *data);
+
+/* threads are named "<attr->name>-<n>", capacity is rounded up to 2^n */
+os_thread_pool_t *os_thread_pool_create(const os_thread_attr_t *attr,
+        int threads, unsigned int capacity);
+/* runs the tasks already queued, then joins the workers */
+void os_thread_pool_destroy(os_thread_pool_t *pool);
+int os_thread_pool_submit(os_thread_pool_t *pool, os_task_f task, void *data);
+unsigned int os_thread_pool_pending(os_thread_pool_t *pool);
 
 #ifdef __cplusplus
 }
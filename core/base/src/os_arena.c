@@ -0,0 +1,367 @@
+/************************************************************************
+ *File name: os_arena.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+struct os_arena_chunk_s {
+    os_arena_chunk_t *next;
+    os_buf_t *buf;          /* NULL if beyond the largest cluster */
+    void *mem;              /* then it came from os_malloc() */
+    unsigned char *end;
+};
+
+#define OS_ARENA_ROUNDUP(x) \
+    (((x) + OS_ARENA_ALIGN - 1) & ~((size_t)OS_ARENA_ALIGN - 1))
+#define OS_ARENA_ALIGN_PTR(p) \
+    ((unsigned char *)OS_ARENA_ROUNDUP((uintptr_t)(p)))
+
+#define OS_ARENA_CHUNK_HDR OS_ARENA_ROUNDUP(sizeof(os_arena_chunk_t))
+#define OS_ARENA_MIN_CHUNK 512
+
+PRIVATE os_arena_chunk_t *arena_chunk_alloc(
+        os_arena_t *arena, size_t size, const char *file_line)
+{
+    os_arena_chunk_t *chunk = NULL;
+    os_buf_t *buf = NULL;
+    void *mem = NULL;
+
+    /* os_buf_alloc() cannot go past the largest cluster */
+    if (size > OS_CLUSTER_BIG_SIZE) {
+        mem = os_malloc(size);
+        if (!mem) {
+            os_log(ERROR, "os_malloc() failed [size=%zu]", size);
+            return NULL;
+        }
+
+        chunk = (os_arena_chunk_t *)OS_ARENA_ALIGN_PTR(mem);
+        chunk->next = NULL;
+        chunk->buf = NULL;
+        chunk->mem = mem;
+        chunk->end = (unsigned char *)mem + size;
+
+        return chunk;
+    }
+
+    buf = os_buf_alloc_debug(arena->pool, size, file_line);
+    if (!buf) {
+        os_log(ERROR, "os_buf_alloc() failed [size=%d]", (int)size);
+        return NULL;
+    }
+
+    chunk = (os_arena_chunk_t *)OS_ARENA_ALIGN_PTR(buf->head);
+    chunk->next = NULL;
+    chunk->buf = buf;
+    chunk->mem = NULL;
+    chunk->end = buf->end;
+
+    return chunk;
+}
+
+PRIVATE void arena_chunk_free(os_arena_chunk_t *chunk)
+{
+    if (chunk->buf)
+        os_buf_free(chunk->buf);
+    else
+        os_free(chunk->mem);
+}
+
+PRIVATE os_inline unsigned char *arena_chunk_data(os_arena_chunk_t *chunk)
+{
+    return (unsigned char *)chunk + OS_ARENA_CHUNK_HDR;
+}
+
+/* the first chunk also carries the arena itself */
+PRIVATE os_inline unsigned char *arena_base(os_arena_t *arena)
+{
+    return (unsigned char *)arena + OS_ARENA_ROUNDUP(sizeof(os_arena_t));
+}
+
+PRIVATE void arena_release(os_arena_t *arena,
+        os_arena_chunk_t *chunk, os_arena_chunk_t *large)
+{
+    os_arena_chunk_t *next = NULL;
+
+    while (arena->large != large) {
+        os_assert(arena->large);
+        next = arena->large->next;
+        arena_chunk_free(arena->large);
+        arena->large = next;
+    }
+
+    while (arena->chunk != chunk) {
+        os_assert(arena->chunk);
+        next = arena->chunk->next;
+        arena_chunk_free(arena->chunk);
+        arena->chunk = next;
+    }
+}
+
+os_arena_t *os_arena_create_debug(
+        os_buf_pool_t *pool, unsigned int chunk_size, const char *file_line)
+{
+    os_arena_t *arena = NULL;
+    os_arena_chunk_t *chunk = NULL;
+    os_arena_t tmp;
+
+    if (chunk_size == 0)
+        chunk_size = OS_ARENA_DEFAULT_CHUNK;
+    if (chunk_size < OS_ARENA_MIN_CHUNK)
+        chunk_size = OS_ARENA_MIN_CHUNK;
+
+    memset(&tmp, 0, sizeof tmp);
+    tmp.pool = pool;
+
+    chunk = arena_chunk_alloc(&tmp, chunk_size, file_line);
+    if (!chunk)
+        return NULL;
+
+    arena = (os_arena_t *)arena_chunk_data(chunk);
+    memcpy(arena, &tmp, sizeof *arena);
+
+    arena->chunk = chunk;
+    arena->chunk_size = chunk_size;
+    arena->file_line = file_line;
+
+    arena->ptr = arena_base(arena);
+    arena->end = chunk->end;
+
+    return arena;
+}
+
+void os_arena_destroy(os_arena_t *arena)
+{
+    os_arena_chunk_t *first = NULL;
+
+    os_assert(arena);
+
+    for (first = arena->chunk; first->next; first = first->next);
+
+    arena_release(arena, first, NULL);
+
+    /* arena lives in this chunk, nothing may touch it afterwards */
+    arena_chunk_free(first);
+}
+
+void os_arena_reset(os_arena_t *arena)
+{
+    os_arena_chunk_t *first = NULL;
+
+    os_assert(arena);
+
+    for (first = arena->chunk; first->next; first = first->next);
+
+    arena_release(arena, first, NULL);
+
+    arena->ptr = arena_base(arena);
+    arena->end = first->end;
+    arena->used = 0;
+}
+
+void *os_arena_alloc_slow(os_arena_t *arena, size_t size)
+{
+    os_arena_chunk_t *chunk = NULL;
+    unsigned char *p = NULL;
+
+    os_assert(arena);
+
+    if (size == 0)
+        size = OS_ARENA_ALIGN;
+
+    /* big blocks get their own chunk so the current one is not wasted */
+    if (size > arena->chunk_size / 4) {
+        if (size > SIZE_MAX / 2) {
+            os_log(ERROR, "os_arena_alloc() too large [size=%zu]", size);
+            return NULL;
+        }
+        /* keep room to re-align the payload behind the header */
+        chunk = arena_chunk_alloc(arena,
+                size + OS_ARENA_CHUNK_HDR + OS_ARENA_ALIGN, arena->file_line);
+        if (!chunk)
+            return NULL;
+
+        chunk->next = arena->large;
+        arena->large = chunk;
+        arena->used += size;
+
+        return arena_chunk_data(chunk);
+    }
+
+    chunk = arena_chunk_alloc(arena, arena->chunk_size, arena->file_line);
+    if (!chunk)
+        return NULL;
+
+    chunk->next = arena->chunk;
+    arena->chunk = chunk;
+
+    p = arena_chunk_data(chunk);
+    arena->ptr = p + size;
+    arena->end = chunk->end;
+    arena->used += size;
+
+    return p;
+}
+
+void *os_arena_calloc(os_arena_t *arena, size_t nmemb, size_t size)
+{
+    void *p = NULL;
+
+    if (size && nmemb > SIZE_MAX / size) {
+        os_log(ERROR, "os_arena_calloc() overflow [nmemb=%zu, size=%zu]", nmemb, size);
+        return NULL;
+    }
+
+    p = os_arena_alloc(arena, nmemb * size);
+    if (p)
+        memset(p, 0, nmemb * size);
+
+    return p;
+}
+
+char *os_arena_strdup(os_arena_t *arena, const char *s)
+{
+    if (!s)
+        return NULL;
+
+    return os_arena_memdup(arena, s, strlen(s) + 1);
+}
+
+char *os_arena_strndup(os_arena_t *arena, const char *s, size_t n)
+{
+    char *p = NULL;
+    const char *end = NULL;
+
+    if (!s)
+        return NULL;
+
+    end = memchr(s, '\0', n);
+    if (end)
+        n = end - s;
+
+    p = os_arena_alloc(arena, n + 1);
+    if (p) {
+        memcpy(p, s, n);
+        p[n] = '\0';
+    }
+
+    return p;
+}
+
+void *os_arena_memdup(os_arena_t *arena, const void *m, size_t n)
+{
+    void *p = NULL;
+
+    if (!m)
+        return NULL;
+
+    p = os_arena_alloc(arena, n);
+    if (p)
+        memcpy(p, m, n);
+
+    return p;
+}
+
+void os_arena_mark(os_arena_t *arena, os_arena_mark_t *mark)
+{
+    os_assert(arena);
+    os_assert(mark);
+
+    mark->chunk = arena->chunk;
+    mark->large = arena->large;
+    mark->ptr = arena->ptr;
+    mark->used = arena->used;
+}
+
+void os_arena_rewind(os_arena_t *arena, const os_arena_mark_t *mark)
+{
+    os_assert(arena);
+    os_assert(mark);
+
+    arena_release(arena, mark->chunk, mark->large);
+
+    arena->ptr = mark->ptr;
+    arena->end = mark->chunk->end;
+    arena->used = mark->used;
+}
+
+bool os_arena_contains(os_arena_t *arena, const void *ptr)
+{
+    os_arena_chunk_t *chunk = NULL;
+    const unsigned char *p = ptr;
+
+    os_assert(arena);
+
+    for (chunk = arena->chunk; chunk; chunk = chunk->next) {
+        if (p >= arena_chunk_data(chunk) && p < chunk->end)
+            return true;
+    }
+    for (chunk = arena->large; chunk; chunk = chunk->next) {
+        if (p >= arena_chunk_data(chunk) && p < chunk->end)
+            return true;
+    }
+
+    return false;
+}
+
+PRIVATE __thread os_arena_t *cjson_arena = NULL;
+PRIVATE pthread_once_t cjson_hooks_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Detached, these are cJSON's own defaults, so items made before the
+ * hooks went in can still be freed. Attached, freeing is a no-op: arena
+ * memory goes away with os_arena_reset(), and telling it apart from
+ * heap memory would cost a walk over the chunks on every free.
+ */
+PRIVATE void *cjson_arena_malloc(size_t size)
+{
+    if (cjson_arena)
+        return os_arena_alloc(cjson_arena, size);
+
+    return malloc(size);
+}
+
+PRIVATE void cjson_arena_free(void *ptr)
+{
+    if (!cjson_arena)
+        free(ptr);
+}
+
+PRIVATE void cjson_hooks_install(void)
+{
+    cJSON_Hooks hooks = { cjson_arena_malloc, cjson_arena_free };
+
+    cJSON_InitHooks(&hooks);
+}
+
+void os_arena_cjson_attach(os_arena_t *arena)
+{
+    os_assert(arena);
+
+    pthread_once(&cjson_hooks_once, cjson_hooks_install);
+    cjson_arena = arena;
+}
+
+void os_arena_cjson_detach(void)
+{
+    cjson_arena = NULL;
+}
+
+void os_arena_show_avail(os_arena_t *arena)
+{
+    os_arena_chunk_t *chunk = NULL;
+    int chunks = 0, large = 0;
+
+    os_assert(arena);
+
+    for (chunk = arena->chunk; chunk; chunk = chunk->next)
+        chunks++;
+    for (chunk = arena->large; chunk; chunk = chunk->next)
+        large++;
+
+    fprintf(stderr, "OS_ARENA(%s)  chunk[%u], chunks[%d], large[%d], used[%zu]!\n",
+            arena->file_line, arena->chunk_size, chunks, large, arena->used);
+}
@@ -19,7 +19,6 @@
 #define OS_CLUSTER_32768_SIZE  32768
 #define OS_CLUSTER_LIL_SIZE    1024*128
 #define OS_CLUSTER_MID_SIZE    1024*512
-#define OS_CLUSTER_BIG_SIZE    (1024*1024)
 
 typedef uint8_t os_cluster_128_t[OS_CLUSTER_128_SIZE];
 typedef uint8_t os_cluster_256_t[OS_CLUSTER_256_SIZE];
@@ -123,7 +122,7 @@ void os_buf_default_destroy(void)
 #endif
 }
 
-os_buf_pool_t *os_buf_pool_create_debug(os_buf_config_t *config)
+os_buf_pool_t *os_buf_pool_create(os_buf_config_t *config)
 {
     os_buf_pool_t *pool = NULL;
 #if OS_USE_TALLOC == 0
@@ -175,6 +174,7 @@ os_buf_pool_t *os_buf_pool_create_debug(os_buf_config_t *config)
     free((pool)->free); \
     free((pool)->array); \
     free((pool)->index); \
+    free((pool)->gen); \
 } while (0)
 
 void os_buf_pool_destroy(os_buf_pool_t *pool)
@@ -248,6 +248,8 @@ os_buf_t *os_buf_alloc_debug(
         os_thread_mutex_unlock(&pool->mutex);
         return NULL;
     }
+    os_thread_mutex_unlock(&pool->mutex);
+
     memset(buf, 0, sizeof(*buf));
 
     OS_OBJECT_REF(cluster);
@@ -265,8 +267,6 @@ os_buf_t *os_buf_alloc_debug(
 
     buf->pool = pool;
 
-    os_thread_mutex_unlock(&pool->mutex);
-
     return buf;
 #endif
 }
@@ -283,21 +283,20 @@ void os_buf_free(os_buf_t *buf)
     pool = buf->pool;
     os_assert(pool);
 
-    os_thread_mutex_lock(&pool->mutex);
-
     cluster = buf->cluster;
     os_assert(cluster);
 
-    if (OS_OBJECT_IS_REF(cluster)){
-        OS_OBJECT_UNREF(cluster);
-    }
-    else{
-        cluster_free(pool, buf->cluster);
+    /* only the last reference touches the cluster pools */
+    if (OS_OBJECT_UNREF(cluster) == 0) {
+        os_thread_mutex_lock(&pool->mutex);
+        cluster_free(pool, cluster);
+        os_pool_free(&pool->buf, buf);
+        os_thread_mutex_unlock(&pool->mutex);
+    } else {
+        os_thread_mutex_lock(&pool->mutex);
+        os_pool_free(&pool->buf, buf);
+        os_thread_mutex_unlock(&pool->mutex);
     }
-
-    os_pool_free(&pool->buf, buf);
-
-    os_thread_mutex_unlock(&pool->mutex);
 #endif
 }
 
@@ -347,12 +346,12 @@ os_buf_t *os_buf_copy_debug(os_buf_t *buf, const char *file_line)
         os_thread_mutex_unlock(&pool->mutex);
         return NULL;
     }
+    os_thread_mutex_unlock(&pool->mutex);
+
     os_assert(newbuf);
     memcpy(newbuf, buf, sizeof *buf);
 
     OS_OBJECT_REF(newbuf->cluster);
-
-    os_thread_mutex_unlock(&pool->mutex);
 #endif
 
     return newbuf;
@@ -56,8 +56,14 @@ typedef struct cdlog_s {
 } os_cdlog_t;
 
 
-PRIVATE OS_POOL(cdlog_pool, os_cdlog_t);
+/*
+ * Outputs and domains may be added from any thread. The lists are only
+ * serialized among writers; logging walks them unlocked, so do not
+ * remove an entry while other threads may log through it.
+ */
+PRIVATE OS_CPOOL(cdlog_pool, os_cdlog_t);
 PRIVATE OS_LIST(cdlog_list);
+PRIVATE os_mutex_t cdlog_mutex;
 
 PRIVATE void cdlog_create_new_file(os_cdlog_t *cdlog);
 PRIVATE os_cdlog_t *add_cdlog(cdlog_type_e type);
@@ -86,7 +92,7 @@ typedef struct os_cdlog_domain_s {
     const char *name;
 } os_cdlog_domain_t;
 
-PRIVATE OS_POOL(domain_pool, os_cdlog_domain_t);
+PRIVATE OS_CPOOL(domain_pool, os_cdlog_domain_t);
 PRIVATE OS_LIST(domain_list);
 
 os_cdlog_domain_t *os_cdlog_add_domain(const char *name, os_cdlog_level_e level)
@@ -95,14 +101,16 @@ os_cdlog_domain_t *os_cdlog_add_domain(const char *name, os_cdlog_level_e level)
 
     os_assert(name);
 
-    os_pool_alloc(&domain_pool, &domain);
+    os_cpool_alloc(&domain_pool, &domain);
     os_assert(domain);
 
     domain->name = name;
     domain->id = os_pool_index(&domain_pool, domain);
     domain->level = level;
 
+    os_mutex_lock(&cdlog_mutex);
     os_list_add(&domain_list, domain);
+    os_mutex_unlock(&cdlog_mutex);
 
     return domain;
 }
@@ -124,8 +132,10 @@ void os_cdlog_remove_domain(os_cdlog_domain_t *domain)
 {
     os_assert(domain);
 
+    os_mutex_lock(&cdlog_mutex);
     os_list_remove(&domain_list, domain);
-    os_pool_free(&domain_pool, domain);
+    os_mutex_unlock(&cdlog_mutex);
+    os_cpool_free(&domain_pool, domain);
 }
 
 void os_cdlog_set_domain_level(int id, os_cdlog_level_e level)
@@ -268,9 +278,9 @@ _API_ void os_cdlog_init(void)
     signal(SIGBUS,  cdlog_catch_segViolation);
     signal(SIGINT,  cdlog_cycle);
 
-    os_pool_init(&cdlog_pool, os_global_context()->log.pool);
+    os_cpool_init(&cdlog_pool, os_global_context()->log.pool);
 
-    os_pool_init(&domain_pool, os_global_context()->log.domain_pool);
+    os_cpool_init(&domain_pool, os_global_context()->log.domain_pool);
 
     os_cdlog_add_domain("os", os_global_context()->log.level);
 }
@@ -281,13 +291,13 @@ _API_ void os_cdlog_final(void)
 
     os_list_for_each_safe(&cdlog_list, saved_cdlog, cdlog)
         cdlog_remove(cdlog);
-    os_pool_final(&cdlog_pool);
+    os_cpool_final(&cdlog_pool);
 
     os_cdlog_domain_t *domain, *saved_domain;
 
     os_list_for_each_safe(&domain_list, saved_domain, domain)
         os_cdlog_remove_domain(domain);
-    os_pool_final(&domain_pool);
+    os_cpool_final(&domain_pool);
 
 }
 
@@ -419,7 +429,9 @@ void cdlog_remove(os_cdlog_t *cdlog)
 {
     os_assert(cdlog);
 
+    os_mutex_lock(&cdlog_mutex);
     os_list_remove(&cdlog_list, cdlog);
+    os_mutex_unlock(&cdlog_mutex);
 
     if (cdlog->type == OS_LOG_FILE_TYPE) {
         os_assert(cdlog->file.out);
@@ -427,7 +439,7 @@ void cdlog_remove(os_cdlog_t *cdlog)
         cdlog->file.out = NULL;
     }
 
-    os_pool_free(&cdlog_pool, cdlog);
+    os_cpool_free(&cdlog_pool, cdlog);
 }
 
 
@@ -556,7 +568,7 @@ PRIVATE os_cdlog_t *add_cdlog(cdlog_type_e type)
 {
     os_cdlog_t *cdlog = NULL;
 
-    os_pool_alloc(&cdlog_pool, &cdlog);
+    os_cpool_alloc(&cdlog_pool, &cdlog);
     os_assert(cdlog);
     memset(cdlog, 0, sizeof *cdlog);
 
@@ -568,7 +580,9 @@ PRIVATE os_cdlog_t *add_cdlog(cdlog_type_e type)
     cdlog->print.fileline = 1;
     cdlog->print.linefeed = 1;
 
+    os_mutex_lock(&cdlog_mutex);
     os_list_add(&cdlog_list, cdlog);
+    os_mutex_unlock(&cdlog_mutex);
 
     return cdlog;
 }
@@ -38,6 +38,7 @@ PRIVATE unsigned int numTtiTicks;     /* TTI Count */
 
 PRIVATE os_ring_queue_t  *log_queue = NULL;
 PRIVATE os_ring_buf_t    *log_buf = NULL;
+PRIVATE os_thread_t      *log_thread = NULL;
 typedef unsigned char cmlog_buffer_t[CLOG_FIXED_LENGTH_BUFFER_SIZE];
 
 PRIVATE void cmlog_create_new_log_file(void);
@@ -274,7 +275,7 @@ PRIVATE void cmlog_enable_coredump(bool enable_core)
 #endif
 }
 
-PRIVATE void* cmlog_cirbuf_read_thread(void* arg)
+PRIVATE void cmlog_cirbuf_read_thread(void* arg)
 {
     unsigned char *pkt = NULL;
     unsigned int len = 0;
@@ -300,8 +301,6 @@ PRIVATE void* cmlog_cirbuf_read_thread(void* arg)
         pkt = NULL;
         len = 0;
     }
-
-    return NULL;
 }
 
 
@@ -357,7 +356,7 @@ void os_cmlog_set_module_mask(unsigned int modMask)
 
 void os_cmlog_init(void)
 {
-    os_thread_id_t tid;
+    os_thread_attr_t attr;
 
     signal(SIGSEGV, cmlog_catch_segViolation);
     signal(SIGBUS,  cmlog_catch_segViolation);
@@ -381,7 +380,10 @@ void os_cmlog_init(void)
     cmlog_create_new_log_file();
 #endif
 
-    if(pthread_create(&tid, NULL, cmlog_cirbuf_read_thread, NULL) != 0) {
+    memset(&attr, 0, sizeof(attr));
+    attr.name = "cmlog";
+    log_thread = os_thread_create_ex(&attr, cmlog_cirbuf_read_thread, NULL);
+    if(!log_thread) {
         fprintf(g_fp, "Failed to initialize log server thread\n");
         exit(0);
     }
@@ -396,6 +398,12 @@ void os_cmlog_final(void)
     g_readyFg = 0;
     g_clogWriteCount = 0;
 
+    /* the reader must be gone before the rest is drained here */
+    if(log_thread){
+        os_thread_destroy(log_thread, 1000);
+        log_thread = NULL;
+    }
+
     cmlog_read_final();
 
     cmlog_printf_static();
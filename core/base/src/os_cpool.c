@@ -0,0 +1,400 @@
+/************************************************************************
+ *File name: os_cpool.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+/*
+ * The lock is uncontended except when another thread drains the cache
+ * because the shared stack ran dry.
+ */
+struct os_cpool_cache_s {
+    os_spinlock_t lock;
+    int count;
+    uint32_t idx[OS_CPOOL_CACHE_SIZE];
+};
+
+#define CPOOL_TOP(tag, idx)  (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+#define CPOOL_TOP_TAG(top)   ((uint32_t)((top) >> 32))
+#define CPOOL_TOP_IDX(top)   ((uint32_t)(top))
+
+/*
+ * Per-thread slot into os_cpool_core_t.cache[], kept in the thread
+ * context as slot + 1 and released at thread exit.
+ */
+#define CPOOL_SLOT_NONE ((uintptr_t)-1) /* all slots were taken */
+
+PRIVATE uint64_t cpool_slot_map = 0;
+PRIVATE int cpool_ctx_slot = OS_ERROR;
+PRIVATE pthread_once_t cpool_slot_once = PTHREAD_ONCE_INIT;
+
+OS_STATIC_ASSERT(OS_CPOOL_MAX_THREADS <= 64);
+
+PRIVATE void cpool_slot_release(void *arg)
+{
+    uintptr_t v = (uintptr_t)arg;
+
+    if (v == CPOOL_SLOT_NONE)
+        return;
+    os_atomic_fetch_sub(&cpool_slot_map, (uint64_t)1 << (v - 1));
+}
+
+PRIVATE void cpool_slot_register(void)
+{
+    cpool_ctx_slot = os_thread_slot_register(cpool_slot_release);
+    os_assert(cpool_ctx_slot >= 0);
+}
+
+PRIVATE int cpool_thread_slot(void)
+{
+    uintptr_t v = 0;
+    uint64_t map, bit;
+    int slot;
+
+    if (os_likely(cpool_ctx_slot >= 0))
+        v = (uintptr_t)os_thread_slot_get(cpool_ctx_slot);
+    if (os_likely(v))
+        return v == CPOOL_SLOT_NONE ? -1 : (int)(v - 1);
+
+    pthread_once(&cpool_slot_once, cpool_slot_register);
+
+    map = os_atomic_load(&cpool_slot_map);
+    do {
+        if (map == UINT64_MAX) {
+            os_thread_slot_set(cpool_ctx_slot, (void *)CPOOL_SLOT_NONE);
+            return -1;
+        }
+        slot = __builtin_ctzll(~map);
+        bit = (uint64_t)1 << slot;
+    } while (!os_atomic_cas_weak(&cpool_slot_map, &map, map | bit));
+
+    os_thread_slot_set(cpool_ctx_slot, (void *)(uintptr_t)(slot + 1));
+
+    /* a cache left behind by an exited thread is simply inherited */
+    return slot;
+}
+
+/* pop up to max indices from the shared stack */
+PRIVATE int cpool_pop(os_cpool_core_t *core, uint32_t *out, int max)
+{
+    uint64_t top, ntop;
+    uint32_t cur;
+    int n;
+
+    top = os_atomic_load(&core->top);
+    do {
+        n = 0;
+        cur = CPOOL_TOP_IDX(top);
+        while (cur && n < max) {
+            out[n++] = cur - 1;
+            cur = os_atomic_load_relaxed(&core->next[cur - 1]);
+        }
+        if (n == 0)
+            return 0;
+        ntop = CPOOL_TOP(CPOOL_TOP_TAG(top) + 1, cur);
+    } while (!os_atomic_cas_weak(&core->top, &top, ntop));
+
+    os_atomic_sub_fetch(&core->count, n);
+
+    return n;
+}
+
+/* push n indices to the shared stack as one chain */
+PRIVATE void cpool_push(os_cpool_core_t *core, const uint32_t *idx, int n)
+{
+    uint64_t top, ntop;
+    int i;
+
+    if (n <= 0)
+        return;
+
+    for (i = 0; i < n - 1; i++)
+        os_atomic_store_relaxed(&core->next[idx[i]], idx[i + 1] + 1);
+
+    top = os_atomic_load(&core->top);
+    do {
+        os_atomic_store_relaxed(&core->next[idx[n - 1]], CPOOL_TOP_IDX(top));
+        ntop = CPOOL_TOP(CPOOL_TOP_TAG(top) + 1, idx[0] + 1);
+    } while (!os_atomic_cas_weak(&core->top, &top, ntop));
+
+    os_atomic_add_fetch(&core->count, n);
+}
+
+PRIVATE os_cpool_cache_t *cpool_cache(os_cpool_core_t *core)
+{
+    os_cpool_cache_t *cache = NULL;
+    int slot;
+
+    if (!core->cache_size)
+        return NULL;
+
+    slot = cpool_thread_slot();
+    if (slot < 0)
+        return NULL;
+
+    cache = core->cache[slot];
+    if (os_unlikely(!cache)) {
+        cache = calloc(1, sizeof *cache);
+        os_assert(cache);
+        os_spinlock_init(&cache->lock);
+        os_atomic_store(&core->cache[slot], cache);
+    }
+
+    return cache;
+}
+
+/*
+ * The shared stack is empty: move what other threads hold in their
+ * caches back to it. The caller must not hold its own cache lock.
+ */
+PRIVATE int cpool_drain(os_cpool_core_t *core, os_cpool_cache_t *self)
+{
+    os_cpool_cache_t *cache = NULL;
+    int i, n = 0;
+
+    for (i = 0; i < OS_CPOOL_MAX_THREADS; i++) {
+        cache = os_atomic_load(&core->cache[i]);
+        if (!cache || cache == self ||
+                !os_atomic_load_relaxed(&cache->count))
+            continue;
+
+        os_spinlock_lock(&cache->lock);
+        cpool_push(core, cache->idx, cache->count);
+        n += cache->count;
+        os_atomic_store_relaxed(&cache->count, 0);
+        os_spinlock_unlock(&cache->lock);
+    }
+
+    return n;
+}
+
+PRIVATE int cpool_pop_or_drain(os_cpool_core_t *core,
+        os_cpool_cache_t *self, uint32_t *out, int max)
+{
+    int n = cpool_pop(core, out, max);
+
+    if (!n && cpool_drain(core, self))
+        n = cpool_pop(core, out, max);
+
+    return n;
+}
+
+PRIVATE os_inline void *cpool_node_get(os_cpool_core_t *core, uint32_t i)
+{
+    void *node = core->array + i * core->elem_size;
+
+    os_atomic_store_relaxed(&core->index[i], node);
+    return node;
+}
+
+PRIVATE os_inline int cpool_node_put(os_cpool_core_t *core, void *node, uint32_t *i)
+{
+    size_t off = (unsigned char *)node - core->array;
+
+    os_assert(off / core->elem_size < (size_t)core->size);
+    *i = off / core->elem_size;
+
+    if (!os_atomic_xchg(&core->index[*i], NULL)) {
+        os_log(ERROR, "'%s' node[%u] is already freed", core->name, *i + 1);
+        return OS_ERROR;
+    }
+    os_atomic_inc(&core->gen[*i]);
+
+    return OS_OK;
+}
+
+void os_cpool_core_init(os_cpool_core_t *core, const char *name,
+        void *array, size_t elem_size, void **index, uint32_t *gen, int size)
+{
+    int i;
+
+    os_assert(core);
+    os_assert(size > 0);
+
+    memset(core, 0, sizeof *core);
+
+    core->name = name;
+    core->array = array;
+    core->elem_size = elem_size;
+    core->index = index;
+    core->gen = gen;
+    core->size = size;
+
+    core->cache_size = size / 16;
+    if (core->cache_size > OS_CPOOL_CACHE_SIZE)
+        core->cache_size = OS_CPOOL_CACHE_SIZE;
+    if (core->cache_size < OS_CPOOL_MIN_CACHE)
+        core->cache_size = 0;
+
+    core->next = malloc(sizeof(*core->next) * size);
+    os_assert(core->next);
+    for (i = 0; i < size; i++)
+        core->next[i] = (i + 1 < size) ? i + 2 : 0;
+
+    core->top = CPOOL_TOP(0, 1);
+    core->count = size;
+}
+
+void os_cpool_core_final(os_cpool_core_t *core)
+{
+    int i, avail;
+
+    os_assert(core);
+
+    avail = os_cpool_core_avail(core);
+    if (avail != core->size)
+        os_log(ERROR, "%d in '%s[%d]' were not released", core->size - avail, core->name, core->size);
+
+    for (i = 0; i < OS_CPOOL_MAX_THREADS; i++)
+        free(core->cache[i]);
+    free(core->next);
+}
+
+void *os_cpool_core_alloc(os_cpool_core_t *core)
+{
+    os_cpool_cache_t *cache = NULL;
+    uint32_t i;
+
+    cache = cpool_cache(core);
+    if (!cache) {
+        if (!cpool_pop_or_drain(core, NULL, &i, 1))
+            return NULL;
+        return cpool_node_get(core, i);
+    }
+
+    os_spinlock_lock(&cache->lock);
+    if (cache->count == 0) {
+        int n = cpool_pop(core, cache->idx, core->cache_size / 2);
+        if (!n) {
+            os_spinlock_unlock(&cache->lock);
+            if (!cpool_pop_or_drain(core, cache, &i, 1))
+                return NULL;
+            return cpool_node_get(core, i);
+        }
+        os_atomic_store_relaxed(&cache->count, n);
+    }
+
+    os_atomic_store_relaxed(&cache->count, cache->count - 1);
+    i = cache->idx[cache->count];
+    os_spinlock_unlock(&cache->lock);
+
+    return cpool_node_get(core, i);
+}
+
+void os_cpool_core_free(os_cpool_core_t *core, void *node)
+{
+    os_cpool_cache_t *cache = NULL;
+    uint32_t i;
+    int half;
+
+    os_assert(node);
+
+    if (cpool_node_put(core, node, &i) != OS_OK)
+        return;
+
+    cache = cpool_cache(core);
+    if (!cache) {
+        cpool_push(core, &i, 1);
+        return;
+    }
+
+    os_spinlock_lock(&cache->lock);
+    if (cache->count == core->cache_size) {
+        half = core->cache_size / 2;
+        cpool_push(core, cache->idx + cache->count - half, half);
+        os_atomic_store_relaxed(&cache->count, cache->count - half);
+    }
+
+    cache->idx[cache->count] = i;
+    os_atomic_store_relaxed(&cache->count, cache->count + 1);
+    os_spinlock_unlock(&cache->lock);
+}
+
+int os_cpool_core_alloc_bulk(os_cpool_core_t *core, void **nodes, int n)
+{
+    os_cpool_cache_t *cache = NULL;
+    uint32_t idx[OS_CPOOL_CACHE_SIZE];
+    int got = 0, k, i;
+
+    os_assert(nodes);
+
+    cache = cpool_cache(core);
+    if (cache) {
+        os_spinlock_lock(&cache->lock);
+        while (got < n && cache->count > 0) {
+            os_atomic_store_relaxed(&cache->count, cache->count - 1);
+            nodes[got++] = cpool_node_get(core, cache->idx[cache->count]);
+        }
+        os_spinlock_unlock(&cache->lock);
+    }
+
+    while (got < n) {
+        k = n - got;
+        if (k > OS_CPOOL_CACHE_SIZE)
+            k = OS_CPOOL_CACHE_SIZE;
+        k = cpool_pop_or_drain(core, cache, idx, k);
+        if (!k)
+            break;
+        for (i = 0; i < k; i++)
+            nodes[got++] = cpool_node_get(core, idx[i]);
+    }
+
+    return got;
+}
+
+void os_cpool_core_free_bulk(os_cpool_core_t *core, void **nodes, int n)
+{
+    os_cpool_cache_t *cache = NULL;
+    uint32_t idx[OS_CPOOL_CACHE_SIZE];
+    int i, k = 0;
+
+    os_assert(nodes);
+
+    cache = cpool_cache(core);
+    if (cache)
+        os_spinlock_lock(&cache->lock);
+
+    for (i = 0; i < n; i++) {
+        uint32_t j;
+
+        if (cpool_node_put(core, nodes[i], &j) != OS_OK)
+            continue;
+
+        if (cache && cache->count < core->cache_size) {
+            cache->idx[cache->count] = j;
+            os_atomic_store_relaxed(&cache->count, cache->count + 1);
+            continue;
+        }
+
+        idx[k++] = j;
+        if (k == OS_CPOOL_CACHE_SIZE) {
+            cpool_push(core, idx, k);
+            k = 0;
+        }
+    }
+
+    if (cache)
+        os_spinlock_unlock(&cache->lock);
+    cpool_push(core, idx, k);
+}
+
+int os_cpool_core_avail(os_cpool_core_t *core)
+{
+    os_cpool_cache_t *cache = NULL;
+    int i, avail;
+
+    os_assert(core);
+
+    avail = os_atomic_load(&core->count);
+    for (i = 0; i < OS_CPOOL_MAX_THREADS; i++) {
+        cache = os_atomic_load(&core->cache[i]);
+        if (cache)
+            avail += os_atomic_load_relaxed(&cache->count);
+    }
+
+    return avail;
+}
@@ -41,7 +41,7 @@ struct epoll_map_s {
 struct epoll_context_s {
     int epfd;
 
-    os_hash_t *map_hash;
+    os_hash_u32_t *map_hash;
     struct epoll_event *event_list;
 };
 
@@ -58,7 +58,7 @@ PRIVATE void epoll_init(os_pollset_t *pollset)
             pollset->capacity, sizeof(struct epoll_event));
     os_assert(context->event_list);
 
-    context->map_hash = os_hash_make();
+    context->map_hash = os_hash_u32_make();
     os_assert(context->map_hash);
 
     context->epfd = epoll_create(pollset->capacity);
@@ -78,7 +78,7 @@ PRIVATE void epoll_cleanup(os_pollset_t *pollset)
     os_notify_final(pollset);
     close(context->epfd);
     os_free(context->event_list);
-    os_hash_destroy(context->map_hash);
+    os_hash_u32_destroy(context->map_hash);
 
     os_free(context);
 }
@@ -97,7 +97,7 @@ PRIVATE int epoll_add(os_poll_t *poll)
     context = pollset->context;
     os_assert(context);
 
-    map = os_hash_get(context->map_hash, &poll->fd, sizeof(poll->fd));
+    map = os_hash_u32_get(context->map_hash, poll->fd);
     if (!map) {
         map = os_calloc(1, sizeof(*map));
         if (!map) {
@@ -106,7 +106,7 @@ PRIVATE int epoll_add(os_poll_t *poll)
         }
 
         op = EPOLL_CTL_ADD;
-        os_hash_set(context->map_hash, &poll->fd, sizeof(poll->fd), map);
+        os_hash_u32_set(context->map_hash, poll->fd, map);
     } else {
         op = EPOLL_CTL_MOD;
     }
@@ -148,7 +148,7 @@ PRIVATE int epoll_remove(os_poll_t *poll)
     context = pollset->context;
     os_assert(context);
 
-    map = os_hash_get(context->map_hash, &poll->fd, sizeof(poll->fd));
+    map = os_hash_u32_get(context->map_hash, poll->fd);
     os_assert(map);
 
     if (poll->when & OS_POLLIN)
@@ -171,7 +171,7 @@ PRIVATE int epoll_remove(os_poll_t *poll)
         op = EPOLL_CTL_DEL;
         ee.data.fd = INVALID_SOCKET;
 
-        os_hash_set(context->map_hash, &poll->fd, sizeof(poll->fd), NULL);
+        os_hash_u32_set(context->map_hash, poll->fd, NULL);
         os_free(map);
     }
 
@@ -194,10 +194,13 @@ PRIVATE int epoll_process(os_pollset_t *pollset, os_time_t timeout)
     context = pollset->context;
     os_assert(context);
 
+    /* nothing is read under RCU while blocked in the kernel */
+    os_rcu_thread_offline();
     num_of_poll = epoll_wait(context->epfd, context->event_list,
             pollset->capacity,
             timeout == OS_INFINITE_TIME ? OS_INFINITE_TIME :
                 os_time_to_msec(timeout));
+    os_rcu_thread_online();
     if (num_of_poll < 0) {
         os_logsp(ERROR, ERRNOID, os_socket_errno, "epoll failed");
         return OS_ERROR;
@@ -250,7 +253,7 @@ PRIVATE int epoll_process(os_pollset_t *pollset, os_time_t timeout)
         fd = context->event_list[i].data.fd;
         os_assert(fd != INVALID_SOCKET);
 
-        map = os_hash_get(context->map_hash, &fd, sizeof(fd));
+        map = os_hash_u32_get(context->map_hash, fd);
         if (!map) continue;
 
         if (map->read && map->write && map->read == map->write) {
@@ -263,7 +266,7 @@ PRIVATE int epoll_process(os_pollset_t *pollset, os_time_t timeout)
              * map->read->handler() can call os_remove_epoll()
              * So, we need to check map instance
              */
-            map = os_hash_get(context->map_hash, &fd, sizeof(fd));
+            map = os_hash_u32_get(context->map_hash, fd);
             if (!map) continue;
 
             if ((when & OS_POLLOUT) && map->write)
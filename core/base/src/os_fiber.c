@@ -0,0 +1,535 @@
+/************************************************************************
+ *File name: os_fiber.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#include "system_config.h"
+
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#include "os_init.h"
+
+#define FIBER_STACK_SIZE    (64 * 1024)
+#define FIBER_STACK_CACHE   64
+
+typedef enum {
+    FIBER_READY,
+    FIBER_RUNNING,
+    FIBER_WAITING,
+    FIBER_DEAD,
+} fiber_state_e;
+
+/*
+ * On x86-64 the switch saves only the callee-saved registers plus the
+ * SSE/x87 control words, and never enters the kernel; swapcontext()
+ * would also save the signal mask with a syscall on every switch.
+ */
+#if defined(__x86_64__)
+typedef struct fiber_ctx_s {
+    void *sp;
+} fiber_ctx_t;
+
+void os_fiber_switch_ctx(fiber_ctx_t *from, fiber_ctx_t *to);
+__asm__ (
+    ".text\n"
+    ".globl os_fiber_switch_ctx\n"
+    ".hidden os_fiber_switch_ctx\n"
+    ".type os_fiber_switch_ctx,@function\n"
+    "os_fiber_switch_ctx:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size os_fiber_switch_ctx,.-os_fiber_switch_ctx\n"
+);
+#define fiber_switch(__fROM, __tO) os_fiber_switch_ctx(__fROM, __tO)
+#else
+typedef ucontext_t fiber_ctx_t;
+#define fiber_switch(__fROM, __tO) swapcontext(__fROM, __tO)
+#endif
+
+struct os_fiber_s {
+    os_lnode_t lnode;           /* ready list */
+    os_lnode_t all;             /* every live fiber, for destroy */
+    os_rbnode_t rbnode;         /* timer, keyed by deadline */
+
+    fiber_ctx_t ctx;
+    void *stack;
+
+    os_fiber_sched_t *sched;
+    os_fiber_f fn;
+    void *data;
+
+    fiber_state_e state;
+    os_poll_t *poll;
+    os_time_t deadline;
+    bool timer;
+    int wait_rv;
+};
+
+struct os_fiber_sched_s {
+    os_pollset_t *pollset;
+
+    size_t page_size;
+    size_t stack_size;
+    unsigned int stack_cache;
+    unsigned int stack_cached;
+    void *stack_free;           /* unused stacks, linked through their lowest word */
+
+    os_list_t ready;
+    os_list_t all;
+    unsigned int count;
+    os_rbtree_t timers;
+
+    fiber_ctx_t main_ctx;
+    os_fiber_t *current;
+};
+
+PRIVATE __thread os_fiber_sched_t *fiber_sched_self = NULL;
+
+/* the guard page sits below the usable area: stacks grow down */
+PRIVATE void *stack_alloc(os_fiber_sched_t *sched)
+{
+    void *base;
+
+    if (sched->stack_free) {
+        base = sched->stack_free;
+        sched->stack_free = *(void **)((char *)base + sched->page_size);
+        sched->stack_cached--;
+        return base;
+    }
+
+    base = mmap(NULL, sched->page_size + sched->stack_size,
+            PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+            -1, 0);
+    if (base == MAP_FAILED) {
+        os_logsp(ERROR, ERRNOID, os_errno, "mmap() failed");
+        return NULL;
+    }
+    if (mprotect(base, sched->page_size, PROT_NONE) != 0) {
+        os_logsp(ERROR, ERRNOID, os_errno, "mprotect() failed");
+        munmap(base, sched->page_size + sched->stack_size);
+        return NULL;
+    }
+
+    return base;
+}
+
+PRIVATE void stack_free(os_fiber_sched_t *sched, void *base)
+{
+    if (sched->stack_cached < sched->stack_cache) {
+        *(void **)((char *)base + sched->page_size) = sched->stack_free;
+        sched->stack_free = base;
+        sched->stack_cached++;
+        return;
+    }
+
+    munmap(base, sched->page_size + sched->stack_size);
+}
+
+PRIVATE void fiber_main(void)
+{
+    os_fiber_sched_t *sched = fiber_sched_self;
+    os_fiber_t *fiber = sched->current;
+
+    fiber->fn(fiber->data);
+
+    fiber->state = FIBER_DEAD;
+    fiber_switch(&fiber->ctx, &sched->main_ctx);
+    os_assert_if_reached();
+}
+
+PRIVATE int fiber_ctx_init(os_fiber_sched_t *sched, os_fiber_t *fiber)
+{
+    char *top = (char *)fiber->stack + sched->page_size + sched->stack_size;
+#if defined(__x86_64__)
+    uint64_t *sp;
+
+    /*
+     * Frame popped by the first switch: control words, r15..rbp, and
+     * fiber_main as return address, landing 16-byte aligned minus the
+     * return slot as if fiber_main had been called.
+     */
+    sp = (uint64_t *)((uintptr_t)top & ~(uintptr_t)15);
+    *--sp = 0;                          /* fiber_main never returns */
+    *--sp = (uint64_t)(uintptr_t)fiber_main;
+    sp -= 6;
+    memset(sp, 0, 6 * sizeof(*sp));
+    *--sp = 0x1f80 | ((uint64_t)0x037f << 32); /* MXCSR, x87 CW */
+    fiber->ctx.sp = sp;
+#else
+    if (getcontext(&fiber->ctx) != 0) {
+        os_logsp(ERROR, ERRNOID, os_errno, "getcontext() failed");
+        return OS_ERROR;
+    }
+    fiber->ctx.uc_stack.ss_sp = (char *)fiber->stack + sched->page_size;
+    fiber->ctx.uc_stack.ss_size = sched->stack_size;
+    fiber->ctx.uc_link = NULL;
+    makecontext(&fiber->ctx, fiber_main, 0);
+    (void)top;
+#endif
+
+    return OS_OK;
+}
+
+PRIVATE void fiber_free(os_fiber_sched_t *sched, os_fiber_t *fiber)
+{
+    if (fiber->poll)
+        os_pollset_remove(fiber->poll);
+    if (fiber->timer)
+        os_rbtree_delete(&sched->timers, &fiber->rbnode);
+
+    os_list_remove(&sched->all, &fiber->all);
+    sched->count--;
+
+    stack_free(sched, fiber->stack);
+    os_free(fiber);
+}
+
+PRIVATE void fiber_ready(os_fiber_sched_t *sched, os_fiber_t *fiber)
+{
+    fiber->state = FIBER_READY;
+    os_list_add(&sched->ready, &fiber->lnode);
+}
+
+PRIVATE void timer_add(os_fiber_sched_t *sched,
+        os_fiber_t *fiber, os_time_t timeout)
+{
+    os_rbnode_t **new = &sched->timers.root;
+    os_rbnode_t *parent = NULL;
+
+    fiber->deadline = os_get_monotonic_time() + timeout;
+
+    while (*new) {
+        os_fiber_t *this = os_rb_entry(*new, os_fiber_t, rbnode);
+
+        parent = *new;
+        /* equal deadlines go right, so they fire in arming order */
+        if (fiber->deadline < this->deadline)
+            new = &(*new)->left;
+        else
+            new = &(*new)->right;
+    }
+
+    os_rbtree_link_node(&fiber->rbnode, parent, new);
+    os_rbtree_insert_color(&sched->timers, &fiber->rbnode);
+    fiber->timer = true;
+}
+
+PRIVATE void timer_del(os_fiber_sched_t *sched, os_fiber_t *fiber)
+{
+    if (!fiber->timer)
+        return;
+
+    os_rbtree_delete(&sched->timers, &fiber->rbnode);
+    fiber->timer = false;
+}
+
+PRIVATE void timer_expire(os_fiber_sched_t *sched)
+{
+    os_rbnode_t *rbnode;
+    os_fiber_t *fiber;
+    os_time_t now;
+
+    now = os_get_monotonic_time();
+
+    while ((rbnode = os_rbtree_first(&sched->timers))) {
+        fiber = os_rb_entry(rbnode, os_fiber_t, rbnode);
+        if (fiber->deadline > now)
+            break;
+
+        timer_del(sched, fiber);
+        if (fiber->state == FIBER_WAITING) {
+            fiber->wait_rv = OS_TIMEUP;
+            fiber_ready(sched, fiber);
+        }
+    }
+}
+
+/* runs from os_pollset_poll(): only queue the fiber, it resumes later */
+PRIVATE void fiber_poll_handler(short when, os_socket_t fd, void *data)
+{
+    os_fiber_t *fiber = data;
+
+    if (fiber->state != FIBER_WAITING)
+        return;
+
+    timer_del(fiber->sched, fiber);
+    fiber->wait_rv = OS_OK;
+    fiber_ready(fiber->sched, fiber);
+}
+
+/* back to the scheduler until something makes the fiber ready */
+PRIVATE void fiber_suspend(os_fiber_t *fiber)
+{
+    fiber_switch(&fiber->ctx, &fiber->sched->main_ctx);
+}
+
+os_fiber_sched_t *os_fiber_sched_create(
+        os_pollset_t *pollset, const os_fiber_config_t *conf)
+{
+    os_fiber_sched_t *sched;
+    size_t stack_size;
+
+    os_assert(pollset);
+
+    sched = os_calloc(1, sizeof(*sched));
+    if (!sched) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    sched->pollset = pollset;
+    sched->page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    stack_size = conf && conf->stack_size ? conf->stack_size : FIBER_STACK_SIZE;
+    sched->stack_size = (stack_size + sched->page_size - 1) &
+        ~(sched->page_size - 1);
+    sched->stack_cache = conf && conf->stack_cache ?
+        conf->stack_cache : FIBER_STACK_CACHE;
+
+    os_list_init(&sched->ready);
+    os_list_init(&sched->all);
+    sched->timers.root = NULL;
+
+    return sched;
+}
+
+void os_fiber_sched_destroy(os_fiber_sched_t *sched)
+{
+    os_fiber_t *fiber, *next;
+    void *base;
+
+    os_assert(sched);
+    os_assert(!sched->current);
+
+    os_list_for_each_entry_safe(&sched->all, next, fiber, all)
+        fiber_free(sched, fiber);
+
+    while ((base = sched->stack_free)) {
+        sched->stack_free = *(void **)((char *)base + sched->page_size);
+        munmap(base, sched->page_size + sched->stack_size);
+    }
+
+    os_free(sched);
+}
+
+void os_fiber_sched_run(os_fiber_sched_t *sched)
+{
+    os_fiber_sched_t *saved;
+    os_fiber_t *fiber;
+    os_lnode_t *lnode;
+    int n;
+
+    os_assert(sched);
+    os_assert(!sched->current);
+
+    timer_expire(sched);
+
+    saved = fiber_sched_self;
+    fiber_sched_self = sched;
+
+    /* fibers readied during this pass wait for the next one */
+    n = os_list_count(&sched->ready);
+    while (n-- > 0) {
+        lnode = os_list_first(&sched->ready);
+        if (!lnode)
+            break;
+        fiber = os_list_entry(lnode, os_fiber_t, lnode);
+        os_list_remove(&sched->ready, &fiber->lnode);
+
+        fiber->state = FIBER_RUNNING;
+        sched->current = fiber;
+        fiber_switch(&sched->main_ctx, &fiber->ctx);
+        sched->current = NULL;
+
+        if (fiber->state == FIBER_DEAD)
+            fiber_free(sched, fiber);
+    }
+
+    fiber_sched_self = saved;
+}
+
+os_time_t os_fiber_sched_timeout(os_fiber_sched_t *sched)
+{
+    os_rbnode_t *rbnode;
+    os_fiber_t *fiber;
+    os_time_t now;
+
+    os_assert(sched);
+
+    if (!os_list_empty(&sched->ready))
+        return 0;
+
+    rbnode = os_rbtree_first(&sched->timers);
+    if (!rbnode)
+        return OS_INFINITE_TIME;
+
+    fiber = os_rb_entry(rbnode, os_fiber_t, rbnode);
+    now = os_get_monotonic_time();
+
+    return fiber->deadline > now ? fiber->deadline - now : 0;
+}
+
+unsigned int os_fiber_sched_count(os_fiber_sched_t *sched)
+{
+    os_assert(sched);
+    return sched->count;
+}
+
+os_fiber_t *os_fiber_spawn(os_fiber_sched_t *sched, os_fiber_f fn, void *data)
+{
+    os_fiber_t *fiber;
+
+    os_assert(sched);
+    os_assert(fn);
+
+    fiber = os_calloc(1, sizeof(*fiber));
+    if (!fiber) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    fiber->stack = stack_alloc(sched);
+    if (!fiber->stack) {
+        os_free(fiber);
+        return NULL;
+    }
+
+    fiber->sched = sched;
+    fiber->fn = fn;
+    fiber->data = data;
+
+    if (fiber_ctx_init(sched, fiber) != OS_OK) {
+        stack_free(sched, fiber->stack);
+        os_free(fiber);
+        return NULL;
+    }
+
+    os_list_add(&sched->all, &fiber->all);
+    sched->count++;
+    fiber_ready(sched, fiber);
+
+    return fiber;
+}
+
+os_fiber_t *os_fiber_self(void)
+{
+    return fiber_sched_self ? fiber_sched_self->current : NULL;
+}
+
+void os_fiber_yield(void)
+{
+    os_fiber_t *fiber = os_fiber_self();
+
+    os_assert(fiber);
+
+    fiber_ready(fiber->sched, fiber);
+    fiber_suspend(fiber);
+}
+
+void os_fiber_sleep(os_time_t timeout)
+{
+    os_fiber_t *fiber = os_fiber_self();
+
+    os_assert(fiber);
+
+    if (timeout <= 0) {
+        os_fiber_yield();
+        return;
+    }
+
+    timer_add(fiber->sched, fiber, timeout);
+    fiber->state = FIBER_WAITING;
+    fiber_suspend(fiber);
+}
+
+int os_fiber_wait(os_socket_t fd, short when, os_time_t timeout)
+{
+    os_fiber_t *fiber = os_fiber_self();
+    os_fiber_sched_t *sched;
+
+    os_assert(fiber);
+    os_assert(when == OS_POLLIN || when == OS_POLLOUT);
+    sched = fiber->sched;
+
+    fiber->poll = os_pollset_add(sched->pollset,
+            when, fd, fiber_poll_handler, fiber);
+    if (!fiber->poll)
+        return OS_ERROR;
+
+    if (timeout != OS_INFINITE_TIME)
+        timer_add(sched, fiber, timeout);
+
+    fiber->state = FIBER_WAITING;
+    fiber_suspend(fiber);
+
+    os_pollset_remove(fiber->poll);
+    fiber->poll = NULL;
+
+    return fiber->wait_rv;
+}
+
+ssize_t os_fiber_read(os_socket_t fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    for ( ;; ) {
+        n = os_read(fd, buf, len);
+        if (n >= 0)
+            return n;
+
+        if (os_socket_errno == EINTR)
+            continue;
+        if (os_socket_errno != OS_EAGAIN)
+            return OS_ERROR;
+        if (os_fiber_wait(fd, OS_POLLIN, OS_INFINITE_TIME) != OS_OK)
+            return OS_ERROR;
+    }
+}
+
+ssize_t os_fiber_write(os_socket_t fd, const void *buf, size_t len)
+{
+    size_t sent = 0;
+    ssize_t n;
+
+    while (sent < len) {
+        n = os_write(fd, (const char *)buf + sent, len - sent);
+        if (n >= 0) {
+            sent += n;
+            continue;
+        }
+
+        if (os_socket_errno == EINTR)
+            continue;
+        if (os_socket_errno != OS_EAGAIN)
+            return OS_ERROR;
+        if (os_fiber_wait(fd, OS_POLLOUT, OS_INFINITE_TIME) != OS_OK)
+            return OS_ERROR;
+    }
+
+    return len;
+}
@@ -0,0 +1,442 @@
+/************************************************************************
+ *File name: os_flat_hash.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define FLAT_GROUP_WIDTH    16
+#define FLAT_MIN_CAPACITY   FLAT_GROUP_WIDTH
+#define FLAT_BURST          32
+
+/* control bytes: full slots hold the low 7 bits of the hash */
+#define FLAT_CTRL_EMPTY     ((int8_t)0x80)
+#define FLAT_CTRL_DELETED   ((int8_t)0xFE)
+
+#define FLAT_H1(hash)       ((hash) >> 7)
+#define FLAT_H2(hash)       ((int8_t)((hash) & 0x7F))
+
+struct os_flat_hash_s {
+    int8_t *ctrl;
+    unsigned char *slots;
+    size_t capacity;    /* power of 2, multiple of FLAT_GROUP_WIDTH */
+    size_t growth_left; /* inserts into EMPTY slots before rehash */
+    unsigned int count;
+
+    size_t ksize, vsize, stride;
+    uint64_t seed;
+    os_flat_hashfunc_t hash_func;   /* NULL: os_hash64() over the key */
+
+    os_flat_hash_index_t iterator;
+};
+
+typedef uint32_t flat_mask_t;
+
+#if defined(__SSE2__)
+PRIVATE os_inline flat_mask_t group_match(const int8_t *g, int8_t h2)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+    return (flat_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+}
+
+PRIVATE os_inline flat_mask_t group_match_empty(const int8_t *g)
+{
+    return group_match(g, FLAT_CTRL_EMPTY);
+}
+
+PRIVATE os_inline flat_mask_t group_match_free(const int8_t *g)
+{
+    /* EMPTY and DELETED are the only negative control bytes */
+    return (flat_mask_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+#else
+PRIVATE os_inline flat_mask_t group_match(const int8_t *g, int8_t h2)
+{
+    flat_mask_t mask = 0;
+    int i;
+
+    for (i = 0; i < FLAT_GROUP_WIDTH; i++)
+        if (g[i] == h2)
+            mask |= 1u << i;
+    return mask;
+}
+
+PRIVATE os_inline flat_mask_t group_match_empty(const int8_t *g)
+{
+    return group_match(g, FLAT_CTRL_EMPTY);
+}
+
+PRIVATE os_inline flat_mask_t group_match_free(const int8_t *g)
+{
+    flat_mask_t mask = 0;
+    int i;
+
+    for (i = 0; i < FLAT_GROUP_WIDTH; i++)
+        if (g[i] < 0)
+            mask |= 1u << i;
+    return mask;
+}
+#endif
+
+/* custom hash functions must mix well: H1 and H2 are split off it */
+#define flat_hash_of(ht, key) ((ht)->hash_func ? \
+        (ht)->hash_func(key, (ht)->seed) : os_hash64(key, (ht)->ksize, (ht)->seed))
+
+PRIVATE os_inline bool flat_key_eq(
+        const os_flat_hash_t *ht, const void *a, const void *b)
+{
+    uint32_t a32, b32;
+    uint64_t a64, b64;
+
+    switch (ht->ksize) {
+    case 4:
+        memcpy(&a32, a, 4); memcpy(&b32, b, 4);
+        return a32 == b32;
+    case 8:
+        memcpy(&a64, a, 8); memcpy(&b64, b, 8);
+        return a64 == b64;
+    default:
+        return memcmp(a, b, ht->ksize) == 0;
+    }
+}
+
+PRIVATE os_inline unsigned char *flat_slot(const os_flat_hash_t *ht, size_t i)
+{
+    return ht->slots + i * ht->stride;
+}
+
+PRIVATE os_inline size_t flat_growth(size_t capacity)
+{
+    return capacity - capacity / 8;
+}
+
+PRIVATE void flat_alloc(os_flat_hash_t *ht, size_t capacity)
+{
+    void *mem = NULL;
+
+    /* control bytes first, the slots behind them stay pointer aligned */
+    mem = os_malloc(capacity + capacity * ht->stride);
+    os_assert(mem);
+
+    ht->ctrl = mem;
+    ht->slots = (unsigned char *)mem + capacity;
+    ht->capacity = capacity;
+    ht->growth_left = flat_growth(capacity);
+    memset(ht->ctrl, FLAT_CTRL_EMPTY, capacity);
+}
+
+/* first free slot on the probe sequence of hash */
+PRIVATE size_t flat_find_free(const os_flat_hash_t *ht, uint64_t hash)
+{
+    size_t groups_mask = ht->capacity / FLAT_GROUP_WIDTH - 1;
+    size_t g = FLAT_H1(hash) & groups_mask;
+    size_t step = 0;
+    flat_mask_t m;
+
+    for ( ;; ) {
+        m = group_match_free(ht->ctrl + g * FLAT_GROUP_WIDTH);
+        if (m)
+            return g * FLAT_GROUP_WIDTH + __builtin_ctz(m);
+        g = (g + ++step) & groups_mask;
+    }
+}
+
+PRIVATE os_inline void flat_set_ctrl(os_flat_hash_t *ht, size_t i, int8_t c)
+{
+    if (ht->ctrl[i] == FLAT_CTRL_EMPTY && c >= 0)
+        ht->growth_left--;
+    ht->ctrl[i] = c;
+}
+
+PRIVATE void flat_resize(os_flat_hash_t *ht, size_t capacity)
+{
+    int8_t *old_ctrl = ht->ctrl;
+    unsigned char *old_slots = ht->slots;
+    size_t old_capacity = ht->capacity;
+    size_t i, j;
+    uint64_t hash;
+
+    flat_alloc(ht, capacity);
+
+    for (i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] < 0)
+            continue;
+        hash = flat_hash_of(ht, old_slots + i * ht->stride);
+        j = flat_find_free(ht, hash);
+        flat_set_ctrl(ht, j, FLAT_H2(hash));
+        memcpy(flat_slot(ht, j), old_slots + i * ht->stride, ht->stride);
+    }
+
+    os_free(old_ctrl);
+}
+
+PRIVATE void flat_rehash_for_insert(os_flat_hash_t *ht)
+{
+    /* mostly tombstones: rebuild in place size, otherwise double */
+    if (ht->count <= flat_growth(ht->capacity) / 2)
+        flat_resize(ht, ht->capacity);
+    else
+        flat_resize(ht, ht->capacity * 2);
+}
+
+os_flat_hash_t *os_flat_hash_make(size_t ksize, size_t vsize)
+{
+    os_flat_hash_t *ht = NULL;
+
+    os_assert(ksize);
+
+    ht = os_calloc(1, sizeof *ht);
+    if (!ht) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    ht->ksize = ksize;
+    ht->vsize = vsize;
+    ht->stride = (ksize + vsize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    ht->seed = ((uint64_t)os_random32() << 32) | os_random32();
+
+    flat_alloc(ht, FLAT_MIN_CAPACITY);
+
+    return ht;
+}
+
+os_flat_hash_t *os_flat_hash_make_custom(
+        size_t ksize, size_t vsize, os_flat_hashfunc_t hash_func)
+{
+    os_flat_hash_t *ht = os_flat_hash_make(ksize, vsize);
+    if (!ht) {
+        os_log(ERROR, "os_flat_hash_make() failed");
+        return NULL;
+    }
+    ht->hash_func = hash_func;
+    return ht;
+}
+
+void os_flat_hash_destroy(os_flat_hash_t *ht)
+{
+    os_assert(ht);
+
+    os_free(ht->ctrl);
+    os_free(ht);
+}
+
+void os_flat_hash_reserve(os_flat_hash_t *ht, unsigned int n)
+{
+    size_t capacity;
+
+    os_assert(ht);
+
+    capacity = ht->capacity;
+    while (flat_growth(capacity) < n)
+        capacity *= 2;
+
+    if (capacity != ht->capacity)
+        flat_resize(ht, capacity);
+}
+
+/* @return slot index, or -1 if not found */
+PRIVATE os_inline ssize_t flat_find(
+        const os_flat_hash_t *ht, const void *key, uint64_t hash)
+{
+    size_t groups_mask = ht->capacity / FLAT_GROUP_WIDTH - 1;
+    size_t g = FLAT_H1(hash) & groups_mask;
+    size_t step = 0, i;
+    const int8_t *ctrl;
+    flat_mask_t m;
+
+    for ( ;; ) {
+        ctrl = ht->ctrl + g * FLAT_GROUP_WIDTH;
+        for (m = group_match(ctrl, FLAT_H2(hash)); m; m &= m - 1) {
+            i = g * FLAT_GROUP_WIDTH + __builtin_ctz(m);
+            if (flat_key_eq(ht, flat_slot(ht, i), key))
+                return i;
+        }
+        if (group_match_empty(ctrl))
+            return -1;
+        if (++step > groups_mask)
+            return -1;
+        g = (g + step) & groups_mask;
+    }
+}
+
+void os_flat_hash_set(os_flat_hash_t *ht, const void *key, const void *val)
+{
+    uint64_t hash;
+    ssize_t i;
+    size_t j;
+
+    os_assert(ht);
+    os_assert(key);
+    os_assert(val || !ht->vsize);
+
+    hash = flat_hash_of(ht, key);
+
+    i = flat_find(ht, key, hash);
+    if (i >= 0) {
+        if (ht->vsize)
+            memcpy(flat_slot(ht, i) + ht->ksize, val, ht->vsize);
+        return;
+    }
+
+    j = flat_find_free(ht, hash);
+    if (ht->growth_left == 0 && ht->ctrl[j] == FLAT_CTRL_EMPTY) {
+        flat_rehash_for_insert(ht);
+        j = flat_find_free(ht, hash);
+    }
+
+    flat_set_ctrl(ht, j, FLAT_H2(hash));
+    memcpy(flat_slot(ht, j), key, ht->ksize);
+    if (ht->vsize)
+        memcpy(flat_slot(ht, j) + ht->ksize, val, ht->vsize);
+    ht->count++;
+}
+
+void *os_flat_hash_get(os_flat_hash_t *ht, const void *key)
+{
+    ssize_t i;
+
+    os_assert(ht);
+    os_assert(key);
+
+    i = flat_find(ht, key, flat_hash_of(ht, key));
+    if (i < 0)
+        return NULL;
+
+    return flat_slot(ht, i) + ht->ksize;
+}
+
+void os_flat_hash_get_burst(os_flat_hash_t *ht,
+        const void * const keys[], unsigned int n, void *vals[])
+{
+    uint64_t hash[FLAT_BURST];
+    size_t groups_mask, g;
+    unsigned int i, j, m;
+    flat_mask_t match;
+    ssize_t k;
+
+    os_assert(ht);
+    os_assert(keys);
+    os_assert(vals);
+
+    groups_mask = ht->capacity / FLAT_GROUP_WIDTH - 1;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < FLAT_BURST ? n - i : FLAT_BURST;
+
+        for (j = 0; j < m; j++) {
+            hash[j] = flat_hash_of(ht, keys[i + j]);
+            os_prefetch(ht->ctrl +
+                    (FLAT_H1(hash[j]) & groups_mask) * FLAT_GROUP_WIDTH);
+        }
+
+        /* the first candidate slot is almost always the right one */
+        for (j = 0; j < m; j++) {
+            g = (FLAT_H1(hash[j]) & groups_mask) * FLAT_GROUP_WIDTH;
+            match = group_match(ht->ctrl + g, FLAT_H2(hash[j]));
+            if (match)
+                os_prefetch(flat_slot(ht, g + __builtin_ctz(match)));
+        }
+
+        for (j = 0; j < m; j++) {
+            k = flat_find(ht, keys[i + j], hash[j]);
+            vals[i + j] = k < 0 ? NULL : flat_slot(ht, k) + ht->ksize;
+        }
+    }
+}
+
+int os_flat_hash_remove(os_flat_hash_t *ht, const void *key)
+{
+    ssize_t i;
+    size_t g;
+
+    os_assert(ht);
+    os_assert(key);
+
+    i = flat_find(ht, key, flat_hash_of(ht, key));
+    if (i < 0)
+        return OS_ERROR;
+
+    /*
+     * A group that still has an EMPTY slot has never been full, so no
+     * probe sequence continues past it and the slot can become EMPTY.
+     */
+    g = i & ~((size_t)FLAT_GROUP_WIDTH - 1);
+    if (group_match_empty(ht->ctrl + g)) {
+        ht->ctrl[i] = FLAT_CTRL_EMPTY;
+        ht->growth_left++;
+    } else {
+        ht->ctrl[i] = FLAT_CTRL_DELETED;
+    }
+    ht->count--;
+
+    return OS_OK;
+}
+
+unsigned int os_flat_hash_count(os_flat_hash_t *ht)
+{
+    os_assert(ht);
+    return ht->count;
+}
+
+void os_flat_hash_clear(os_flat_hash_t *ht)
+{
+    os_assert(ht);
+
+    memset(ht->ctrl, FLAT_CTRL_EMPTY, ht->capacity);
+    ht->growth_left = flat_growth(ht->capacity);
+    ht->count = 0;
+}
+
+os_flat_hash_index_t *os_flat_hash_next(os_flat_hash_index_t *hi)
+{
+    os_flat_hash_t *ht = NULL;
+
+    os_assert(hi);
+    ht = hi->ht;
+
+    for (hi->i++; hi->i < ht->capacity; hi->i++) {
+        if (ht->ctrl[hi->i] >= 0)
+            return hi;
+    }
+
+    return NULL;
+}
+
+os_flat_hash_index_t *os_flat_hash_first(os_flat_hash_t *ht)
+{
+    os_assert(ht);
+
+    return os_flat_hash_first_r(ht, &ht->iterator);
+}
+
+os_flat_hash_index_t *os_flat_hash_first_r(
+        os_flat_hash_t *ht, os_flat_hash_index_t *hi)
+{
+    os_assert(ht);
+    os_assert(hi);
+
+    hi->ht = ht;
+    hi->i = (size_t)-1;
+
+    return os_flat_hash_next(hi);
+}
+
+const void *os_flat_hash_this_key(os_flat_hash_index_t *hi)
+{
+    os_assert(hi);
+    return flat_slot(hi->ht, hi->i);
+}
+
+void *os_flat_hash_this_val(os_flat_hash_index_t *hi)
+{
+    os_assert(hi);
+    return flat_slot(hi->ht, hi->i) + hi->ht->ksize;
+}
@@ -24,7 +24,6 @@
 
 #include "os_init.h"
 
-typedef struct os_hash_entry_t os_hash_entry_t;
 struct os_hash_entry_t {
     os_hash_entry_t    *next;
     unsigned int        hash;
@@ -33,21 +32,48 @@ struct os_hash_entry_t {
     const void          *val;
 };
 
-struct os_hash_index_t {
-    os_hash_t          *ht;
-    os_hash_entry_t    *this, *next;
-    unsigned int        index;
-};
-
+/*
+ * While growing, buckets [0, rehash_idx) of array have been moved to
+ * new_array. Every new key moves a few more, so no single insert pays
+ * for the whole table.
+ */
 struct os_hash_t {
     os_hash_entry_t    **array;
+    os_hash_entry_t    **new_array; /* non-NULL while rehashing */
     os_hash_index_t    iterator;  /* For os_hash_first(NULL, ...) */
-    unsigned int        count, max, seed;
+    unsigned int        count, max;
+    unsigned int        new_max, rehash_idx;
+    uint64_t            seed;
     os_hashfunc_t      hash_func;
     os_hash_entry_t    *free;  /* List of recycled entries */
 };
 
 #define INITIAL_MAX 15 /* tunable == 2^n - 1 */
+#define REHASH_STEP 8  /* non-empty buckets moved per new key */
+#define HASH_BULK   32 /* keys hashed and prefetched ahead */
+
+PRIVATE uint64_t hash_secret_seed;
+PRIVATE uint64_t hash_table_count;
+PRIVATE pthread_once_t hash_seed_once = PTHREAD_ONCE_INIT;
+
+PRIVATE void hash_seed_init(void)
+{
+    os_random(&hash_secret_seed, sizeof(hash_secret_seed));
+}
+
+PRIVATE os_inline uint64_t hash_process_seed(void)
+{
+    pthread_once(&hash_seed_once, hash_seed_init);
+    return hash_secret_seed;
+}
+
+/* distinct per table, derived from the process seed */
+PRIVATE uint64_t hash_table_seed(void)
+{
+    uint64_t n = os_atomic_inc(&hash_table_count);
+
+    return os_hash64(&n, sizeof(n), hash_process_seed());
+}
 
 PRIVATE os_hash_entry_t **alloc_array(os_hash_t *ht, unsigned int max)
 {
@@ -59,7 +85,6 @@ PRIVATE os_hash_entry_t **alloc_array(os_hash_t *ht, unsigned int max)
 os_hash_t *os_hash_make(void)
 {
     os_hash_t *ht;
-    os_time_t now = os_get_monotonic_time();
 
     ht = os_malloc(sizeof(os_hash_t));
     if (!ht) {
@@ -70,9 +95,11 @@ os_hash_t *os_hash_make(void)
     ht->free = NULL;
     ht->count = 0;
     ht->max = INITIAL_MAX;
-    ht->seed = (unsigned int)((now >> 32) ^ now ^ 
-                              (uintptr_t)ht ^ (uintptr_t)&now) - 1;
+    ht->seed = hash_table_seed();
     ht->array = alloc_array(ht, ht->max);
+    ht->new_array = NULL;
+    ht->new_max = 0;
+    ht->rehash_idx = 0;
     ht->hash_func = NULL;
 
     return ht;
@@ -106,6 +133,8 @@ void os_hash_destroy(os_hash_t *ht)
         he = next_he;
     }
 
+    if (ht->new_array)
+        os_free(ht->new_array);
     os_free(ht->array);
     os_free(ht);
 }
@@ -116,10 +145,15 @@ os_hash_index_t *os_hash_next(os_hash_index_t *hi)
 
     hi->this = hi->next;
     while (!hi->this) {
-        if (hi->index > hi->ht->max)
+        os_hash_t *ht = hi->ht;
+
+        /* old buckets first, then the ones already moved */
+        if (hi->index <= ht->max)
+            hi->this = ht->array[hi->index++];
+        else if (ht->new_array && hi->index - ht->max - 1 <= ht->new_max)
+            hi->this = ht->new_array[hi->index++ - ht->max - 1];
+        else
             return NULL;
-
-        hi->this = hi->ht->array[hi->index++];
     }
     hi->next = hi->this->next;
     return hi;
@@ -127,11 +161,15 @@ os_hash_index_t *os_hash_next(os_hash_index_t *hi)
 
 os_hash_index_t *os_hash_first(os_hash_t *ht)
 {
-    os_hash_index_t *hi;
-
     os_assert(ht);
 
-    hi = &ht->iterator;
+    return os_hash_first_r(ht, &ht->iterator);
+}
+
+os_hash_index_t *os_hash_first_r(os_hash_t *ht, os_hash_index_t *hi)
+{
+    os_assert(ht);
+    os_assert(hi);
 
     hi->ht = ht;
     hi->index = 0;
@@ -174,22 +212,78 @@ void *os_hash_this_val(os_hash_index_t *hi)
     return val;
 }
 
-PRIVATE void expand_array(os_hash_t *ht)
+PRIVATE void rehash_finish(os_hash_t *ht)
+{
+    os_free(ht->array);
+    ht->array = ht->new_array;
+    ht->max = ht->new_max;
+    ht->new_array = NULL;
+    ht->new_max = 0;
+    ht->rehash_idx = 0;
+}
+
+/* move up to n non-empty buckets, visiting at most 10 * n empty ones */
+PRIVATE void rehash_step(os_hash_t *ht, unsigned int n)
+{
+    os_hash_entry_t *he, *next;
+    unsigned int empty_visits = n * 10;
+
+    while (n && ht->rehash_idx <= ht->max) {
+        he = ht->array[ht->rehash_idx];
+        if (!he) {
+            ht->rehash_idx++;
+            if (--empty_visits == 0)
+                break;
+            continue;
+        }
+        while (he) {
+            unsigned int i = he->hash & ht->new_max;
+            next = he->next;
+            he->next = ht->new_array[i];
+            ht->new_array[i] = he;
+            he = next;
+        }
+        ht->array[ht->rehash_idx++] = NULL;
+        n--;
+    }
+
+    if (ht->rehash_idx > ht->max)
+        rehash_finish(ht);
+}
+
+PRIVATE void rehash_start(os_hash_t *ht, unsigned int new_max)
+{
+    os_assert(!ht->new_array);
+
+    ht->new_max = new_max;
+    ht->new_array = alloc_array(ht, new_max);
+    ht->rehash_idx = 0;
+}
+
+PRIVATE os_inline os_hash_entry_t **bucket_of(os_hash_t *ht, unsigned int hash)
+{
+    if (ht->new_array && (hash & ht->max) < ht->rehash_idx)
+        return &ht->new_array[hash & ht->new_max];
+    return &ht->array[hash & ht->max];
+}
+
+void os_hash_reserve(os_hash_t *ht, unsigned int n)
 {
-    os_hash_index_t *hi;
-    os_hash_entry_t **new_array;
     unsigned int new_max;
 
-    new_max = ht->max * 2 + 1;
-    new_array = alloc_array(ht, new_max);
-    for (hi = os_hash_first(ht); hi; hi = os_hash_next(hi)) {
-        unsigned int i = hi->this->hash & new_max;
-        hi->this->next = new_array[i];
-        new_array[i] = hi->this;
+    os_assert(ht);
+
+    if (ht->new_array)
+        rehash_step(ht, UINT_MAX);
+
+    new_max = ht->max;
+    while (new_max < n && new_max < UINT_MAX / 2)
+        new_max = new_max * 2 + 1;
+
+    if (new_max != ht->max) {
+        rehash_start(ht, new_max);
+        rehash_step(ht, UINT_MAX);
     }
-    os_free(ht->array);
-    ht->array = new_array;
-    ht->max = new_max;
 }
 
 PRIVATE unsigned int hashfunc_default(
@@ -257,19 +351,133 @@ unsigned int os_hashfunc_default(const char *char_key, int *klen)
     return hashfunc_default(char_key, klen, 0);
 }
 
-PRIVATE os_hash_entry_t **find_entry(os_hash_t *ht,
-        const void *key, int klen, const void *val, const char *file_line)
+/*
+ * wyhash final version 4 by Wang Yi, released into the public domain.
+ * https://github.com/wangyi-fudan/wyhash
+ */
+PRIVATE const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+PRIVATE os_inline void wymum(uint64_t *a, uint64_t *b)
 {
-    os_hash_entry_t **hep, *he;
-    unsigned int hash;
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b, hi, lo;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+PRIVATE os_inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+PRIVATE os_inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+PRIVATE os_inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+PRIVATE os_inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t os_hash64(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+
+    if (os_likely(len <= 16)) {
+        if (os_likely(len >= 4)) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (os_likely(len > 0)) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+
+        if (os_unlikely(i > 48)) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (os_likely(i > 48));
+            seed ^= see1 ^ see2;
+        }
+        while (os_unlikely(i > 16)) {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a, &b);
+
+    return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+unsigned int os_hashfunc_fast(const char *char_key, int *klen)
+{
+    if (*klen == OS_HASH_KEY_STRING)
+        *klen = strlen(char_key);
 
+    return (unsigned int)os_hash64(char_key, *klen, hash_process_seed());
+}
+
+PRIVATE os_inline unsigned int hash_key(os_hash_t *ht, const void *key, int *klen)
+{
     if (ht->hash_func)
-        hash = ht->hash_func(key, &klen);
-    else
-        hash = hashfunc_default(key, &klen, ht->seed);
+        return ht->hash_func(key, klen);
+
+    if (*klen == OS_HASH_KEY_STRING)
+        *klen = strlen(key);
+    return (unsigned int)os_hash64(key, *klen, ht->seed);
+}
+
+PRIVATE os_hash_entry_t **find_entry(os_hash_t *ht, const void *key,
+        int klen, unsigned int hash, const void *val, const char *file_line)
+{
+    os_hash_entry_t **hep, *he;
 
     /* scan linked list */
-    for (hep = &ht->array[hash & ht->max], he = *hep;
+    for (hep = bucket_of(ht, hash), he = *hep;
          he; hep = &he->next, he = *hep) {
         if (he->hash == hash
             && he->klen == klen
@@ -279,6 +487,19 @@ PRIVATE os_hash_entry_t **find_entry(os_hash_t *ht,
     if (he || !val)
         return hep;
 
+    /*
+     * Only a new key advances the rehash, so lookups, replacements and
+     * deletions never move entries under a running iterator.
+     */
+    if (ht->new_array) {
+        /* must be done before the new table fills up as well */
+        rehash_step(ht, ht->count >= ht->new_max ? UINT_MAX : REHASH_STEP);
+    } else if (ht->count >= ht->max) {
+        rehash_start(ht, ht->max * 2 + 1);
+        rehash_step(ht, REHASH_STEP);
+    }
+    hep = bucket_of(ht, hash);
+
     /* add a new entry for non-NULL values */
     if ((he = ht->free) != NULL)
         ht->free = he->next;
@@ -286,7 +507,7 @@ PRIVATE os_hash_entry_t **find_entry(os_hash_t *ht,
         he = os_malloc(sizeof(*he));
         os_assert(he);
     }
-    he->next = NULL;
+    he->next = *hep;
     he->hash = hash;
     he->key  = key;
     he->klen = klen;
@@ -300,28 +521,22 @@ void *os_hash_get_debug(os_hash_t *ht,
         const void *key, int klen, const char *file_line)
 {
     os_hash_entry_t *he;
+    unsigned int hash;
 
     os_assert(ht);
     os_assert(key);
     os_assert(klen);
 
-    he = *find_entry(ht, key, klen, NULL, file_line);
+    hash = hash_key(ht, key, &klen);
+    he = *find_entry(ht, key, klen, hash, NULL, file_line);
     if (he)
         return (void *)he->val;
     else
         return NULL;
 }
 
-void os_hash_set_debug(os_hash_t *ht,
-        const void *key, int klen, const void *val, const char *file_line)
+PRIVATE void set_entry(os_hash_t *ht, os_hash_entry_t **hep, const void *val)
 {
-    os_hash_entry_t **hep;
-
-    os_assert(ht);
-    os_assert(key);
-    os_assert(klen);
-
-    hep = find_entry(ht, key, klen, val, file_line);
     if (*hep) {
         if (!val) {
             /* delete entry */
@@ -333,31 +548,38 @@ void os_hash_set_debug(os_hash_t *ht,
         } else {
             /* replace entry */
             (*hep)->val = val;
-            /* check that the collision rate isn't too high */
-            if (ht->count > ht->max) {
-                expand_array(ht);
-            }
         }
     }
     /* else key not present and val==NULL */
 }
 
+void os_hash_set_debug(os_hash_t *ht,
+        const void *key, int klen, const void *val, const char *file_line)
+{
+    unsigned int hash;
+
+    os_assert(ht);
+    os_assert(key);
+    os_assert(klen);
+
+    hash = hash_key(ht, key, &klen);
+    set_entry(ht, find_entry(ht, key, klen, hash, val, file_line), val);
+}
+
 void *os_hash_get_or_set_debug(os_hash_t *ht,
         const void *key, int klen, const void *val, const char *file_line)
 {
     os_hash_entry_t **hep;
+    unsigned int hash;
 
     os_assert(ht);
     os_assert(key);
     os_assert(klen);
 
-    hep = find_entry(ht, key, klen, val, file_line);
+    hash = hash_key(ht, key, &klen);
+    hep = find_entry(ht, key, klen, hash, val, file_line);
     if (*hep) {
         val = (*hep)->val;
-        /* check that the collision rate isn't too high */
-        if (ht->count > ht->max) {
-            expand_array(ht);
-        }
         return (void *)val;
     }
     /* else key not present and val==NULL */
@@ -370,14 +592,127 @@ unsigned int os_hash_count(os_hash_t *ht)
     return ht->count;
 }
 
-void os_hash_clear(os_hash_t *ht)
+/* hash a batch of keys and prefetch the bucket slots they land in */
+PRIVATE void bulk_prepare(os_hash_t *ht, const void * const keys[],
+        const int klens[], int klen, int klen_out[], unsigned int hash[],
+        unsigned int n)
 {
-    os_hash_index_t *hi;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        os_assert(keys[i]);
+        klen_out[i] = klens ? klens[i] : klen;
+        os_assert(klen_out[i]);
+        hash[i] = hash_key(ht, keys[i], &klen_out[i]);
+        os_prefetch(bucket_of(ht, hash[i]));
+    }
+}
+
+void os_hash_set_bulk(os_hash_t *ht, const void * const keys[],
+        const int klens[], const void * const vals[], unsigned int n)
+{
+    unsigned int hash[HASH_BULK], i, j, m;
+    int klen[HASH_BULK];
+
+    os_assert(ht);
+    os_assert(keys);
+    os_assert(vals);
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < HASH_BULK ? n - i : HASH_BULK;
+        bulk_prepare(ht, keys + i, klens ? klens + i : NULL,
+                OS_HASH_KEY_STRING, klen, hash, m);
+
+        for (j = 0; j < m; j++)
+            set_entry(ht, find_entry(ht, keys[i + j], klen[j], hash[j],
+                        vals[i + j], OS_FILE_LINE), vals[i + j]);
+    }
+}
+
+/*
+ * Three passes per batch so that each one only touches memory the
+ * previous pass prefetched: hash and prefetch the bucket slots, load the
+ * chain heads and prefetch the entries, then compare keys.
+ */
+PRIVATE void get_batch(os_hash_t *ht, const void * const keys[],
+        const int klens[], int klen_all, void *vals[], unsigned int n)
+{
+    unsigned int hash[HASH_BULK], i, j, m;
+    int klen[HASH_BULK];
+    os_hash_entry_t *head[HASH_BULK], *he;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < HASH_BULK ? n - i : HASH_BULK;
+        bulk_prepare(ht, keys + i, klens ? klens + i : NULL,
+                klen_all, klen, hash, m);
+
+        for (j = 0; j < m; j++) {
+            head[j] = *bucket_of(ht, hash[j]);
+            if (head[j])
+                os_prefetch(head[j]);
+        }
+
+        for (j = 0; j < m; j++) {
+            for (he = head[j]; he; he = he->next) {
+                if (he->hash == hash[j]
+                    && he->klen == klen[j]
+                    && memcmp(he->key, keys[i + j], klen[j]) == 0)
+                    break;
+            }
+            vals[i + j] = he ? (void *)he->val : NULL;
+        }
+    }
+}
+
+void os_hash_get_bulk(os_hash_t *ht, const void * const keys[],
+        const int klens[], void *vals[], unsigned int n)
+{
+    os_assert(ht);
+    os_assert(keys);
+    os_assert(vals);
 
+    get_batch(ht, keys, klens, OS_HASH_KEY_STRING, vals, n);
+}
+
+void os_hash_get_burst(os_hash_t *ht,
+        const void * const keys[], int klen, unsigned int n, void *vals[])
+{
     os_assert(ht);
+    os_assert(keys);
+    os_assert(klen);
+    os_assert(vals);
+
+    get_batch(ht, keys, NULL, klen, vals, n);
+}
 
-    for (hi = os_hash_first(ht); hi; hi = os_hash_next(hi))
-        os_hash_set(ht, hi->this->key, hi->this->klen, NULL);
+/* hand every chain of array[0..max] to the free list at once */
+PRIVATE void clear_array(os_hash_t *ht, os_hash_entry_t **array, unsigned int max)
+{
+    os_hash_entry_t *he;
+    unsigned int i;
+
+    for (i = 0; i <= max; i++) {
+        if (!(he = array[i]))
+            continue;
+        while (he->next)
+            he = he->next;
+        he->next = ht->free;
+        ht->free = array[i];
+        array[i] = NULL;
+    }
+}
+
+void os_hash_clear(os_hash_t *ht)
+{
+    os_assert(ht);
+
+    clear_array(ht, ht->array, ht->max);
+    if (ht->new_array) {
+        /* nothing left to move, keep the bigger table */
+        clear_array(ht, ht->new_array, ht->new_max);
+        rehash_finish(ht);
+    }
+    ht->count = 0;
 }
 
 /* This is basically the following...
@@ -0,0 +1,249 @@
+/************************************************************************
+ *File name: os_hash_int.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+#define HASH_INT_MIN_BITS   4
+#define HASH_INT_FIB        0x9E3779B97F4A7C15ULL
+#define HASH_INT_BURST      32
+
+/* grow at 3/4 load so that probe runs stay short and a slot is always free */
+#define HASH_INT_FULL(count, cap) ((count) + 1 > (cap) - (cap) / 4)
+
+#define OS_HASH_INT_DEFINE(name, ktype) \
+    \
+    typedef struct name##_entry_s { \
+        ktype key; \
+        const void *val; /* NULL: empty slot */ \
+    } name##_entry_t; \
+    \
+    struct os_##name##_index_s { \
+        os_##name##_t *ht; \
+        size_t i, left; \
+    }; \
+    \
+    struct os_##name##_s { \
+        name##_entry_t *array; \
+        size_t mask; \
+        unsigned int shift; \
+        unsigned int count; \
+        os_##name##_index_t iterator; \
+    }; \
+    \
+    PRIVATE os_inline size_t name##_slot(const os_##name##_t *ht, ktype key) \
+    { \
+        return (size_t)(((uint64_t)key * HASH_INT_FIB) >> ht->shift); \
+    } \
+    \
+    PRIVATE void name##_alloc(os_##name##_t *ht, unsigned int bits) \
+    { \
+        ht->array = os_calloc((size_t)1 << bits, sizeof(name##_entry_t)); \
+        os_assert(ht->array); \
+        ht->mask = ((size_t)1 << bits) - 1; \
+        ht->shift = 64 - bits; \
+    } \
+    \
+    PRIVATE void name##_resize(os_##name##_t *ht, unsigned int bits) \
+    { \
+        name##_entry_t *old = ht->array; \
+        size_t old_cap = ht->mask + 1, i, j; \
+        \
+        name##_alloc(ht, bits); \
+        for (i = 0; i < old_cap; i++) { \
+            if (!old[i].val) \
+                continue; \
+            for (j = name##_slot(ht, old[i].key); ht->array[j].val; \
+                    j = (j + 1) & ht->mask); \
+            ht->array[j] = old[i]; \
+        } \
+        os_free(old); \
+    } \
+    \
+    /* @return the slot holding key, or the empty slot ending its run */ \
+    PRIVATE os_inline size_t name##_find(const os_##name##_t *ht, ktype key) \
+    { \
+        size_t i = name##_slot(ht, key); \
+        \
+        while (ht->array[i].val && ht->array[i].key != key) \
+            i = (i + 1) & ht->mask; \
+        return i; \
+    } \
+    \
+    PRIVATE void name##_delete(os_##name##_t *ht, size_t i) \
+    { \
+        size_t j = i, home; \
+        \
+        /* pull back later entries whose home is not in (i, j] */ \
+        for ( ;; ) { \
+            j = (j + 1) & ht->mask; \
+            if (!ht->array[j].val) \
+                break; \
+            home = name##_slot(ht, ht->array[j].key); \
+            if (((j - home) & ht->mask) >= ((j - i) & ht->mask)) { \
+                ht->array[i] = ht->array[j]; \
+                i = j; \
+            } \
+        } \
+        ht->array[i].val = NULL; \
+        ht->count--; \
+    } \
+    \
+    os_##name##_t *os_##name##_make(void) \
+    { \
+        os_##name##_t *ht = os_calloc(1, sizeof *ht); \
+        if (!ht) { \
+            os_log(ERROR, "os_calloc() failed"); \
+            return NULL; \
+        } \
+        name##_alloc(ht, HASH_INT_MIN_BITS); \
+        return ht; \
+    } \
+    \
+    void os_##name##_destroy(os_##name##_t *ht) \
+    { \
+        os_assert(ht); \
+        os_free(ht->array); \
+        os_free(ht); \
+    } \
+    \
+    void os_##name##_reserve(os_##name##_t *ht, unsigned int n) \
+    { \
+        unsigned int bits = 64 - ht->shift; \
+        \
+        os_assert(ht); \
+        while (HASH_INT_FULL(n, (size_t)1 << bits)) \
+            bits++; \
+        if (bits != 64 - ht->shift) \
+            name##_resize(ht, bits); \
+    } \
+    \
+    void *os_##name##_get(os_##name##_t *ht, ktype key) \
+    { \
+        os_assert(ht); \
+        return (void *)ht->array[name##_find(ht, key)].val; \
+    } \
+    \
+    void os_##name##_get_burst(os_##name##_t *ht, \
+            const ktype keys[], unsigned int n, void *vals[]) \
+    { \
+        size_t slot[HASH_INT_BURST]; \
+        unsigned int i, j, m; \
+        \
+        os_assert(ht); \
+        for (i = 0; i < n; i += m) { \
+            m = n - i < HASH_INT_BURST ? n - i : HASH_INT_BURST; \
+            for (j = 0; j < m; j++) { \
+                slot[j] = name##_slot(ht, keys[i + j]); \
+                os_prefetch(&ht->array[slot[j]]); \
+            } \
+            for (j = 0; j < m; j++) { \
+                size_t k = slot[j]; \
+                while (ht->array[k].val && ht->array[k].key != keys[i + j]) \
+                    k = (k + 1) & ht->mask; \
+                vals[i + j] = (void *)ht->array[k].val; \
+            } \
+        } \
+    } \
+    \
+    void *os_##name##_get_or_set(os_##name##_t *ht, ktype key, const void *val) \
+    { \
+        size_t i; \
+        \
+        os_assert(ht); \
+        i = name##_find(ht, key); \
+        if (ht->array[i].val || !val) \
+            return (void *)ht->array[i].val; \
+        \
+        if (HASH_INT_FULL(ht->count, ht->mask + 1)) { \
+            name##_resize(ht, 64 - ht->shift + 1); \
+            i = name##_find(ht, key); \
+        } \
+        ht->array[i].key = key; \
+        ht->array[i].val = val; \
+        ht->count++; \
+        return (void *)val; \
+    } \
+    \
+    void os_##name##_set(os_##name##_t *ht, ktype key, const void *val) \
+    { \
+        size_t i; \
+        \
+        os_assert(ht); \
+        i = name##_find(ht, key); \
+        if (ht->array[i].val) { \
+            if (val) \
+                ht->array[i].val = val; \
+            else \
+                name##_delete(ht, i); \
+            return; \
+        } \
+        if (val) \
+            os_##name##_get_or_set(ht, key, val); \
+    } \
+    \
+    /* \
+     * Walk backwards from an empty slot: a backward shift after deleting \
+     * the current entry only moves entries that were already visited. \
+     */ \
+    os_##name##_index_t *os_##name##_next(os_##name##_index_t *hi) \
+    { \
+        os_##name##_t *ht = NULL; \
+        \
+        os_assert(hi); \
+        ht = hi->ht; \
+        while (hi->left) { \
+            hi->left--; \
+            hi->i = (hi->i - 1) & ht->mask; \
+            if (ht->array[hi->i].val) \
+                return hi; \
+        } \
+        return NULL; \
+    } \
+    \
+    os_##name##_index_t *os_##name##_first(os_##name##_t *ht) \
+    { \
+        os_##name##_index_t *hi = NULL; \
+        size_t i; \
+        \
+        os_assert(ht); \
+        for (i = ht->mask; ht->array[i].val; i--); \
+        \
+        hi = &ht->iterator; \
+        hi->ht = ht; \
+        hi->i = i; \
+        hi->left = ht->mask; \
+        return os_##name##_next(hi); \
+    } \
+    \
+    ktype os_##name##_this_key(os_##name##_index_t *hi) \
+    { \
+        os_assert(hi); \
+        return hi->ht->array[hi->i].key; \
+    } \
+    \
+    void *os_##name##_this_val(os_##name##_index_t *hi) \
+    { \
+        os_assert(hi); \
+        return (void *)hi->ht->array[hi->i].val; \
+    } \
+    \
+    unsigned int os_##name##_count(os_##name##_t *ht) \
+    { \
+        os_assert(ht); \
+        return ht->count; \
+    } \
+    \
+    void os_##name##_clear(os_##name##_t *ht) \
+    { \
+        os_assert(ht); \
+        memset(ht->array, 0, (ht->mask + 1) * sizeof(name##_entry_t)); \
+        ht->count = 0; \
+    }
+
+OS_HASH_INT_DEFINE(hash_u32, uint32_t)
+OS_HASH_INT_DEFINE(hash_u64, uint64_t)
@@ -42,16 +42,21 @@ _ENTER_API_ void os_core_initialize(void)
 #if OS_USE_TALLOC == 1
     os_kmem_init();
 #else
+    os_slab_init();
     os_buf_init();
 #endif
+    os_rcu_init();
 }
 
 _EXIT_API_ void os_core_terminate(void)
 {
+    os_rcu_final();
+
 #if OS_USE_TALLOC == 1
     os_kmem_final();
 #else
     os_buf_final();
+    os_slab_final();
 #endif
 
 #if defined(OS_USE_CDLOG)
@@ -190,9 +190,11 @@ PRIVATE int kqueue_process(os_pollset_t *pollset, os_time_t timeout)
         tp = &ts;
     }
 
+    os_rcu_thread_offline();
     n = kevent(context->kqueue,
             context->change_list, context->nchanges,
             context->event_list, context->nevents, tp);
+    os_rcu_thread_online();
 
     context->nchanges = 0;
 
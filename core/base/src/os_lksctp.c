@@ -5,6 +5,10 @@
  *Current Version:
  *Author: Created by sjw --- 2024.01
 ************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg */
+#endif
+
 #include "os_init.h"
 
 PRIVATE int subscribe_to_events(os_sock_t *sock);
@@ -206,6 +210,84 @@ int os_sctp_sendmsg(os_sock_t *sock, const void *msg, size_t len, os_sockaddr_t
             0); /* context */
 }
 
+/*
+ * Each message carries its own stream and PPID in a cmsg, so a batch
+ * may mix streams. RFC 6458 SCTP_SNDINFO where the headers have it,
+ * the older SCTP_SNDRCV otherwise.
+ */
+#if defined(SCTP_SNDINFO)
+typedef struct sctp_sndinfo sctp_cmsg_info_t;
+#define SCTP_CMSG_TYPE SCTP_SNDINFO
+#define sctp_cmsg_info_set(__iNFO, __pPID, __sTREAM) do { \
+    (__iNFO)->snd_ppid = htobe32(__pPID); \
+    (__iNFO)->snd_sid = (__sTREAM); \
+} while (0)
+#else
+typedef struct sctp_sndrcvinfo sctp_cmsg_info_t;
+#define SCTP_CMSG_TYPE SCTP_SNDRCV
+#define sctp_cmsg_info_set(__iNFO, __pPID, __sTREAM) do { \
+    (__iNFO)->sinfo_ppid = htobe32(__pPID); \
+    (__iNFO)->sinfo_stream = (__sTREAM); \
+} while (0)
+#endif
+
+int os_sctp_sendmmsg(os_sock_t *sock, os_buf_t **bufs, int count)
+{
+#if defined(__linux__)
+    struct mmsghdr msgs[OS_SCTP_SEND_BATCH];
+    struct iovec iov[OS_SCTP_SEND_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(sctp_cmsg_info_t))];
+        struct cmsghdr align;
+    } control[OS_SCTP_SEND_BATCH];
+    struct cmsghdr *cmsg = NULL;
+    sctp_cmsg_info_t *info = NULL;
+    int i;
+
+    os_assert(sock);
+    os_assert(bufs);
+    os_assert(count > 0 && count <= OS_SCTP_SEND_BATCH);
+
+    memset(msgs, 0, sizeof(msgs[0]) * count);
+    memset(control, 0, sizeof(control[0]) * count);
+
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = bufs[i]->data;
+        iov[i].iov_len = bufs[i]->len;
+
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+
+        cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+        cmsg->cmsg_level = IPPROTO_SCTP;
+        cmsg->cmsg_type = SCTP_CMSG_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(*info));
+
+        info = (sctp_cmsg_info_t *)CMSG_DATA(cmsg);
+        sctp_cmsg_info_set(info, os_sctp_ppid_in_buf(bufs[i]),
+                os_sctp_stream_no_in_buf(bufs[i]));
+    }
+
+    return sendmmsg(sock->fd, msgs, count, 0);
+#else
+    int i;
+
+    os_assert(sock);
+    os_assert(bufs);
+
+    for (i = 0; i < count; i++) {
+        if (os_sctp_sendmsg(sock, bufs[i]->data, bufs[i]->len, NULL,
+                    os_sctp_ppid_in_buf(bufs[i]),
+                    os_sctp_stream_no_in_buf(bufs[i])) < 0)
+            return i ? i : OS_ERROR;
+    }
+
+    return count;
+#endif
+}
+
 int os_sctp_recvmsg(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from, os_sctp_info_t *sinfo, int *msg_flags)
 {
     int size;
@@ -222,7 +304,8 @@ int os_sctp_recvmsg(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from,
     size = sctp_recvmsg(sock->fd, msg, len, &addr.sa, &addrlen,
                 &sndrcvinfo, &flags);
     if (size < 0) {
-        os_logsp(ERROR, ERRNOID, os_socket_errno, "sctp_recvmsg(%d) failed", size);
+        if (os_socket_errno != OS_EAGAIN)
+            os_logsp(ERROR, ERRNOID, os_socket_errno, "sctp_recvmsg(%d) failed", size);
         return size;
     }
 
@@ -235,6 +318,7 @@ int os_sctp_recvmsg(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from,
     }
 
     if (sinfo) {
+        sinfo->assoc_id = sndrcvinfo.sinfo_assoc_id;
         sinfo->ppid = be32toh(sndrcvinfo.sinfo_ppid);
         sinfo->stream_no = sndrcvinfo.sinfo_stream;
     }
@@ -242,6 +326,58 @@ int os_sctp_recvmsg(os_sock_t *sock, void *msg, size_t len, os_sockaddr_t *from,
     return size;
 }
 
+os_sock_t *os_sctp_peeloff(os_sock_t *sock, uint32_t assoc_id)
+{
+    os_sock_t *new = NULL;
+    int fd;
+
+    os_assert(sock);
+
+    fd = sctp_peeloff(sock->fd, (sctp_assoc_t)assoc_id);
+    if (fd < 0) {
+        os_logsp(ERROR, ERRNOID, os_socket_errno,
+                "sctp_peeloff(%u) failed", assoc_id);
+        return NULL;
+    }
+
+    new = os_sock_create();
+    if (!new) {
+        os_closesocket(fd);
+        return NULL;
+    }
+    new->family = sock->family;
+    new->fd = fd;
+    memcpy(&new->local_addr, &sock->local_addr, sizeof(new->local_addr));
+
+    return new;
+}
+
+int os_sctp_assoc_streams(os_sock_t *sock, uint32_t assoc_id,
+        uint16_t *inbound, uint16_t *outbound)
+{
+    struct sctp_status status;
+    socklen_t socklen;
+
+    os_assert(sock);
+    os_assert(inbound);
+    os_assert(outbound);
+
+    memset(&status, 0, sizeof(status));
+    status.sstat_assoc_id = (sctp_assoc_t)assoc_id;
+    socklen = sizeof(status);
+    if (getsockopt(sock->fd, IPPROTO_SCTP, SCTP_STATUS,
+                            &status, &socklen) != 0) {
+        os_logsp(ERROR, ERRNOID, os_socket_errno,
+                "getsockopt(SCTP_STATUS) failed [assoc_id=%u]", assoc_id);
+        return OS_ERROR;
+    }
+
+    *inbound = status.sstat_instrms;
+    *outbound = status.sstat_outstrms;
+
+    return OS_OK;
+}
+
 /* is any of the bytes from offset .. u8_size in 'u8' non-zero? return offset
  * or -1 if all zero */
 PRIVATE int byte_nonzero(const uint8_t *u8, unsigned int offset, unsigned int u8_size)
@@ -363,6 +499,7 @@ PRIVATE int subscribe_to_events(os_sock_t *sock)
     event_subscribe.sctp_association_event = 1;
     event_subscribe.sctp_send_failure_event = 1;
     event_subscribe.sctp_shutdown_event = 1;
+    event_subscribe.sctp_address_event = 1;
 
 #ifdef DISABLE_SCTP_EVENT_WORKAROUND
     if (setsockopt(sock->fd, IPPROTO_SCTP, SCTP_EVENTS,
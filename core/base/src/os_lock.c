@@ -0,0 +1,269 @@
+/************************************************************************
+ *File name: os_lock.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+#define RW_WRITER       0x80000000u
+#define RW_WRITER_WAIT  0x40000000u
+#define RW_READERS      0x3fffffffu
+
+/*
+ * On a single CPU the holder cannot run while we spin, so waiters go
+ * straight to yielding or sleeping. Racy first-use init is harmless.
+ */
+PRIVATE int lock_spin = -1;
+
+PRIVATE int lock_spin_limit(void)
+{
+    if (os_unlikely(lock_spin < 0))
+        lock_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? OS_LOCK_SPIN : 0;
+
+    return lock_spin;
+}
+
+/* sleep on addr while it still holds val; off Linux just give up the CPU */
+PRIVATE void lock_sleep(uint32_t *addr, uint32_t val)
+{
+#if defined(__linux__)
+    os_futex_wait(addr, val, OS_INFINITE_TIME);
+#else
+    (void)addr;
+    (void)val;
+    sched_yield();
+#endif
+}
+
+PRIVATE void lock_wake(uint32_t *addr, int count)
+{
+#if defined(__linux__)
+    os_futex_wake(addr, count);
+#else
+    (void)addr;
+    (void)count;
+#endif
+}
+
+void os_spinlock_init(os_spinlock_t *lock)
+{
+    os_assert(lock);
+    memset(lock, 0, sizeof(*lock));
+}
+
+void os_spinlock_lock_slow(os_spinlock_t *lock, uint32_t ticket)
+{
+    uint64_t spins = 0;
+    uint32_t owner, i;
+    int limit = lock_spin_limit();
+
+    /*
+     * Back off in proportion to the number of holders ahead of us. Once
+     * that takes long, the holder or the next in line has most likely
+     * been preempted, and spinning on only burns its CPU time.
+     */
+    while ((owner = os_atomic_load(&lock->owner)) != ticket) {
+        if (spins < (uint64_t)limit) {
+            for (i = 0; i < ticket - owner; i++)
+                os_cpu_relax();
+        } else {
+            sched_yield();
+        }
+        spins++;
+    }
+
+    lock->stat.contended++;
+    lock->stat.spins += spins;
+}
+
+void os_mutex_init(os_mutex_t *lock)
+{
+    os_assert(lock);
+    memset(lock, 0, sizeof(*lock));
+}
+
+/*
+ * Drepper's three-state futex mutex ("Futexes Are Tricky", mutex 3)
+ * with a spin phase first: a holder of a short section is usually gone
+ * before a futex round trip would complete.
+ */
+void os_mutex_lock_slow(os_mutex_t *lock)
+{
+    uint64_t spins = 0, sleeps = 0;
+    uint32_t c;
+    int i, limit = lock_spin_limit();
+
+    for (i = 0; i < limit; i++) {
+        c = 0;
+        if (os_atomic_load_relaxed(&lock->state) == 0 &&
+                os_atomic_cas(&lock->state, &c, 1))
+            goto out;
+        os_cpu_relax();
+        spins++;
+    }
+
+    c = os_atomic_xchg(&lock->state, 2);
+    while (c != 0) {
+        lock_sleep(&lock->state, 2);
+        sleeps++;
+        c = os_atomic_xchg(&lock->state, 2);
+    }
+
+out:
+    lock->stat.contended++;
+    lock->stat.spins += spins;
+    lock->stat.sleeps += sleeps;
+}
+
+void os_mutex_unlock_slow(os_mutex_t *lock)
+{
+    os_atomic_store(&lock->state, 0);
+    lock_wake(&lock->state, 1);
+}
+
+void os_rwlock_init(os_rwlock_t *lock)
+{
+    os_assert(lock);
+    memset(lock, 0, sizeof(*lock));
+}
+
+/*
+ * Waiters sample seq, announce themselves, then re-check the state; a
+ * releaser changes the state, then bumps seq if anyone is announced.
+ * The full fences on both sides make sure one of them sees the other.
+ */
+PRIVATE void rwlock_wait(os_rwlock_t *lock, uint32_t blocked, uint64_t *sleeps)
+{
+    uint32_t seq = os_atomic_load(&lock->seq);
+
+    os_atomic_inc(&lock->waiters);
+    os_atomic_thread_fence();
+    if (os_atomic_load(&lock->state) & blocked) {
+        lock_sleep(&lock->seq, seq);
+        (*sleeps)++;
+    }
+    os_atomic_dec(&lock->waiters);
+}
+
+PRIVATE void rwlock_wake(os_rwlock_t *lock)
+{
+    os_atomic_thread_fence();
+    if (os_atomic_load_relaxed(&lock->waiters)) {
+        os_atomic_inc(&lock->seq);
+        lock_wake(&lock->seq, INT_MAX);
+    }
+}
+
+bool os_rwlock_tryrdlock(os_rwlock_t *lock)
+{
+    uint32_t s = os_atomic_load_relaxed(&lock->state);
+
+    while (!(s & (RW_WRITER|RW_WRITER_WAIT))) {
+        if (os_atomic_cas_weak(&lock->state, &s, s + 1))
+            return true;
+    }
+
+    return false;
+}
+
+void os_rwlock_rdlock(os_rwlock_t *lock)
+{
+    uint64_t spins = 0, sleeps = 0;
+    int limit;
+
+    if (os_likely(os_rwlock_tryrdlock(lock)))
+        return;
+
+    limit = lock_spin_limit();
+    while (!os_rwlock_tryrdlock(lock)) {
+        if (spins < (uint64_t)limit) {
+            os_cpu_relax();
+            spins++;
+            continue;
+        }
+        rwlock_wait(lock, RW_WRITER|RW_WRITER_WAIT, &sleeps);
+    }
+
+    /* readers share the lock, so these need atomics */
+    __atomic_add_fetch(&lock->stat.contended, 1, OS_MO_RELAXED);
+    __atomic_add_fetch(&lock->stat.spins, spins, OS_MO_RELAXED);
+    if (sleeps)
+        __atomic_add_fetch(&lock->stat.sleeps, sleeps, OS_MO_RELAXED);
+}
+
+void os_rwlock_rdunlock(os_rwlock_t *lock)
+{
+    uint32_t s = __atomic_sub_fetch(&lock->state, 1, OS_MO_RELEASE);
+
+    /* the last reader out lets a waiting writer in */
+    if (!(s & RW_READERS) && (s & RW_WRITER_WAIT))
+        rwlock_wake(lock);
+}
+
+bool os_rwlock_trywrlock(os_rwlock_t *lock)
+{
+    uint32_t s = os_atomic_load_relaxed(&lock->state);
+
+    /* a writer may take the lock over the waiting bit; it is re-set */
+    while (!(s & (RW_WRITER|RW_READERS))) {
+        if (os_atomic_cas_weak(&lock->state, &s, RW_WRITER)) {
+            lock->stat.acquired++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void os_rwlock_wrlock(os_rwlock_t *lock)
+{
+    uint64_t spins = 0, sleeps = 0;
+    int limit;
+
+    if (os_likely(os_rwlock_trywrlock(lock)))
+        return;
+
+    limit = lock_spin_limit();
+    while (!os_rwlock_trywrlock(lock)) {
+        if (spins < (uint64_t)limit) {
+            os_cpu_relax();
+            spins++;
+            continue;
+        }
+        __atomic_fetch_or(&lock->state, RW_WRITER_WAIT, OS_MO_RELAXED);
+        rwlock_wait(lock, RW_WRITER|RW_READERS, &sleeps);
+    }
+
+    lock->stat.contended++;
+    lock->stat.spins += spins;
+    lock->stat.sleeps += sleeps;
+}
+
+void os_rwlock_wrunlock(os_rwlock_t *lock)
+{
+    __atomic_fetch_and(&lock->state, ~RW_WRITER, OS_MO_RELEASE);
+    rwlock_wake(lock);
+}
+
+void os_lock_stat_reset(os_lock_stat_t *stat)
+{
+    os_assert(stat);
+    memset(stat, 0, sizeof(*stat));
+}
+
+void os_lock_stat_show(const char *name, const os_lock_stat_t *stat)
+{
+    os_assert(stat);
+
+    fprintf(stderr, "lock %s : acquired=%llu,contended=%llu[%llu%%],"
+            "spins=%llu,sleeps=%llu!\n", name ? name : "-",
+            (unsigned long long)stat->acquired,
+            (unsigned long long)stat->contended,
+            stat->acquired ? (unsigned long long)
+                (stat->contended * 100 / stat->acquired) : 0ULL,
+            (unsigned long long)stat->spins,
+            (unsigned long long)stat->sleeps);
+}
@@ -0,0 +1,680 @@
+/************************************************************************
+ *File name: os_lpm.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+/*
+ * IPv4 table entry: 0 is empty, otherwise either
+ *   LPM_EXT | tbl8 group                 prefixes longer than /24 below
+ *   depth << 24 | rule index             leaf
+ */
+#define LPM_EXT             0x80000000u
+#define LPM_INDEX_MASK      0x00FFFFFFu
+#define LPM_NONE            0xFFFFFFFFu
+#define LPM_TBL24_SIZE      (1u << 24)
+#define LPM_TBL8_SIZE       256
+#define LPM_TBL8_MAX        (1u << 24)
+#define LPM_RULE_MAX        LPM_INDEX_MASK
+#define LPM_BURST           32
+
+#define lpm4_entry(rule, depth) (((uint32_t)(depth) << 24) | (rule))
+#define lpm4_depth(e)           ((int)(((e) >> 24) & 0x3F))
+#define lpm4_index(e)           ((e) & LPM_INDEX_MASK)
+
+typedef struct lpm_key_s {
+    uint8_t family;
+    uint8_t depth;
+    uint8_t pad[2];
+    uint8_t addr[16];   /* masked prefix, network byte order */
+} lpm_key_t;
+
+typedef struct lpm_rule_s {
+    lpm_key_t key;
+    void *data;         /* NULL: slot on the free list */
+    uint32_t next_free;
+} lpm_rule_t;
+
+typedef struct lpm6_node_s lpm6_node_t;
+typedef struct lpm6_entry_s {
+    uint32_t rule;      /* 0: no prefix ends here */
+    uint8_t depth;
+    lpm6_node_t *child;
+} lpm6_entry_t;
+
+struct lpm6_node_s {
+    lpm6_entry_t e[256];
+};
+
+struct os_lpm_s {
+    uint32_t *tbl24;    /* allocated with the first IPv4 prefix */
+    uint32_t *tbl8;
+    uint32_t tbl8_max, tbl8_top, tbl8_free;
+
+    lpm6_node_t *root6;
+    uint32_t default6;  /* ::/0 */
+
+    lpm_rule_t *rules;  /* index 0 is never used */
+    uint32_t rules_max, rules_top, rules_free;
+    os_flat_hash_t *index;  /* lpm_key_t -> rule index */
+
+    unsigned int count;
+};
+
+PRIVATE int subnet_key(const os_ipsubnet_t *subnet, lpm_key_t *key)
+{
+    int words, i, depth = 0;
+    uint32_t m, w;
+
+    memset(key, 0, sizeof *key);
+
+    if (subnet->family == AF_INET)
+        words = 1;
+    else if (subnet->family == AF_INET6)
+        words = 4;
+    else {
+        os_log(ERROR, "Unknown family(%d)", subnet->family);
+        return OS_ERROR;
+    }
+
+    for (i = 0; i < words; i++) {
+        m = be32toh(subnet->mask[i]);
+        /* ones then zeros, and nothing after a partial word */
+        if ((~m & (~m + 1)) != 0 || (m && depth != 32 * i)) {
+            os_log(ERROR, "Non-contiguous netmask");
+            return OS_ERROR;
+        }
+        depth += __builtin_popcount(m);
+
+        w = subnet->sub[i] & subnet->mask[i];
+        memcpy(key->addr + 4 * i, &w, 4);
+    }
+
+    key->family = subnet->family;
+    key->depth = depth;
+
+    return OS_OK;
+}
+
+/* key of the depth-bit prefix of an existing key */
+PRIVATE void key_truncate(lpm_key_t *dst, const lpm_key_t *src, int depth)
+{
+    int i;
+
+    memset(dst, 0, sizeof *dst);
+    dst->family = src->family;
+    dst->depth = depth;
+
+    for (i = 0; i < depth / 8; i++)
+        dst->addr[i] = src->addr[i];
+    if (depth % 8)
+        dst->addr[i] = src->addr[i] & (0xFF << (8 - depth % 8));
+}
+
+PRIVATE uint32_t rule_find(os_lpm_t *lpm, const lpm_key_t *key)
+{
+    uint32_t *r = os_flat_hash_get(lpm->index, key);
+    return r ? *r : 0;
+}
+
+PRIVATE uint32_t rule_alloc(os_lpm_t *lpm, const lpm_key_t *key, void *data)
+{
+    lpm_rule_t *rules = NULL;
+    uint32_t r, max;
+
+    if (lpm->rules_free) {
+        r = lpm->rules_free;
+        lpm->rules_free = lpm->rules[r].next_free;
+    } else {
+        if (lpm->rules_top == lpm->rules_max) {
+            max = lpm->rules_max * 2;
+            if (max > LPM_RULE_MAX + 1)
+                max = LPM_RULE_MAX + 1;
+            if (max == lpm->rules_max) {
+                os_log(ERROR, "Too many prefixes [%u]", LPM_RULE_MAX);
+                return 0;
+            }
+            rules = os_realloc(lpm->rules, max * sizeof(*rules));
+            if (!rules) {
+                os_log(ERROR, "os_realloc() failed");
+                return 0;
+            }
+            lpm->rules = rules;
+            lpm->rules_max = max;
+        }
+        r = lpm->rules_top++;
+    }
+
+    lpm->rules[r].key = *key;
+    lpm->rules[r].data = data;
+    os_flat_hash_set(lpm->index, key, &r);
+
+    return r;
+}
+
+PRIVATE void rule_free(os_lpm_t *lpm, uint32_t r)
+{
+    os_flat_hash_remove(lpm->index, &lpm->rules[r].key);
+    lpm->rules[r].data = NULL;
+    lpm->rules[r].next_free = lpm->rules_free;
+    lpm->rules_free = r;
+}
+
+/* longest rule shorter than key and longer than min_depth that covers it */
+PRIVATE uint32_t rule_cover(os_lpm_t *lpm,
+        const lpm_key_t *key, int min_depth, uint8_t *depth)
+{
+    lpm_key_t k;
+    uint32_t r;
+    int d;
+
+    for (d = key->depth - 1; d > min_depth; d--) {
+        key_truncate(&k, key, d);
+        if ((r = rule_find(lpm, &k)) != 0) {
+            *depth = d;
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+/////////////////////////////////////////////////////////
+PRIVATE uint32_t tbl8_alloc(os_lpm_t *lpm)
+{
+    uint32_t *tbl8 = NULL;
+    uint32_t g, max;
+
+    if (lpm->tbl8_free != LPM_NONE) {
+        g = lpm->tbl8_free;
+        lpm->tbl8_free = lpm->tbl8[(size_t)g * LPM_TBL8_SIZE];
+        return g;
+    }
+
+    if (lpm->tbl8_top == lpm->tbl8_max) {
+        max = lpm->tbl8_max ? lpm->tbl8_max * 2 : 256;
+        if (max > LPM_TBL8_MAX) {
+            os_log(ERROR, "Too many tbl8 groups [%u]", LPM_TBL8_MAX);
+            return LPM_NONE;
+        }
+        tbl8 = os_realloc(lpm->tbl8,
+                (size_t)max * LPM_TBL8_SIZE * sizeof(*tbl8));
+        if (!tbl8) {
+            os_log(ERROR, "os_realloc() failed");
+            return LPM_NONE;
+        }
+        lpm->tbl8 = tbl8;
+        lpm->tbl8_max = max;
+    }
+
+    return lpm->tbl8_top++;
+}
+
+PRIVATE void tbl8_free(os_lpm_t *lpm, uint32_t g)
+{
+    /* a free group keeps the free list link in its first entry */
+    lpm->tbl8[(size_t)g * LPM_TBL8_SIZE] = lpm->tbl8_free;
+    lpm->tbl8_free = g;
+}
+
+/* fold a group back into tbl24[i] once all its entries are equal */
+PRIVATE void tbl8_shrink(os_lpm_t *lpm, uint32_t i)
+{
+    uint32_t g = lpm4_index(lpm->tbl24[i]);
+    uint32_t *group = lpm->tbl8 + (size_t)g * LPM_TBL8_SIZE;
+    int k;
+
+    for (k = 1; k < LPM_TBL8_SIZE; k++)
+        if (group[k] != group[0])
+            return;
+
+    lpm->tbl24[i] = group[0];
+    tbl8_free(lpm, g);
+}
+
+PRIVATE void lpm4_fill(uint32_t *tbl,
+        uint32_t start, uint32_t n, uint32_t e, int depth)
+{
+    uint32_t i;
+
+    for (i = start; i < start + n; i++)
+        if (!tbl[i] || lpm4_depth(tbl[i]) <= depth)
+            tbl[i] = e;
+}
+
+PRIVATE void lpm4_replace(uint32_t *tbl,
+        uint32_t start, uint32_t n, uint32_t old, uint32_t e)
+{
+    uint32_t i;
+
+    for (i = start; i < start + n; i++)
+        if (tbl[i] == old)
+            tbl[i] = e;
+}
+
+PRIVATE int lpm4_add(os_lpm_t *lpm, uint32_t ip, int depth, uint32_t r)
+{
+    uint32_t e = lpm4_entry(r, depth), t, i, g;
+    int k;
+
+    if (!lpm->tbl24) {
+        lpm->tbl24 = os_calloc(LPM_TBL24_SIZE, sizeof(*lpm->tbl24));
+        if (!lpm->tbl24) {
+            os_log(ERROR, "os_calloc() failed");
+            return OS_ERROR;
+        }
+    }
+
+    if (depth <= 24) {
+        for (i = ip >> 8; i < (ip >> 8) + (1u << (24 - depth)); i++) {
+            t = lpm->tbl24[i];
+            if (t & LPM_EXT)
+                lpm4_fill(lpm->tbl8 + (size_t)lpm4_index(t) * LPM_TBL8_SIZE,
+                        0, LPM_TBL8_SIZE, e, depth);
+            else if (!t || lpm4_depth(t) <= depth)
+                lpm->tbl24[i] = e;
+        }
+        return OS_OK;
+    }
+
+    i = ip >> 8;
+    t = lpm->tbl24[i];
+    if (!(t & LPM_EXT)) {
+        g = tbl8_alloc(lpm);
+        if (g == LPM_NONE)
+            return OS_ERROR;
+        for (k = 0; k < LPM_TBL8_SIZE; k++)
+            lpm->tbl8[(size_t)g * LPM_TBL8_SIZE + k] = t;
+        lpm->tbl24[i] = t = LPM_EXT | g;
+    }
+
+    lpm4_fill(lpm->tbl8 + (size_t)lpm4_index(t) * LPM_TBL8_SIZE,
+            ip & 0xFF, 1u << (32 - depth), e, depth);
+
+    return OS_OK;
+}
+
+/* entries of the deleted rule fall back to the best shorter prefix */
+PRIVATE void lpm4_delete(os_lpm_t *lpm, uint32_t ip, int depth,
+        uint32_t r, uint32_t rep)
+{
+    uint32_t old = lpm4_entry(r, depth), t, i;
+
+    if (depth <= 24) {
+        for (i = ip >> 8; i < (ip >> 8) + (1u << (24 - depth)); i++) {
+            t = lpm->tbl24[i];
+            if (t & LPM_EXT) {
+                lpm4_replace(lpm->tbl8 + (size_t)lpm4_index(t) * LPM_TBL8_SIZE,
+                        0, LPM_TBL8_SIZE, old, rep);
+                tbl8_shrink(lpm, i);
+            } else if (t == old) {
+                lpm->tbl24[i] = rep;
+            }
+        }
+        return;
+    }
+
+    i = ip >> 8;
+    t = lpm->tbl24[i];
+    os_assert(t & LPM_EXT);
+
+    lpm4_replace(lpm->tbl8 + (size_t)lpm4_index(t) * LPM_TBL8_SIZE,
+            ip & 0xFF, 1u << (32 - depth), old, rep);
+    tbl8_shrink(lpm, i);
+}
+
+/////////////////////////////////////////////////////////
+PRIVATE lpm6_node_t *lpm6_node_new(void)
+{
+    lpm6_node_t *node = os_calloc(1, sizeof *node);
+    if (!node)
+        os_log(ERROR, "os_calloc() failed");
+    return node;
+}
+
+PRIVATE void lpm6_node_free(lpm6_node_t *node)
+{
+    int k;
+
+    for (k = 0; k < 256; k++)
+        if (node->e[k].child)
+            lpm6_node_free(node->e[k].child);
+    os_free(node);
+}
+
+PRIVATE bool lpm6_node_empty(const lpm6_node_t *node)
+{
+    int k;
+
+    for (k = 0; k < 256; k++)
+        if (node->e[k].rule || node->e[k].child)
+            return false;
+    return true;
+}
+
+PRIVATE int lpm6_add(os_lpm_t *lpm, const uint8_t *addr, int depth, uint32_t r)
+{
+    lpm6_node_t *node = NULL;
+    lpm6_entry_t *ent = NULL;
+    int level, bits, k, start;
+
+    if (depth == 0) {
+        lpm->default6 = r;
+        return OS_OK;
+    }
+
+    if (!lpm->root6 && !(lpm->root6 = lpm6_node_new()))
+        return OS_ERROR;
+
+    node = lpm->root6;
+    for (level = 0; level < (depth - 1) / 8; level++) {
+        ent = &node->e[addr[level]];
+        if (!ent->child && !(ent->child = lpm6_node_new()))
+            return OS_ERROR;
+        node = ent->child;
+    }
+
+    /* expand the last 1..8 bits over the entries they cover */
+    bits = depth - 8 * level;
+    start = addr[level] & (0xFF << (8 - bits)) & 0xFF;
+    for (k = start; k < start + (1 << (8 - bits)); k++) {
+        ent = &node->e[k];
+        if (!ent->rule || ent->depth <= depth) {
+            ent->rule = r;
+            ent->depth = depth;
+        }
+    }
+
+    return OS_OK;
+}
+
+PRIVATE void lpm6_delete(os_lpm_t *lpm, const uint8_t *addr, int depth,
+        uint32_t r, uint32_t rep, uint8_t rep_depth)
+{
+    lpm6_node_t *path[16];
+    lpm6_entry_t *ent = NULL;
+    int level, last, bits, k, start;
+
+    if (depth == 0) {
+        lpm->default6 = 0;
+        return;
+    }
+
+    last = (depth - 1) / 8;
+    path[0] = lpm->root6;
+    for (level = 0; level < last; level++) {
+        os_assert(path[level]);
+        path[level + 1] = path[level]->e[addr[level]].child;
+    }
+    os_assert(path[last]);
+
+    bits = depth - 8 * last;
+    start = addr[last] & (0xFF << (8 - bits)) & 0xFF;
+    for (k = start; k < start + (1 << (8 - bits)); k++) {
+        ent = &path[last]->e[k];
+        if (ent->rule == r && ent->depth == depth) {
+            ent->rule = rep;
+            ent->depth = rep ? rep_depth : 0;
+        }
+    }
+
+    /* prune nodes left without prefixes or children */
+    for (level = last; level >= 0 && lpm6_node_empty(path[level]); level--) {
+        os_free(path[level]);
+        if (level)
+            path[level - 1]->e[addr[level - 1]].child = NULL;
+        else
+            lpm->root6 = NULL;
+    }
+}
+
+/////////////////////////////////////////////////////////
+os_lpm_t *os_lpm_create(void)
+{
+    os_lpm_t *lpm = os_calloc(1, sizeof *lpm);
+    if (!lpm) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    lpm->tbl8_free = LPM_NONE;
+
+    lpm->rules_max = 64;
+    lpm->rules_top = 1;
+    lpm->rules = os_calloc(lpm->rules_max, sizeof(*lpm->rules));
+    lpm->index = os_flat_hash_make(sizeof(lpm_key_t), sizeof(uint32_t));
+    if (!lpm->rules || !lpm->index) {
+        os_log(ERROR, "os_lpm_create() failed");
+        os_lpm_destroy(lpm);
+        return NULL;
+    }
+
+    return lpm;
+}
+
+void os_lpm_destroy(os_lpm_t *lpm)
+{
+    os_assert(lpm);
+
+    if (lpm->root6)
+        lpm6_node_free(lpm->root6);
+    if (lpm->tbl24)
+        os_free(lpm->tbl24);
+    if (lpm->tbl8)
+        os_free(lpm->tbl8);
+    if (lpm->rules)
+        os_free(lpm->rules);
+    if (lpm->index)
+        os_flat_hash_destroy(lpm->index);
+    os_free(lpm);
+}
+
+int os_lpm_add(os_lpm_t *lpm, const os_ipsubnet_t *subnet, void *data)
+{
+    lpm_key_t key;
+    uint32_t r, ip;
+    int rv;
+
+    os_assert(lpm);
+    os_assert(subnet);
+    os_assert(data);
+
+    if (subnet_key(subnet, &key) != OS_OK)
+        return OS_ERROR;
+
+    if ((r = rule_find(lpm, &key)) != 0) {
+        lpm->rules[r].data = data;
+        return OS_OK;
+    }
+
+    if ((r = rule_alloc(lpm, &key, data)) == 0)
+        return OS_ERROR;
+
+    if (key.family == AF_INET) {
+        memcpy(&ip, key.addr, 4);
+        rv = lpm4_add(lpm, be32toh(ip), key.depth, r);
+    } else {
+        rv = lpm6_add(lpm, key.addr, key.depth, r);
+    }
+
+    /* both fail before touching any entry */
+    if (rv != OS_OK) {
+        rule_free(lpm, r);
+        return OS_ERROR;
+    }
+
+    lpm->count++;
+
+    return OS_OK;
+}
+
+int os_lpm_delete(os_lpm_t *lpm, const os_ipsubnet_t *subnet)
+{
+    lpm_key_t key;
+    uint32_t r, rep, ip;
+    uint8_t rep_depth = 0;
+
+    os_assert(lpm);
+    os_assert(subnet);
+
+    if (subnet_key(subnet, &key) != OS_OK)
+        return OS_ERROR;
+
+    if ((r = rule_find(lpm, &key)) == 0)
+        return OS_ERROR;
+
+    if (key.family == AF_INET) {
+        rep = rule_cover(lpm, &key, -1, &rep_depth);
+        memcpy(&ip, key.addr, 4);
+        lpm4_delete(lpm, be32toh(ip), key.depth, r,
+                rep ? lpm4_entry(rep, rep_depth) : 0);
+    } else {
+        /* shorter prefixes of earlier levels are found on the way down */
+        rep = key.depth ?
+            rule_cover(lpm, &key, (key.depth - 1) / 8 * 8, &rep_depth) : 0;
+        lpm6_delete(lpm, key.addr, key.depth, r, rep, rep_depth);
+    }
+
+    rule_free(lpm, r);
+    lpm->count--;
+
+    return OS_OK;
+}
+
+void *os_lpm_find(os_lpm_t *lpm, const os_ipsubnet_t *subnet)
+{
+    lpm_key_t key;
+    uint32_t r;
+
+    os_assert(lpm);
+    os_assert(subnet);
+
+    if (subnet_key(subnet, &key) != OS_OK)
+        return NULL;
+
+    r = rule_find(lpm, &key);
+    return r ? lpm->rules[r].data : NULL;
+}
+
+unsigned int os_lpm_count(os_lpm_t *lpm)
+{
+    os_assert(lpm);
+    return lpm->count;
+}
+
+void *os_lpm_lookup_v4(os_lpm_t *lpm, uint32_t addr)
+{
+    uint32_t ip, e;
+
+    os_assert(lpm);
+
+    if (!lpm->tbl24)
+        return NULL;
+
+    ip = be32toh(addr);
+    e = lpm->tbl24[ip >> 8];
+    if (e & LPM_EXT)
+        e = lpm->tbl8[(size_t)lpm4_index(e) * LPM_TBL8_SIZE + (ip & 0xFF)];
+
+    return e ? lpm->rules[lpm4_index(e)].data : NULL;
+}
+
+void *os_lpm_lookup_v6(os_lpm_t *lpm, const struct in6_addr *addr)
+{
+    const uint8_t *a = (const uint8_t *)addr;
+    lpm6_node_t *node = NULL;
+    uint32_t best;
+    int level;
+
+    os_assert(lpm);
+    os_assert(addr);
+
+    best = lpm->default6;
+    node = lpm->root6;
+    for (level = 0; node && level < 16; level++) {
+        if (node->e[a[level]].rule)
+            best = node->e[a[level]].rule;
+        node = node->e[a[level]].child;
+    }
+
+    return best ? lpm->rules[best].data : NULL;
+}
+
+void *os_lpm_lookup(os_lpm_t *lpm, const os_sockaddr_t *addr)
+{
+    os_assert(addr);
+
+    switch (addr->os_sa_family) {
+    case AF_INET:
+        return os_lpm_lookup_v4(lpm, addr->sin.sin_addr.s_addr);
+    case AF_INET6:
+        return os_lpm_lookup_v6(lpm, &addr->sin6.sin6_addr);
+    default:
+        return NULL;
+    }
+}
+
+void os_lpm_lookup_v4_burst(os_lpm_t *lpm,
+        const uint32_t addrs[], unsigned int n, void *datas[])
+{
+    uint32_t ip[LPM_BURST], e[LPM_BURST];
+    unsigned int i, j, m;
+
+    os_assert(lpm);
+    os_assert(addrs);
+    os_assert(datas);
+
+    if (!lpm->tbl24) {
+        memset(datas, 0, n * sizeof(*datas));
+        return;
+    }
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < LPM_BURST ? n - i : LPM_BURST;
+
+        for (j = 0; j < m; j++) {
+            ip[j] = be32toh(addrs[i + j]);
+            os_prefetch(&lpm->tbl24[ip[j] >> 8]);
+        }
+
+        for (j = 0; j < m; j++) {
+            e[j] = lpm->tbl24[ip[j] >> 8];
+            if (e[j] & LPM_EXT)
+                os_prefetch(&lpm->tbl8[
+                        (size_t)lpm4_index(e[j]) * LPM_TBL8_SIZE + (ip[j] & 0xFF)]);
+            else if (e[j])
+                os_prefetch(&lpm->rules[lpm4_index(e[j])]);
+        }
+
+        for (j = 0; j < m; j++) {
+            if (e[j] & LPM_EXT)
+                e[j] = lpm->tbl8[
+                    (size_t)lpm4_index(e[j]) * LPM_TBL8_SIZE + (ip[j] & 0xFF)];
+            datas[i + j] = e[j] ? lpm->rules[lpm4_index(e[j])].data : NULL;
+        }
+    }
+}
+
+void os_lpm_lookup_burst(os_lpm_t *lpm,
+        const os_sockaddr_t * const addrs[], unsigned int n, void *datas[])
+{
+    unsigned int i;
+
+    os_assert(lpm);
+    os_assert(addrs);
+    os_assert(datas);
+
+    if (lpm->tbl24) {
+        for (i = 0; i < n; i++)
+            if (addrs[i]->os_sa_family == AF_INET)
+                os_prefetch(&lpm->tbl24[
+                        be32toh(addrs[i]->sin.sin_addr.s_addr) >> 8]);
+    }
+
+    for (i = 0; i < n; i++)
+        datas[i] = os_lpm_lookup(lpm, addrs[i]);
+}
@@ -98,44 +98,30 @@ int os_talloc_free(void *ptr, const char *location)
 
 #else
 /*****************************************
- * Use buf library
+ * Use slab allocator
  *****************************************/
 
 void *os_malloc_debug(size_t size, const char *file_line)
 {
-    size_t headroom = 0;
-    os_buf_t *buf = NULL;
+    void *ptr = NULL;
 
     os_assert(size);
 
-    headroom = sizeof(os_buf_t *);
-    buf = os_buf_alloc_debug(NULL, headroom + size, file_line);
-    if (!buf) {
-        os_log(ERROR, "os_buf_alloc_debug[headroom:%d, size:%d] failed",
-                (int)headroom, (int)size);
+    ptr = os_slab_alloc(size, file_line);
+    if (!ptr) {
+        os_log(ERROR, "os_slab_alloc[size:%d] failed", (int)size);
         return NULL;
     }
 
-    os_buf_reserve(buf, headroom);
-    memcpy(buf->head, &buf, headroom);
-    os_buf_put(buf, size);
-
-    return buf->data;
+    return ptr;
 }
 
 int os_free_debug(void *ptr)
 {
-    size_t headroom;
-    os_buf_t *buf = NULL;
-
     if (!ptr)
         return OS_ERROR;
 
-    headroom = sizeof(os_buf_t *);
-    memcpy(&buf, (unsigned char*)ptr - headroom, headroom);
-    os_assert(buf);
-
-    os_buf_free(buf);
+    os_slab_free(ptr);
 
     return OS_OK;
 }
@@ -151,58 +137,39 @@ void *os_calloc_debug(size_t nmemb, size_t size, const char *file_line)
         return NULL;
     }
 
-    memset(ptr, 0, nmemb * size);
+    /* large blocks are fresh anonymous mappings, already zero-filled */
+    if (nmemb * size <= OS_SLAB_MAX_SIZE)
+        memset(ptr, 0, nmemb * size);
     return ptr;
 }
 
 void *os_realloc_debug(void *ptr, size_t size, const char *file_line)
 {
-    size_t headroom = 0;
-    os_buf_t *buf = NULL;
-    os_cluster_t *cluster = NULL;
+    void *new = NULL;
+    size_t old_size;
 
     if (!ptr)
         return os_malloc(size);
 
-    headroom = sizeof(os_buf_t *);
-
-    memcpy(&buf, (unsigned char*)ptr - headroom, headroom);
-
-    if (!buf) {
-        os_log(ERROR, "Cannot get pkbuf from ptr[%p], headroom[%d]", ptr, (int)headroom);
-
+    if (!size) {
+        os_slab_free(ptr);
         return NULL;
     }
 
-    cluster = buf->cluster;
-    if (!cluster) {
-        os_log(ERROR, "No cluster");
-        return NULL;
-    }
+    if (os_slab_resize(ptr, size))
+        return ptr;
 
-    if (!size) {
-        os_buf_free(buf);
+    new = os_malloc_debug(size, file_line);
+    if (!new) {
+        os_log(ERROR, "os_malloc_debug[%d] failed", (int)size);
         return NULL;
     }
 
-    if (size > (cluster->size - headroom)) {
-        void *new = NULL;
+    old_size = os_slab_size(ptr);
+    memcpy(new, ptr, os_min(old_size, size));
 
-        new = os_malloc_debug(size, file_line);
-        if (!new) {
-            os_log(ERROR, "os_malloc_debug[%d] failed", (int)size);
-            return NULL;
-        }
-
-        memcpy(new, ptr, buf->len);
-
-        os_buf_free(buf);
-        return new;
-    } else {
-        buf->tail = buf->data + size;
-        buf->len = size;
-        return ptr;
-    }
+    os_slab_free(ptr);
+    return new;
 }
 
 #endif
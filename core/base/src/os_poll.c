@@ -34,7 +34,7 @@ os_pollset_t *os_pollset_create(unsigned int capacity)
 
     pollset->capacity = capacity;
 
-    os_pool_init(&pollset->pool, capacity);
+    os_cpool_init(&pollset->pool, capacity);
 
     if (os_pollset_actions_initialized == false) {
 #if defined(HAVE_KQUEUE)
@@ -58,7 +58,7 @@ void os_pollset_destroy(os_pollset_t *pollset)
 
     os_pollset_actions.cleanup(pollset);
 
-    os_pool_final(&pollset->pool);
+    os_cpool_final(&pollset->pool);
     os_free(pollset);
 }
 
@@ -73,8 +73,12 @@ os_poll_t *os_pollset_add(os_pollset_t *pollset, short when,
     os_assert(fd != INVALID_SOCKET);
     os_assert(handler);
 
-    os_pool_alloc(&pollset->pool, &poll);
-    os_assert(poll);
+    os_cpool_alloc(&pollset->pool, &poll);
+    if (!poll) {
+        os_log(ERROR, "os_cpool_alloc() failed [capacity=%u]",
+                pollset->capacity);
+        return NULL;
+    }
 
     rc = os_nonblocking(fd);
     os_assert(rc == OS_OK);
@@ -95,7 +99,7 @@ os_poll_t *os_pollset_add(os_pollset_t *pollset, short when,
     rc = os_pollset_actions.add(poll);
     if (rc != OS_OK) {
         os_log(ERROR, "cannot add poll");
-        os_pool_free(&pollset->pool, poll);
+        os_cpool_free(&pollset->pool, poll);
         return NULL;
     }
 
@@ -116,5 +120,5 @@ void os_pollset_remove(os_poll_t *poll)
         os_log(ERROR, "cannot delete poll");
     }
 
-    os_pool_free(&pollset->pool, poll);
+    os_cpool_free(&pollset->pool, poll);
 }
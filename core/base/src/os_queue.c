@@ -34,8 +34,9 @@ typedef struct os_queue_s {
     unsigned int        full_waiters;
     unsigned int        empty_waiters;
     os_thread_mutex_t  one_big_mutex;
-    os_thread_cond_t   not_empty;
-    os_thread_cond_t   not_full;
+    os_thread_waitq_t  not_empty;
+    os_thread_waitq_t  not_full;
+    unsigned int        interrupts; /**< bumped by interrupt_all */
     int                 terminated;
 } os_queue_t;
 
@@ -62,8 +63,8 @@ os_queue_t *os_queue_create(unsigned int capacity)
     os_assert(queue);
 
     os_thread_mutex_init(&queue->one_big_mutex);
-    os_thread_cond_init(&queue->not_empty);
-    os_thread_cond_init(&queue->not_full);
+    os_thread_waitq_init(&queue->not_empty);
+    os_thread_waitq_init(&queue->not_full);
 
     queue->data = calloc(1, capacity * sizeof(void*));
     os_expect_or_return_val(queue->data, NULL);
@@ -84,13 +85,50 @@ void os_queue_destroy(os_queue_t *queue)
 
     free(queue->data);
 
-    os_thread_cond_destroy(&queue->not_empty);
-    os_thread_cond_destroy(&queue->not_full);
+    os_thread_waitq_destroy(&queue->not_empty);
+    os_thread_waitq_destroy(&queue->not_full);
     os_thread_mutex_destroy(&queue->one_big_mutex);
 
     free(queue);
 }
 
+/**
+ * Wait, with one_big_mutex held, until the queue has room (for_space) or
+ * data. Spurious wakeups are absorbed here, so the wait only ends early on
+ * term, interrupt or timeout. Timeouts are relative and monotonic.
+ */
+static int queue_wait(os_queue_t *queue, int for_space, os_time_t timeout)
+{
+    os_thread_waitq_t *wq = for_space ? &queue->not_full : &queue->not_empty;
+    unsigned int *waiters =
+        for_space ? &queue->full_waiters : &queue->empty_waiters;
+    unsigned int interrupts = queue->interrupts;
+    os_time_t deadline = 0, remain = timeout;
+    int rv = OS_OK;
+
+    if (timeout > 0)
+        deadline = os_get_monotonic_time() + timeout;
+
+    (*waiters)++;
+    while ((for_space ? os_queue_full(queue) : os_queue_empty(queue)) &&
+            !queue->terminated && interrupts == queue->interrupts) {
+        rv = os_thread_waitq_wait(wq, &queue->one_big_mutex,
+                timeout > 0 ? remain : OS_INFINITE_TIME);
+        if (rv != OS_OK)
+            break;
+        if (timeout > 0) {
+            remain = deadline - os_get_monotonic_time();
+            if (remain <= 0) {
+                rv = OS_TIMEUP;
+                break;
+            }
+        }
+    }
+    (*waiters)--;
+
+    return rv;
+}
+
 static int queue_push(os_queue_t *queue, void *data, os_time_t timeout)
 {
     int rv;
@@ -106,25 +144,13 @@ static int queue_push(os_queue_t *queue, void *data, os_time_t timeout)
             os_thread_mutex_unlock(&queue->one_big_mutex);
             return OS_RETRY;
         }
-        if (!queue->terminated) {
-            queue->full_waiters++;
-            if (timeout > 0) {
-                rv = os_thread_cond_timedwait(&queue->not_full,
-                                               &queue->one_big_mutex,
-                                               timeout);
-            }
-            else {
-                rv = os_thread_cond_wait(&queue->not_full,
-                                          &queue->one_big_mutex);
-            }
-            queue->full_waiters--;
+        rv = queue_wait(queue, 1, timeout);
+        /* If we wake up and it's still full, then we were interrupted */
+        if (os_queue_full(queue)) {
             if (rv != OS_OK) {
                 os_thread_mutex_unlock(&queue->one_big_mutex);
                 return rv;
             }
-        }
-        /* If we wake up and it's still empty, then we were interrupted */
-        if (os_queue_full(queue)) {
             os_log(WARN, "queue full (intr)");
             os_thread_mutex_unlock(&queue->one_big_mutex);
             if (queue->terminated) {
@@ -144,7 +170,7 @@ static int queue_push(os_queue_t *queue, void *data, os_time_t timeout)
 
     if (queue->empty_waiters) {
         os_log(TRACE, "signal !empty");
-        os_thread_cond_signal(&queue->not_empty);
+        os_thread_waitq_signal(&queue->not_empty);
     }
 
     os_thread_mutex_unlock(&queue->one_big_mutex);
@@ -201,25 +227,13 @@ static int queue_pop(os_queue_t *queue, void **data, os_time_t timeout)
             os_thread_mutex_unlock(&queue->one_big_mutex);
             return OS_RETRY;
         }
-        if (!queue->terminated) {
-            queue->empty_waiters++;
-            if (timeout > 0) {
-                rv = os_thread_cond_timedwait(&queue->not_empty,
-                                               &queue->one_big_mutex,
-                                               timeout);
-            }
-            else {
-                rv = os_thread_cond_wait(&queue->not_empty,
-                                          &queue->one_big_mutex);
-            }
-            queue->empty_waiters--;
+        rv = queue_wait(queue, 0, timeout);
+        /* If we wake up and it's still empty, then we were interrupted */
+        if (os_queue_empty(queue)) {
             if (rv != OS_OK) {
                 os_thread_mutex_unlock(&queue->one_big_mutex);
                 return rv;
             }
-        }
-        /* If we wake up and it's still empty, then we were interrupted */
-        if (os_queue_empty(queue)) {
             //os_log(WARN, "queue empty (intr)");
             os_thread_mutex_unlock(&queue->one_big_mutex);
             if (queue->terminated) {
@@ -238,7 +252,7 @@ static int queue_pop(os_queue_t *queue, void **data, os_time_t timeout)
         queue->out -= queue->bounds;
     if (queue->full_waiters) {
         os_log(TRACE, "signal !full");
-        os_thread_cond_signal(&queue->not_full);
+        os_thread_waitq_signal(&queue->not_full);
     }
 
     os_thread_mutex_unlock(&queue->one_big_mutex);
@@ -265,8 +279,9 @@ int os_queue_interrupt_all(os_queue_t *queue)
     os_log(DEBUG, "interrupt all");
     os_thread_mutex_lock(&queue->one_big_mutex);
 
-    os_thread_cond_broadcast(&queue->not_empty);
-    os_thread_cond_broadcast(&queue->not_full);
+    queue->interrupts++;
+    os_thread_waitq_broadcast(&queue->not_empty);
+    os_thread_waitq_broadcast(&queue->not_full);
 
     os_thread_mutex_unlock(&queue->one_big_mutex);
 
@@ -0,0 +1,490 @@
+/************************************************************************
+ *File name: os_rcu.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+/*
+ * ctr is the grace-period counter the reader saw at its last quiescent
+ * state, 0 while it is offline or the slot is unused.
+ */
+typedef struct rcu_reader_s {
+    uint64_t ctr;
+    bool used;
+} OS_CACHELINE_ALIGNED rcu_reader_t;
+
+typedef struct rcu_retired_s {
+    struct rcu_retired_s *next;
+    uint64_t epoch;
+    os_rcu_free_f fn;
+    void *ptr;
+} rcu_retired_t;
+
+PRIVATE rcu_reader_t rcu_readers[OS_RCU_MAX_THREADS];
+PRIVATE uint64_t rcu_gp OS_CACHELINE_ALIGNED = 1;
+PRIVATE __thread rcu_reader_t *rcu_self = NULL;
+/* os_thread_ctx_t slot releasing the reader of a thread that exits */
+PRIVATE int rcu_slot = OS_ERROR;
+PRIVATE pthread_once_t rcu_slot_once = PTHREAD_ONCE_INIT;
+
+PRIVATE os_thread_mutex_t rcu_mutex;
+PRIVATE rcu_retired_t *retired_head = NULL, *retired_tail = NULL;
+
+void os_rcu_init(void)
+{
+    os_thread_mutex_init(&rcu_mutex);
+}
+
+void os_rcu_final(void)
+{
+    os_rcu_barrier();
+    os_thread_mutex_destroy(&rcu_mutex);
+}
+
+PRIVATE void rcu_reader_release(void *arg)
+{
+    rcu_reader_t *reader = arg;
+
+    os_thread_mutex_lock(&rcu_mutex);
+    os_atomic_store(&reader->ctr, 0);
+    reader->used = false;
+    os_thread_mutex_unlock(&rcu_mutex);
+
+    if (rcu_self == reader)
+        rcu_self = NULL;
+}
+
+PRIVATE void rcu_slot_register(void)
+{
+    rcu_slot = os_thread_slot_register(rcu_reader_release);
+    os_assert(rcu_slot >= 0);
+}
+
+int os_rcu_thread_register(void)
+{
+    int i;
+
+    if (rcu_self)
+        return OS_OK;
+
+    os_thread_mutex_lock(&rcu_mutex);
+    for (i = 0; i < OS_RCU_MAX_THREADS; i++) {
+        if (!rcu_readers[i].used) {
+            rcu_readers[i].used = true;
+            rcu_self = &rcu_readers[i];
+            __atomic_store_n(&rcu_self->ctr,
+                    os_atomic_load(&rcu_gp), OS_MO_SEQ_CST);
+            break;
+        }
+    }
+    os_thread_mutex_unlock(&rcu_mutex);
+
+    if (!rcu_self) {
+        os_log(ERROR, "Too many RCU readers [%d]", OS_RCU_MAX_THREADS);
+        return OS_ERROR;
+    }
+
+    /* a thread that exits registered must not stall grace periods */
+    pthread_once(&rcu_slot_once, rcu_slot_register);
+    os_thread_slot_set(rcu_slot, rcu_self);
+
+    return OS_OK;
+}
+
+void os_rcu_thread_unregister(void)
+{
+    if (!rcu_self)
+        return;
+
+    os_thread_slot_set(rcu_slot, NULL);
+    rcu_reader_release(rcu_self);
+}
+
+bool os_rcu_thread_registered(void)
+{
+    return rcu_self != NULL;
+}
+
+void os_rcu_quiescent(void)
+{
+    if (rcu_self)
+        __atomic_store_n(&rcu_self->ctr,
+                os_atomic_load(&rcu_gp), OS_MO_SEQ_CST);
+}
+
+void os_rcu_thread_offline(void)
+{
+    if (rcu_self) {
+        os_atomic_thread_fence();
+        os_atomic_store(&rcu_self->ctr, 0);
+    }
+}
+
+void os_rcu_thread_online(void)
+{
+    if (rcu_self)
+        __atomic_store_n(&rcu_self->ctr,
+                os_atomic_load(&rcu_gp), OS_MO_SEQ_CST);
+}
+
+/* oldest grace-period counter still seen by an online reader */
+PRIVATE uint64_t rcu_min_epoch(void)
+{
+    uint64_t min = UINT64_MAX, ctr;
+    int i;
+
+    for (i = 0; i < OS_RCU_MAX_THREADS; i++) {
+        ctr = os_atomic_load(&rcu_readers[i].ctr);
+        if (ctr && ctr < min)
+            min = ctr;
+    }
+
+    return min;
+}
+
+void os_rcu_synchronize(void)
+{
+    uint64_t target, ctr;
+    unsigned int spins;
+    int i;
+
+    target = __atomic_add_fetch(&rcu_gp, 1, OS_MO_SEQ_CST);
+
+    /* the caller is trivially quiescent while it waits */
+    if (rcu_self && os_atomic_load(&rcu_self->ctr))
+        __atomic_store_n(&rcu_self->ctr, target, OS_MO_SEQ_CST);
+
+    for (i = 0; i < OS_RCU_MAX_THREADS; i++) {
+        spins = 0;
+        while ((ctr = os_atomic_load(&rcu_readers[i].ctr)) && ctr < target) {
+            if (++spins < 1000)
+                os_cpu_relax();
+            else
+                sched_yield();
+        }
+    }
+}
+
+/* detach the retired objects with epoch <= limit, oldest first */
+PRIVATE rcu_retired_t *rcu_detach(uint64_t limit)
+{
+    rcu_retired_t *head = NULL, *last = NULL;
+
+    os_thread_mutex_lock(&rcu_mutex);
+    while (retired_head && retired_head->epoch <= limit) {
+        if (!head)
+            head = retired_head;
+        last = retired_head;
+        retired_head = retired_head->next;
+    }
+    if (last)
+        last->next = NULL;
+    if (!retired_head)
+        retired_tail = NULL;
+    os_thread_mutex_unlock(&rcu_mutex);
+
+    return head;
+}
+
+PRIVATE void rcu_free_list(rcu_retired_t *r)
+{
+    rcu_retired_t *next = NULL;
+
+    while (r) {
+        next = r->next;
+        r->fn(r->ptr);
+        os_free(r);
+        r = next;
+    }
+}
+
+void os_rcu_retire(void *ptr, os_rcu_free_f fn)
+{
+    rcu_retired_t *r = NULL;
+
+    os_assert(ptr);
+    os_assert(fn);
+
+    r = os_malloc(sizeof *r);
+    os_assert(r);
+
+    r->next = NULL;
+    r->fn = fn;
+    r->ptr = ptr;
+
+    os_thread_mutex_lock(&rcu_mutex);
+    /* readers that report this epoch or later cannot see ptr anymore */
+    r->epoch = __atomic_add_fetch(&rcu_gp, 1, OS_MO_SEQ_CST);
+    if (retired_tail)
+        retired_tail->next = r;
+    else
+        retired_head = r;
+    retired_tail = r;
+    os_thread_mutex_unlock(&rcu_mutex);
+
+    os_rcu_reclaim();
+}
+
+void os_rcu_reclaim(void)
+{
+    if (!os_atomic_load_relaxed(&retired_head))
+        return;
+
+    rcu_free_list(rcu_detach(rcu_min_epoch()));
+}
+
+void os_rcu_barrier(void)
+{
+    uint64_t limit = os_atomic_load(&rcu_gp);
+
+    os_rcu_synchronize();
+    rcu_free_list(rcu_detach(limit));
+}
+
+/////////////////////////////////////////////////////////
+typedef struct rcu_hash_node_s {
+    struct rcu_hash_node_s *next;
+    unsigned int hash;
+    int klen;
+    const void *val;
+    unsigned char key[0];
+} rcu_hash_node_t;
+
+typedef struct rcu_hash_table_s {
+    unsigned int max;   /* 2^n - 1 */
+    rcu_hash_node_t *array[0];
+} rcu_hash_table_t;
+
+struct os_rcu_hash_s {
+    rcu_hash_table_t *table;
+    os_thread_mutex_t mutex;
+    unsigned int count;
+    uint64_t seed;
+};
+
+#define RCU_HASH_INITIAL_MAX 15
+#define RCU_HASH_BURST       32
+
+PRIVATE void rcu_os_free(void *ptr)
+{
+    os_free(ptr);
+}
+
+PRIVATE rcu_hash_table_t *rcu_hash_table_alloc(unsigned int max)
+{
+    rcu_hash_table_t *t = os_calloc(1,
+            sizeof(*t) + sizeof(t->array[0]) * (max + 1));
+    os_assert(t);
+    t->max = max;
+    return t;
+}
+
+PRIVATE void rcu_hash_table_free(void *ptr)
+{
+    rcu_hash_table_t *t = ptr;
+    rcu_hash_node_t *n = NULL, *next = NULL;
+    unsigned int i;
+
+    for (i = 0; i <= t->max; i++) {
+        for (n = t->array[i]; n; n = next) {
+            next = n->next;
+            os_free(n);
+        }
+    }
+    os_free(t);
+}
+
+PRIVATE rcu_hash_node_t *rcu_hash_node_new(const void *key, int klen,
+        unsigned int hash, const void *val, rcu_hash_node_t *next)
+{
+    rcu_hash_node_t *n = os_malloc(sizeof(*n) + klen);
+    os_assert(n);
+
+    n->next = next;
+    n->hash = hash;
+    n->klen = klen;
+    n->val = val;
+    memcpy(n->key, key, klen);
+    return n;
+}
+
+/* copy every node into a bigger table; readers keep the old one */
+PRIVATE void rcu_hash_expand(os_rcu_hash_t *ht)
+{
+    rcu_hash_table_t *old = ht->table, *t = NULL;
+    rcu_hash_node_t *n = NULL;
+    unsigned int i, b;
+
+    t = rcu_hash_table_alloc(old->max * 2 + 1);
+    for (i = 0; i <= old->max; i++) {
+        for (n = old->array[i]; n; n = n->next) {
+            b = n->hash & t->max;
+            t->array[b] = rcu_hash_node_new(
+                    n->key, n->klen, n->hash, n->val, t->array[b]);
+        }
+    }
+
+    os_atomic_store(&ht->table, t);
+    os_rcu_retire(old, rcu_hash_table_free);
+}
+
+os_rcu_hash_t *os_rcu_hash_make(void)
+{
+    os_rcu_hash_t *ht = os_calloc(1, sizeof *ht);
+    if (!ht) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    ht->table = rcu_hash_table_alloc(RCU_HASH_INITIAL_MAX);
+    os_random(&ht->seed, sizeof(ht->seed));
+    os_thread_mutex_init(&ht->mutex);
+
+    return ht;
+}
+
+void os_rcu_hash_destroy(os_rcu_hash_t *ht)
+{
+    os_assert(ht);
+
+    /* readers must be gone; retired tables are freed by RCU */
+    rcu_hash_table_free(ht->table);
+    os_thread_mutex_destroy(&ht->mutex);
+    os_free(ht);
+}
+
+void os_rcu_hash_set(os_rcu_hash_t *ht, const void *key, int klen, const void *val)
+{
+    rcu_hash_table_t *t = NULL;
+    rcu_hash_node_t **np = NULL, *n = NULL;
+    unsigned int hash;
+
+    os_assert(ht);
+    os_assert(key);
+    os_assert(klen);
+
+    if (klen == OS_HASH_KEY_STRING)
+        klen = strlen(key);
+    hash = (unsigned int)os_hash64(key, klen, ht->seed);
+
+    os_thread_mutex_lock(&ht->mutex);
+
+    t = ht->table;
+    for (np = &t->array[hash & t->max]; (n = *np) != NULL; np = &n->next) {
+        if (n->hash == hash && n->klen == klen &&
+                memcmp(n->key, key, klen) == 0)
+            break;
+    }
+
+    if (n) {
+        if (val) {
+            os_atomic_store(&n->val, val);
+        } else {
+            os_atomic_store(np, n->next);
+            ht->count--;
+            os_rcu_retire(n, rcu_os_free);
+        }
+    } else if (val) {
+        n = rcu_hash_node_new(key, klen, hash, val, t->array[hash & t->max]);
+        os_atomic_store(&t->array[hash & t->max], n);
+        if (++ht->count > t->max)
+            rcu_hash_expand(ht);
+    }
+
+    os_thread_mutex_unlock(&ht->mutex);
+}
+
+void *os_rcu_hash_get(os_rcu_hash_t *ht, const void *key, int klen)
+{
+    rcu_hash_table_t *t = NULL;
+    rcu_hash_node_t *n = NULL;
+    unsigned int hash;
+
+    os_assert(ht);
+    os_assert(key);
+    os_assert(klen);
+
+    if (klen == OS_HASH_KEY_STRING)
+        klen = strlen(key);
+    hash = (unsigned int)os_hash64(key, klen, ht->seed);
+
+    t = os_atomic_load(&ht->table);
+    for (n = os_atomic_load(&t->array[hash & t->max]); n;
+            n = os_atomic_load(&n->next)) {
+        if (n->hash == hash && n->klen == klen &&
+                memcmp(n->key, key, klen) == 0)
+            return (void *)os_atomic_load(&n->val);
+    }
+
+    return NULL;
+}
+
+void os_rcu_hash_get_burst(os_rcu_hash_t *ht,
+        const void * const keys[], int klen, unsigned int n, void *vals[])
+{
+    unsigned int hash[RCU_HASH_BURST], i, j, m;
+    rcu_hash_node_t *head[RCU_HASH_BURST], *node = NULL;
+    rcu_hash_table_t *t = NULL;
+
+    os_assert(ht);
+    os_assert(keys);
+    os_assert(klen > 0);
+    os_assert(vals);
+
+    t = os_atomic_load(&ht->table);
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < RCU_HASH_BURST ? n - i : RCU_HASH_BURST;
+
+        for (j = 0; j < m; j++) {
+            hash[j] = (unsigned int)os_hash64(keys[i + j], klen, ht->seed);
+            os_prefetch(&t->array[hash[j] & t->max]);
+        }
+
+        for (j = 0; j < m; j++) {
+            head[j] = os_atomic_load(&t->array[hash[j] & t->max]);
+            if (head[j])
+                os_prefetch(head[j]);
+        }
+
+        for (j = 0; j < m; j++) {
+            for (node = head[j]; node; node = os_atomic_load(&node->next)) {
+                if (node->hash == hash[j] && node->klen == klen &&
+                        memcmp(node->key, keys[i + j], klen) == 0)
+                    break;
+            }
+            vals[i + j] = node ? (void *)os_atomic_load(&node->val) : NULL;
+        }
+    }
+}
+
+unsigned int os_rcu_hash_count(os_rcu_hash_t *ht)
+{
+    os_assert(ht);
+    return os_atomic_load_relaxed(&ht->count);
+}
+
+int os_rcu_hash_do(os_hash_do_callback_fn_t *comp, void *rec, os_rcu_hash_t *ht)
+{
+    rcu_hash_table_t *t = NULL;
+    rcu_hash_node_t *n = NULL;
+    unsigned int i;
+
+    os_assert(comp);
+    os_assert(ht);
+
+    t = os_atomic_load(&ht->table);
+    for (i = 0; i <= t->max; i++) {
+        for (n = os_atomic_load(&t->array[i]); n;
+                n = os_atomic_load(&n->next)) {
+            if (!(*comp)(rec, n->key, n->klen, os_atomic_load(&n->val)))
+                return 0;
+        }
+    }
+
+    return 1;
+}
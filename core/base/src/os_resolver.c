@@ -0,0 +1,496 @@
+/************************************************************************
+ *File name: os_resolver.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#include "system_config.h"
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include "os_init.h"
+
+#define RESOLVER_DEFAULT_THREADS    2
+#define RESOLVER_MAX_THREADS        16
+#define RESOLVER_DEFAULT_QUEUE      256
+
+typedef struct resolve_req_s {
+    os_lnode_t lnode;           /* resolver->pending */
+
+    int family;
+    int flags;
+    uint16_t port;
+    char *hostname;
+
+    os_resolve_cb_f cb;
+    void *data;
+    bool cancelled;
+
+    /* filled in by the worker */
+    int rv;
+    os_sockaddr_t *sa_list;
+} resolve_req_t;
+
+typedef struct resolve_cache_s {
+    char *key;
+    os_sockaddr_t *sa_list;
+    os_time_t expires;
+} resolve_cache_t;
+
+struct os_resolver_s {
+    os_pollset_t *pollset;
+    os_poll_t *poll;
+    os_socket_t fd[2];
+
+    os_queue_t *work;
+    os_queue_t *done;
+    os_thread_t **threads;
+    int nthreads;
+
+    os_list_t pending;          /* owned by the pollset thread */
+    unsigned int npending;
+    unsigned int queue;         /* most lookups in flight */
+
+    os_hash_t *cache;
+    os_time_t ttl;
+    char *hosts_file;
+};
+
+PRIVATE void req_free(resolve_req_t *req)
+{
+    if (req->sa_list)
+        os_freeaddrinfo(req->sa_list);
+    os_free(req->hostname);
+    os_free(req);
+}
+
+/////////////////////////////////////////////////////////
+PRIVATE int resolve_hosts(const char *path, resolve_req_t *req)
+{
+    FILE *fp = NULL;
+    char line[1024], *p = NULL, *ip = NULL, *name = NULL, *save = NULL;
+    os_sockaddr_t tmp, *new = NULL, *last = NULL;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        os_logsp(ERROR, ERRNOID, os_errno, "fopen(%s) failed", path);
+        return OS_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if ((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+
+        ip = strtok_r(line, " \t\r\n", &save);
+        if (!ip)
+            continue;
+        while ((name = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+            if (strcasecmp(name, req->hostname) == 0)
+                break;
+        if (!name)
+            continue;
+
+        memset(&tmp, 0, sizeof(tmp));
+        if (inet_pton(AF_INET, ip, &tmp.sin.sin_addr) == 1)
+            tmp.os_sa_family = AF_INET;
+        else if (inet_pton(AF_INET6, ip, &tmp.sin6.sin6_addr) == 1)
+            tmp.os_sa_family = AF_INET6;
+        else
+            continue;
+
+        if (req->family != AF_UNSPEC && req->family != tmp.os_sa_family)
+            continue;
+
+        new = os_memdup(&tmp, sizeof(tmp));
+        os_assert(new);
+        new->os_sin_port = htobe16(req->port);
+        new->hostname = os_strdup(req->hostname);
+        os_assert(new->hostname);
+
+        if (last)
+            last->next = new;
+        else
+            req->sa_list = new;
+        last = new;
+    }
+
+    fclose(fp);
+
+    if (!req->sa_list) {
+        os_log(ERROR, "%s not found in %s", req->hostname, path);
+        return OS_ERROR;
+    }
+
+    return OS_OK;
+}
+
+PRIVATE void resolver_wakeup(os_resolver_t *resolver)
+{
+    ssize_t r;
+#if defined(HAVE_EVENTFD)
+    uint64_t msg = 1;
+
+    r = write(resolver->fd[0], &msg, sizeof(msg));
+#else
+    char buf[1] = { 0 };
+
+    r = send(resolver->fd[1], buf, 1, 0);
+#endif
+    if (r < 0)
+        os_logsp(ERROR, ERRNOID, os_socket_errno, "resolver wakeup failed");
+}
+
+PRIVATE void resolver_worker(void *arg)
+{
+    os_resolver_t *resolver = arg;
+    resolve_req_t *req = NULL;
+    int rv;
+
+    for ( ;; ) {
+        rv = os_queue_pop(resolver->work, (void **)&req);
+        if (rv == OS_DONE)
+            break;
+        if (rv != OS_OK)
+            continue;
+
+        if (resolver->hosts_file)
+            req->rv = resolve_hosts(resolver->hosts_file, req);
+        else
+            req->rv = os_getaddrinfo(&req->sa_list,
+                    req->family, req->hostname, req->port, req->flags);
+
+        if (req->rv != OS_OK && req->sa_list) {
+            os_freeaddrinfo(req->sa_list);
+            req->sa_list = NULL;
+        }
+
+        if (os_queue_push(resolver->done, req) != OS_OK)
+            break;
+        resolver_wakeup(resolver);
+    }
+}
+
+/////////////////////////////////////////////////////////
+PRIVATE char *cache_key(int family, int flags, const char *hostname)
+{
+    return os_msprintf("%d:%x:%s", family, flags, hostname);
+}
+
+PRIVATE void cache_entry_free(os_resolver_t *resolver, resolve_cache_t *entry)
+{
+    os_hash_set(resolver->cache, entry->key, OS_HASH_KEY_STRING, NULL);
+    os_freeaddrinfo(entry->sa_list);
+    os_free(entry->key);
+    os_free(entry);
+}
+
+/* @return a fresh copy of the cached answer with port applied */
+PRIVATE os_sockaddr_t *cache_lookup(os_resolver_t *resolver,
+        int family, const char *hostname, uint16_t port, int flags)
+{
+    resolve_cache_t *entry = NULL;
+    os_sockaddr_t *sa_list = NULL, *addr = NULL;
+    char *key = NULL;
+
+    if (!resolver->ttl)
+        return NULL;
+
+    key = cache_key(family, flags, hostname);
+    os_assert(key);
+    entry = os_hash_get(resolver->cache, key, OS_HASH_KEY_STRING);
+    os_free(key);
+
+    if (!entry)
+        return NULL;
+    if (entry->expires <= os_get_monotonic_time()) {
+        cache_entry_free(resolver, entry);
+        return NULL;
+    }
+
+    if (os_copyaddrinfo(&sa_list, entry->sa_list) != OS_OK) {
+        os_freeaddrinfo(sa_list);
+        return NULL;
+    }
+    for (addr = sa_list; addr; addr = addr->next)
+        addr->os_sin_port = htobe16(port);
+
+    return sa_list;
+}
+
+PRIVATE void cache_store(os_resolver_t *resolver, resolve_req_t *req)
+{
+    resolve_cache_t *entry = NULL;
+    char *key = NULL;
+
+    if (!resolver->ttl)
+        return;
+
+    key = cache_key(req->family, req->flags, req->hostname);
+    os_assert(key);
+
+    entry = os_hash_get(resolver->cache, key, OS_HASH_KEY_STRING);
+    if (entry)
+        cache_entry_free(resolver, entry);
+
+    entry = os_calloc(1, sizeof(*entry));
+    os_assert(entry);
+    entry->key = key;
+    entry->expires = os_get_monotonic_time() + resolver->ttl;
+    if (os_copyaddrinfo(&entry->sa_list, req->sa_list) != OS_OK) {
+        os_freeaddrinfo(entry->sa_list);
+        os_free(entry->key);
+        os_free(entry);
+        return;
+    }
+
+    os_hash_set(resolver->cache, entry->key, OS_HASH_KEY_STRING, entry);
+}
+
+PRIVATE void resolver_complete(short when, os_socket_t fd, void *data)
+{
+    os_resolver_t *resolver = data;
+    resolve_req_t *req = NULL;
+    ssize_t r;
+#if defined(HAVE_EVENTFD)
+    uint64_t msg;
+
+    r = read(fd, &msg, sizeof(msg));
+#else
+    unsigned char buf[1024];
+
+    r = recv(fd, buf, sizeof(buf), 0);
+#endif
+    if (r < 0)
+        os_logsp(ERROR, ERRNOID, os_socket_errno, "resolver drain failed");
+
+    while (os_queue_trypop(resolver->done, (void **)&req) == OS_OK) {
+        os_list_remove(&resolver->pending, req);
+        resolver->npending--;
+
+        if (req->rv == OS_OK)
+            cache_store(resolver, req);
+
+        if (!req->cancelled) {
+            req->cb(req->rv, req->sa_list, req->data);
+            req->sa_list = NULL;
+        }
+        req_free(req);
+    }
+}
+
+/////////////////////////////////////////////////////////
+os_resolver_t *os_resolver_create(
+        os_pollset_t *pollset, const os_resolver_config_t *conf)
+{
+    os_resolver_t *resolver = NULL;
+    unsigned int queue;
+    os_thread_attr_t attr;
+    int i, threads;
+#if !defined(HAVE_EVENTFD)
+    int rc;
+#endif
+
+    os_assert(pollset);
+    os_assert(conf);
+
+    resolver = os_calloc(1, sizeof(*resolver));
+    if (!resolver) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    resolver->pollset = pollset;
+    resolver->fd[0] = resolver->fd[1] = INVALID_SOCKET;
+    resolver->ttl = conf->ttl;
+    os_list_init(&resolver->pending);
+
+    resolver->cache = os_hash_make();
+    os_assert(resolver->cache);
+
+    if (conf->hosts_file) {
+        resolver->hosts_file = os_strdup(conf->hosts_file);
+        os_assert(resolver->hosts_file);
+    }
+
+    threads = conf->threads > 0 ? conf->threads : RESOLVER_DEFAULT_THREADS;
+    if (threads > RESOLVER_MAX_THREADS)
+        threads = RESOLVER_MAX_THREADS;
+    queue = conf->queue ? conf->queue : RESOLVER_DEFAULT_QUEUE;
+
+    /*
+     * No more than queue lookups are in flight, queued or being worked
+     * on or done, so workers never block on the way back.
+     */
+    resolver->queue = queue;
+    resolver->work = os_queue_create(queue);
+    resolver->done = os_queue_create(queue);
+    if (!resolver->work || !resolver->done) {
+        os_log(ERROR, "os_queue_create() failed");
+        goto err;
+    }
+
+#if defined(HAVE_EVENTFD)
+    resolver->fd[0] = eventfd(0, 0);
+    if (resolver->fd[0] == INVALID_SOCKET) {
+        os_logsp(ERROR, ERRNOID, os_errno, "eventfd() failed");
+        goto err;
+    }
+#else
+    rc = os_socketpair(AF_SOCKPAIR, SOCK_STREAM, 0, resolver->fd);
+    if (rc != OS_OK) {
+        os_log(ERROR, "os_socketpair() failed");
+        goto err;
+    }
+#endif
+
+    resolver->poll = os_pollset_add(pollset, OS_POLLIN,
+            resolver->fd[0], resolver_complete, resolver);
+    if (!resolver->poll) {
+        os_log(ERROR, "os_pollset_add() failed");
+        goto err;
+    }
+
+    resolver->threads = os_calloc(threads, sizeof(os_thread_t *));
+    os_assert(resolver->threads);
+    memset(&attr, 0, sizeof(attr));
+    attr.name = "resolver";
+    for (i = 0; i < threads; i++) {
+        resolver->threads[i] =
+            os_thread_create_ex(&attr, resolver_worker, resolver);
+        if (!resolver->threads[i])
+            goto err;
+        resolver->nthreads++;
+    }
+
+    return resolver;
+
+err:
+    os_resolver_destroy(resolver);
+    return NULL;
+}
+
+void os_resolver_destroy(os_resolver_t *resolver)
+{
+    resolve_req_t *req = NULL, *next = NULL;
+    int i;
+
+    os_assert(resolver);
+
+    if (resolver->work)
+        os_queue_term(resolver->work);
+    if (resolver->done)
+        os_queue_term(resolver->done);
+    for (i = 0; i < resolver->nthreads; i++)
+        os_thread_destroy(resolver->threads[i], -1);
+    if (resolver->threads)
+        os_free(resolver->threads);
+
+    if (resolver->poll)
+        os_pollset_remove(resolver->poll);
+    if (resolver->fd[0] != INVALID_SOCKET)
+        os_closesocket(resolver->fd[0]);
+    if (resolver->fd[1] != INVALID_SOCKET)
+        os_closesocket(resolver->fd[1]);
+
+    /* whatever is still queued is on the pending list as well */
+    os_list_for_each_entry_safe(&resolver->pending, next, req, lnode) {
+        os_list_remove(&resolver->pending, req);
+        req_free(req);
+    }
+
+    if (resolver->work)
+        os_queue_destroy(resolver->work);
+    if (resolver->done)
+        os_queue_destroy(resolver->done);
+
+    os_resolver_flush(resolver);
+    os_hash_destroy(resolver->cache);
+
+    if (resolver->hosts_file)
+        os_free(resolver->hosts_file);
+    os_free(resolver);
+}
+
+int os_resolver_getaddrinfo(os_resolver_t *resolver,
+        int family, const char *hostname, uint16_t port, int flags,
+        os_resolve_cb_f cb, void *data)
+{
+    resolve_req_t *req = NULL;
+    os_sockaddr_t *sa_list = NULL, tmp;
+    int rv;
+
+    os_assert(resolver);
+    os_assert(hostname);
+    os_assert(cb);
+
+    /* numeric hosts never block */
+    if (os_inet_pton(AF_INET, hostname, &tmp) == OS_OK ||
+        os_inet_pton(AF_INET6, hostname, &tmp) == OS_OK) {
+        rv = os_getaddrinfo(&sa_list, family, hostname, port, flags | AI_NUMERICHOST);
+        if (rv != OS_OK && sa_list) {
+            os_freeaddrinfo(sa_list);
+            sa_list = NULL;
+        }
+        cb(rv, sa_list, data);
+        return OS_OK;
+    }
+
+    sa_list = cache_lookup(resolver, family, hostname, port, flags);
+    if (sa_list) {
+        cb(OS_OK, sa_list, data);
+        return OS_OK;
+    }
+
+    if (resolver->npending >= resolver->queue) {
+        os_log(ERROR, "Too many pending lookups [%s]", hostname);
+        return OS_ERROR;
+    }
+
+    req = os_calloc(1, sizeof(*req));
+    os_assert(req);
+    req->family = family;
+    req->flags = flags;
+    req->port = port;
+    req->hostname = os_strdup(hostname);
+    os_assert(req->hostname);
+    req->cb = cb;
+    req->data = data;
+
+    if (os_queue_trypush(resolver->work, req) != OS_OK) {
+        os_log(ERROR, "Too many pending lookups [%s]", hostname);
+        req_free(req);
+        return OS_ERROR;
+    }
+    os_list_add(&resolver->pending, req);
+    resolver->npending++;
+
+    return OS_OK;
+}
+
+void os_resolver_cancel(os_resolver_t *resolver, void *data)
+{
+    resolve_req_t *req = NULL;
+
+    os_assert(resolver);
+
+    os_list_for_each_entry(&resolver->pending, req, lnode)
+        if (req->data == data)
+            req->cancelled = true;
+}
+
+void os_resolver_flush(os_resolver_t *resolver)
+{
+    os_hash_index_t hi, *p = NULL;
+
+    os_assert(resolver);
+
+    for (p = os_hash_first_r(resolver->cache, &hi); p; p = os_hash_next(p))
+        cache_entry_free(resolver, os_hash_this_val(p));
+}
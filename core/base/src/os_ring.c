@@ -25,11 +25,16 @@ typedef struct os_ring_queue_s {
    unsigned int        full_waiters;
    unsigned int        empty_waiters;
    os_thread_mutex_t  cs;
-   os_thread_cond_t   not_empty;
-   os_thread_cond_t   not_full;
+   os_thread_waitq_t  not_empty;
+   os_thread_waitq_t  not_full;
+   unsigned int       interrupts;
    int       terminated;
 } os_ring_queue_t;
 
+#define ring_queue_next(rque, idx) ((idx) + 1 == (rque)->que_size + 1 ? 0 : (idx) + 1)
+#define ring_queue_full(rque) (ring_queue_next(rque, (rque)->tail) == (rque)->head)
+#define ring_queue_empty(rque) ((rque)->head == (rque)->tail)
+
 os_ring_queue_t *os_ring_queue_create(unsigned int size)
 {
 
@@ -54,9 +59,10 @@ os_ring_queue_t *os_ring_queue_create(unsigned int size)
     rque->tail = 0;    
     rque->full_waiters = 0;        
     rque->empty_waiters = 0;    
+    rque->interrupts = 0;
     rque->terminated = 0;
-    os_thread_cond_init(&rque->not_empty);
-    os_thread_cond_init(&rque->not_full);
+    os_thread_waitq_init(&rque->not_empty);
+    os_thread_waitq_init(&rque->not_full);
     os_thread_mutex_init(&rque->cs);
     return rque;
 }
@@ -76,6 +82,42 @@ int os_ring_queue_time_put(os_ring_queue_t *rque, unsigned char *data, unsigned
     return ring_queue_put(rque, data, size, timeout);
 }
 
+/*
+ * Wait with cs held until there is room (for_space) or data. Spurious
+ * wakeups are absorbed; only term, interrupt or the relative, monotonic
+ * timeout end the wait early.
+ */
+PRIVATE int ring_queue_wait(os_ring_queue_t *rque, int for_space, os_time_t timeout)
+{
+    os_thread_waitq_t *wq = for_space ? &rque->not_full : &rque->not_empty;
+    unsigned int *waiters = for_space ? &rque->full_waiters : &rque->empty_waiters;
+    unsigned int interrupts = rque->interrupts;
+    os_time_t deadline = 0, remain = timeout;
+    int rv = OS_OK;
+
+    if (timeout > 0)
+        deadline = os_get_monotonic_time() + timeout;
+
+    (*waiters)++;
+    while ((for_space ? ring_queue_full(rque) : ring_queue_empty(rque)) &&
+            !rque->terminated && interrupts == rque->interrupts) {
+        rv = os_thread_waitq_wait(wq, &rque->cs,
+                timeout > 0 ? remain : OS_INFINITE_TIME);
+        if (rv != OS_OK)
+            break;
+        if (timeout > 0) {
+            remain = deadline - os_get_monotonic_time();
+            if (remain <= 0) {
+                rv = OS_TIMEUP;
+                break;
+            }
+        }
+    }
+    (*waiters)--;
+
+    return rv;
+}
+
 int ring_queue_put(os_ring_queue_t *rque, unsigned char *data, unsigned int size, os_time_t timeout)
 {
     size_t tmp;
@@ -93,23 +135,13 @@ int ring_queue_put(os_ring_queue_t *rque, unsigned char *data, unsigned int size
             os_thread_mutex_unlock(&rque->cs);
             return OS_RETRY;
         }
-        if (!rque->terminated) {
-            rque->full_waiters++;
-            if (timeout > 0) {
-                rv = os_thread_cond_timedwait(&rque->not_full,
-                                               &rque->cs,
-                                               timeout);
-            }
-            else {
-                rv = os_thread_cond_wait(&rque->not_full,
-                                          &rque->cs);
-            }
-            rque->full_waiters--;
-            if (rv != OS_OK) {
-                os_thread_mutex_unlock(&rque->cs);
-                return rv;
-            }
+        rv = ring_queue_wait(rque, 1, timeout);
+        if (rv != OS_OK && ring_queue_full(rque)) {
+            os_thread_mutex_unlock(&rque->cs);
+            return rv;
         }
+        /* another producer may have moved tail meanwhile */
+        tmp = ring_queue_next(rque, rque->tail);
     }
 
     if(tmp == rque->head){
@@ -129,7 +161,7 @@ int ring_queue_put(os_ring_queue_t *rque, unsigned char *data, unsigned int size
         ++rque->ic;
         if (rque->empty_waiters) {
             os_log(TRACE, "signal empty!");
-            os_thread_cond_signal(&rque->not_empty);
+            os_thread_waitq_signal(&rque->not_empty);
         }
         os_thread_mutex_unlock(&rque->cs);        
         return OS_OK;
@@ -171,22 +203,10 @@ int ring_queue_get(os_ring_queue_t *rque, unsigned char **ptr, unsigned int *siz
             os_thread_mutex_unlock(&rque->cs);
             return OS_RETRY;
         }
-        if (!rque->terminated) {
-            rque->empty_waiters++;
-            if (timeout > 0) {
-                rv = os_thread_cond_timedwait(&rque->not_empty,
-                                               &rque->cs,
-                                               timeout);
-            }
-            else {
-                rv = os_thread_cond_wait(&rque->not_empty,
-                                          &rque->cs);
-            }
-            rque->empty_waiters--;
-            if (rv != OS_OK) {
-                os_thread_mutex_unlock(&rque->cs);
-                return rv;
-            }
+        rv = ring_queue_wait(rque, 0, timeout);
+        if (rv != OS_OK && ring_queue_empty(rque)) {
+            os_thread_mutex_unlock(&rque->cs);
+            return rv;
         }
     } 
 
@@ -209,7 +229,7 @@ int ring_queue_get(os_ring_queue_t *rque, unsigned char **ptr, unsigned int *siz
         ++rque->oc;
         if (rque->full_waiters) {
             os_log(TRACE, "signal full!");
-            os_thread_cond_signal(&rque->not_full);
+            os_thread_waitq_signal(&rque->not_full);
         }
         os_thread_mutex_unlock(&rque->cs);        
         return OS_OK;        
@@ -222,8 +242,8 @@ int os_ring_queue_destroy(os_ring_queue_t *rque)
 
     if(rque->pkts != NULL)    free(rque->pkts);
 
-    os_thread_cond_destroy(&rque->not_empty);
-    os_thread_cond_destroy(&rque->not_full);
+    os_thread_waitq_destroy(&rque->not_empty);
+    os_thread_waitq_destroy(&rque->not_full);
     os_thread_mutex_destroy(&rque->cs);
     free(rque);
 
@@ -235,8 +255,9 @@ int os_ring_queue_interrupt_all(os_ring_queue_t *rque)
     os_log(DEBUG, "interrupt all");
     os_thread_mutex_lock(&rque->cs);
 
-    os_thread_cond_broadcast(&rque->not_empty);
-    os_thread_cond_broadcast(&rque->not_full);
+    rque->interrupts++;
+    os_thread_waitq_broadcast(&rque->not_empty);
+    os_thread_waitq_broadcast(&rque->not_full);
 
     os_thread_mutex_unlock(&rque->cs);
 
@@ -272,7 +293,7 @@ typedef struct os_ring_buf_s {
    size_t    head;
    size_t    tail;
    unsigned int *rque;
-   os_thread_mutex_t  cs;
+   os_spinlock_t  lock;   /* held for a few instructions only */
 } os_ring_buf_t;
 
 os_ring_buf_t *os_ring_buf_create(unsigned int count, unsigned int size)
@@ -313,7 +334,7 @@ os_ring_buf_t *os_ring_buf_create(unsigned int count, unsigned int size)
     }
     rbuf->rque[count] = -1;
 
-    os_thread_mutex_init(&rbuf->cs);
+    os_spinlock_init(&rbuf->lock);
     return rbuf;
 }
 
@@ -328,10 +349,10 @@ unsigned char *os_ring_buf_get(os_ring_buf_t *rbuf)
 
     if(rbuf == NULL) return NULL;
 
-    os_thread_mutex_lock(&rbuf->cs);
+    os_spinlock_lock(&rbuf->lock);
     if(rbuf->head == rbuf->tail)
     {
-        os_thread_mutex_unlock(&rbuf->cs);
+        os_spinlock_unlock(&rbuf->lock);
         os_log(ERROR, "rbuf EMPTY!");
         return NULL;        
     }else{
@@ -342,7 +363,7 @@ unsigned char *os_ring_buf_get(os_ring_buf_t *rbuf)
         //memcpy(blk, &rbuf, sizeof(void*));
         *(os_ring_buf_t**)blk = rbuf;  //sizeof(*) store struct os_ring_buf_t
         blk += sizeof(void*);
-        os_thread_mutex_unlock(&rbuf->cs);    
+        os_spinlock_unlock(&rbuf->lock);    
         return blk;        
     }   
 }
@@ -364,11 +385,11 @@ unsigned int os_ring_buf_ret(unsigned char *blk)
     idx = (int)((blk - rbuf->buf)/(rbuf->buf_unit));
     if((idx < 0) || (idx > rbuf->buf_size))  return OS_ERROR;
 
-    os_thread_mutex_lock(&rbuf->cs);
+    os_spinlock_lock(&rbuf->lock);
     tmp = rbuf->tail + 1;
     if(tmp == rbuf->buf_size + 1) tmp = 0;
     if(tmp == rbuf->head){
-        os_thread_mutex_unlock(&rbuf->cs);
+        os_spinlock_unlock(&rbuf->lock);
         os_log(WARN, "rbuf FULL!");
         return OS_ERROR;         
     }else{
@@ -376,7 +397,7 @@ unsigned int os_ring_buf_ret(unsigned char *blk)
         rbuf->tail = tmp;
         ++rbuf->ic;
         *(os_ring_buf_t**)(blk - sizeof(void*)) = NULL;
-        os_thread_mutex_unlock(&rbuf->cs);        
+        os_spinlock_unlock(&rbuf->lock);        
         return 0;
     }
  
@@ -389,7 +410,6 @@ int os_ring_buf_destroy(os_ring_buf_t *rbuf)
     if(rbuf->buf != NULL)  free(rbuf->buf);
     if(rbuf->rque != NULL)    free(rbuf->rque);
 
-    os_thread_mutex_destroy(&rbuf->cs);
     free(rbuf);
 
     return OS_OK;
@@ -401,6 +421,7 @@ void os_ring_buf_show(os_ring_buf_t *rbuf)
     char tmp[256] = {0};
     sprintf(tmp, "%p,size=%ld,unit=%ld,ic=%lld,oc=%lld,used rate[%lld%%]",rbuf,rbuf->buf_unit,rbuf->buf_size,rbuf->ic,rbuf->oc,(rbuf->oc-rbuf->ic)/rbuf->buf_size);
     fprintf(stderr, "ring buf : %s!\n", tmp);
+    os_lock_stat_show("ring buf", os_lock_stat(&rbuf->lock));
 }
 
 
@@ -8,12 +8,145 @@
 #include "os_init.h"
 
 PRIVATE void sctp_write_callback(short when, os_socket_t fd, void *data);
+PRIVATE bool sctp_assoc_notify(os_sock_t *sock,
+        const union sctp_notification *not);
+
+/* buffer size when the socket cannot tell the next message's length */
+#define SCTP_RECV_SIZE 2048
+#define SCTP_NOTIFY_MAX 16
+
+typedef struct sctp_notify_s {
+    uint16_t type;
+    os_sctp_notify_f handler;
+    void *data;
+} sctp_notify_t;
+
+/* registered from any thread, read by every reactor */
+PRIVATE sctp_notify_t sctp_notify[SCTP_NOTIFY_MAX];
+PRIVATE int sctp_notify_count = 0;
+PRIVATE os_rwlock_t sctp_notify_lock;
+
+PRIVATE void sctp_notify_log(const union sctp_notification *not, int flags)
+{
+    switch(not->sn_header.sn_type) {
+    case SCTP_ASSOC_CHANGE :
+        os_log(DEBUG, "SCTP_ASSOC_CHANGE:"
+                "[T:%d, F:0x%x, S:%d, I/O:%d/%d]", 
+                not->sn_assoc_change.sac_type,
+                not->sn_assoc_change.sac_flags,
+                not->sn_assoc_change.sac_state,
+                not->sn_assoc_change.sac_inbound_streams,
+                not->sn_assoc_change.sac_outbound_streams);
+
+        if (not->sn_assoc_change.sac_state == SCTP_COMM_UP) {
+            os_log(DEBUG, "SCTP_COMM_UP");
+        } else if (not->sn_assoc_change.sac_state == SCTP_SHUTDOWN_COMP ||
+                not->sn_assoc_change.sac_state == SCTP_COMM_LOST) {
+
+            if (not->sn_assoc_change.sac_state == SCTP_SHUTDOWN_COMP)
+                os_log(DEBUG, "SCTP_SHUTDOWN_COMP");
+            if (not->sn_assoc_change.sac_state == SCTP_COMM_LOST)
+                os_log(DEBUG, "SCTP_COMM_LOST");
+        }
+        break;
+    case SCTP_SHUTDOWN_EVENT :
+        os_log(DEBUG, "SCTP_SHUTDOWN_EVENT:[T:%d, F:0x%x, L:%d]",
+                not->sn_shutdown_event.sse_type,
+                not->sn_shutdown_event.sse_flags,
+                not->sn_shutdown_event.sse_length);
+        break;
+    case SCTP_SEND_FAILED :
+        os_log(ERROR, "SCTP_SEND_FAILED:[T:%d, F:0x%x, S:%d]",
+                not->sn_send_failed.ssf_type,
+                not->sn_send_failed.ssf_flags,
+                not->sn_send_failed.ssf_error);
+        break;
+    case SCTP_PEER_ADDR_CHANGE:
+        os_log(WARN, "SCTP_PEER_ADDR_CHANGE:[T:%d, F:0x%x, S:%d]", 
+                not->sn_paddr_change.spc_type,
+                not->sn_paddr_change.spc_flags,
+                not->sn_paddr_change.spc_error);
+        break;
+    case SCTP_REMOTE_ERROR:
+        os_log(WARN, "SCTP_REMOTE_ERROR:[T:%d, F:0x%x, S:%d]", 
+                not->sn_remote_error.sre_type,
+                not->sn_remote_error.sre_flags,
+                not->sn_remote_error.sre_error);
+        break;
+    default :
+        os_log(ERROR, "Discarding event with unknown flags:0x%x type:0x%x",
+                flags, not->sn_header.sn_type);
+        break;
+    }
+}
+
+int os_sctp_notify_register(uint16_t type, os_sctp_notify_f handler, void *data)
+{
+    int i;
+
+    os_rwlock_wrlock(&sctp_notify_lock);
+
+    for (i = 0; i < sctp_notify_count; i++) {
+        if (sctp_notify[i].type == type)
+            break;
+    }
+
+    if (!handler) {
+        if (i < sctp_notify_count)
+            sctp_notify[i] = sctp_notify[--sctp_notify_count];
+        os_rwlock_wrunlock(&sctp_notify_lock);
+        return OS_OK;
+    }
+
+    if (i == SCTP_NOTIFY_MAX) {
+        os_rwlock_wrunlock(&sctp_notify_lock);
+        os_log(ERROR, "Too many SCTP notification handlers [%d]",
+                SCTP_NOTIFY_MAX);
+        return OS_ERROR;
+    }
+
+    sctp_notify[i].type = type;
+    sctp_notify[i].handler = handler;
+    sctp_notify[i].data = data;
+    if (i == sctp_notify_count)
+        sctp_notify_count++;
+
+    os_rwlock_wrunlock(&sctp_notify_lock);
+
+    return OS_OK;
+}
+
+PRIVATE void sctp_notify_dispatch(os_sock_t *sock,
+        const union sctp_notification *not, int flags)
+{
+    sctp_notify_t notify = { 0 };
+    int i;
+
+    if (sctp_assoc_notify(sock, not))
+        return;
+
+    /* copied out so a handler may (un)register without deadlocking */
+    os_rwlock_rdlock(&sctp_notify_lock);
+    for (i = 0; i < sctp_notify_count; i++) {
+        if (sctp_notify[i].type == not->sn_header.sn_type) {
+            notify = sctp_notify[i];
+            break;
+        }
+    }
+    os_rwlock_rdunlock(&sctp_notify_lock);
+
+    if (notify.handler)
+        notify.handler(sock, not, notify.data);
+    else
+        sctp_notify_log(not, flags);
+}
 
 int os_sctp_recvdata(os_sock_t *sock, void *msg, size_t len,
         os_sockaddr_t *from, os_sctp_info_t *sinfo)
 {
     int size;
     int flags = 0;
+    bool truncated = false;
 
     do {
         size = os_sctp_recvmsg(sock, msg, len, from, sinfo, &flags);
@@ -23,72 +156,170 @@ int os_sctp_recvdata(os_sock_t *sock, void *msg, size_t len,
         }
 
         if (flags & MSG_NOTIFICATION) {
-            /* Nothing */
-            union sctp_notification *not = (union sctp_notification *)msg;
-    
-            switch(not->sn_header.sn_type) {
-            case SCTP_ASSOC_CHANGE :
-                os_log(DEBUG, "SCTP_ASSOC_CHANGE:"
-                        "[T:%d, F:0x%x, S:%d, I/O:%d/%d]", 
-                        not->sn_assoc_change.sac_type,
-                        not->sn_assoc_change.sac_flags,
-                        not->sn_assoc_change.sac_state,
-                        not->sn_assoc_change.sac_inbound_streams,
-                        not->sn_assoc_change.sac_outbound_streams);
-
-                if (not->sn_assoc_change.sac_state == SCTP_COMM_UP) {
-                    os_log(DEBUG, "SCTP_COMM_UP");
-                } else if (not->sn_assoc_change.sac_state == SCTP_SHUTDOWN_COMP ||
-                        not->sn_assoc_change.sac_state == SCTP_COMM_LOST) {
-    
-                    if (not->sn_assoc_change.sac_state == SCTP_SHUTDOWN_COMP)
-                        os_log(DEBUG, "SCTP_SHUTDOWN_COMP");
-                    if (not->sn_assoc_change.sac_state == SCTP_COMM_LOST)
-                        os_log(DEBUG, "SCTP_COMM_LOST");
-                }
-                break;
-            case SCTP_SHUTDOWN_EVENT :
-                os_log(DEBUG, "SCTP_SHUTDOWN_EVENT:[T:%d, F:0x%x, L:%d]",
-                        not->sn_shutdown_event.sse_type,
-                        not->sn_shutdown_event.sse_flags,
-                        not->sn_shutdown_event.sse_length);
-                break;
-            case SCTP_SEND_FAILED :
-                os_log(ERROR, "SCTP_SEND_FAILED:[T:%d, F:0x%x, S:%d]",
-                        not->sn_send_failed.ssf_type,
-                        not->sn_send_failed.ssf_flags,
-                        not->sn_send_failed.ssf_error);
-                break;
-            case SCTP_PEER_ADDR_CHANGE:
-                os_log(WARN, "SCTP_PEER_ADDR_CHANGE:[T:%d, F:0x%x, S:%d]", 
-                        not->sn_paddr_change.spc_type,
-                        not->sn_paddr_change.spc_flags,
-                        not->sn_paddr_change.spc_error);
-                break;
-            case SCTP_REMOTE_ERROR:
-                os_log(WARN, "SCTP_REMOTE_ERROR:[T:%d, F:0x%x, S:%d]", 
-                        not->sn_remote_error.sre_type,
-                        not->sn_remote_error.sre_flags,
-                        not->sn_remote_error.sre_error);
-                break;
-            default :
-                os_log(ERROR, "Discarding event with unknown flags:0x%x type:0x%x",
-                        flags, not->sn_header.sn_type);
-                break;
-            }
+            sctp_notify_log((union sctp_notification *)msg, flags);
         }
         else if (flags & MSG_EOR) {
             //recv success
             break;
         }
+        else if (size == 0) {
+            /* peer closed */
+            return OS_ERROR;
+        }
         else {
-            os_assert_if_reached();
+            /* does not fit in msg; skip the rest, os_sctp_recv_buf() copes */
+            truncated = true;
         }
     } while(1);
 
+    if (truncated) {
+        os_log(ERROR, "os_sctp_recvdata() message larger than %d", (int)len);
+        return OS_ERROR;
+    }
+
     return size;
 }
 
+/* the length of the next queued message, 0 if not known */
+PRIVATE unsigned int sctp_recv_pending(os_sock_t *sock)
+{
+#if defined(FIONREAD)
+    int avail = 0;
+
+    /* on Linux SCTP this is the size of the next message, not the total */
+    if (ioctl(sock->fd, FIONREAD, &avail) == 0 && avail > 0)
+        return avail;
+#endif
+    return 0;
+}
+
+/* the message outgrew buf: move it to one twice as large */
+PRIVATE os_buf_t *sctp_recv_grow(os_buf_pool_t *pool, os_buf_t *buf)
+{
+    os_buf_t *bigger = NULL;
+    unsigned int size;
+
+    size = os_min((buf->len + os_buf_tailroom(buf)) * 2, OS_CLUSTER_BIG_SIZE);
+    bigger = os_buf_alloc(pool, size);
+    if (!bigger)
+        return NULL;
+
+    os_buf_put_data(bigger, buf->data, buf->len);
+    os_buf_free(buf);
+
+    return bigger;
+}
+
+/* what a partly received *buf holds; kept in param[1] until complete */
+#define SCTP_RECV_DATA      0
+#define SCTP_RECV_NOTIFY    1   /* a notification, from offset param[0] */
+#define SCTP_RECV_DISCARD   2   /* the rest of an oversized message */
+
+int os_sctp_recv_buf(os_sock_t *sock, os_buf_pool_t *pool,
+        os_buf_t **pbuf, os_sockaddr_t *from, os_sctp_info_t *sinfo)
+{
+    os_buf_t *buf = NULL;
+    os_sctp_info_t info;
+    unsigned int start = 0, size;
+    int n, flags, rv, state = SCTP_RECV_DATA;
+
+    os_assert(sock);
+    os_assert(pbuf);
+
+    buf = *pbuf;
+    if (buf) {
+        start = buf->param[0];
+        state = buf->param[1];
+    }
+
+    for ( ;; ) {
+        if (!buf) {
+            size = os_max(sctp_recv_pending(sock), SCTP_RECV_SIZE);
+            buf = os_buf_alloc(pool, os_min(size, OS_CLUSTER_BIG_SIZE));
+            if (!buf) {
+                rv = OS_ERROR;
+                goto out;
+            }
+        } else if (os_buf_tailroom(buf) == 0) {
+            if (state == SCTP_RECV_DISCARD) {
+                os_buf_trim(buf, 0);
+            } else if (buf->len >= OS_CLUSTER_BIG_SIZE) {
+                os_log(ERROR, "SCTP message larger than %d dropped",
+                        OS_CLUSTER_BIG_SIZE);
+                state = SCTP_RECV_DISCARD;
+                os_buf_trim(buf, 0);
+            } else {
+                os_buf_t *bigger = sctp_recv_grow(pool, buf);
+                if (!bigger) {
+                    rv = OS_ERROR;
+                    goto out;
+                }
+                buf = bigger;
+            }
+        }
+
+        if (state != SCTP_RECV_NOTIFY)
+            start = buf->len;
+
+        flags = 0;
+        memset(&info, 0, sizeof(info));
+        n = os_sctp_recvmsg(sock, buf->tail, os_buf_tailroom(buf),
+                from, &info, &flags);
+        if (n < 0) {
+            rv = (os_socket_errno == OS_EAGAIN ||
+                    os_socket_errno == EINTR) ? OS_RETRY : OS_ERROR;
+            goto out;
+        }
+        if (n == 0 && !(flags & (MSG_NOTIFICATION|MSG_EOR))) {
+            rv = OS_DONE;
+            goto out;
+        }
+        os_buf_put(buf, n);
+
+        if (!(flags & MSG_EOR)) {
+            if (state != SCTP_RECV_DISCARD)
+                state = (flags & MSG_NOTIFICATION) ?
+                    SCTP_RECV_NOTIFY : SCTP_RECV_DATA;
+            continue;
+        }
+
+        if (state == SCTP_RECV_DISCARD) {
+            rv = OS_ERROR;
+            goto out;
+        }
+
+        if (flags & MSG_NOTIFICATION) {
+            sctp_notify_dispatch(sock,
+                (union sctp_notification *)(buf->data + start), flags);
+            os_buf_trim(buf, start);
+            state = SCTP_RECV_DATA;
+            continue;
+        }
+
+        os_sctp_ppid_in_buf(buf) = info.ppid;
+        os_sctp_stream_no_in_buf(buf) = info.stream_no;
+        if (sinfo)
+            memcpy(sinfo, &info, sizeof(info));
+
+        *pbuf = buf;
+        return OS_OK;
+    }
+
+out:
+    /* keep a partly received message for the next call */
+    if (rv == OS_RETRY && buf && (buf->len || state != SCTP_RECV_DATA)) {
+        buf->param[0] = start;
+        buf->param[1] = state;
+        *pbuf = buf;
+        return rv;
+    }
+    if (buf)
+        os_buf_free(buf);
+    *pbuf = NULL;
+
+    return rv;
+}
+
 int os_sctp_senddata(os_sock_t *sock,
         os_buf_t *buf, os_sockaddr_t *addr)
 {
@@ -109,45 +340,154 @@ int os_sctp_senddata(os_sock_t *sock,
     return OS_OK;
 }
 
+/* messages sent per call before going back to the pollset */
+#define SCTP_WRITE_BUDGET 64
+
+PRIVATE os_list_t *sctp_write_queue(os_sctp_sock_t *sctp, uint16_t stream_no)
+{
+    os_list_t *queue = NULL;
+    unsigned int streams;
+
+    if (os_likely(stream_no < sctp->write.streams))
+        return &sctp->write.queue[stream_no];
+
+    /* os_list_t heads may move, nodes never point back at them */
+    streams = os_max((unsigned int)stream_no + 1, sctp->write.streams * 2);
+    streams = os_min(streams, 65536u);
+    queue = os_realloc(sctp->write.queue, streams * sizeof(*queue));
+    if (!queue) {
+        os_log(ERROR, "os_realloc(%u) failed", streams);
+        return NULL;
+    }
+    memset(queue + sctp->write.streams, 0,
+            (streams - sctp->write.streams) * sizeof(*queue));
+
+    sctp->write.queue = queue;
+    sctp->write.streams = streams;
+
+    return &queue[stream_no];
+}
+
+/*
+ * Pick up to OS_SCTP_SEND_BATCH messages, one from each non-empty
+ * stream in round-robin order, then the next of each and so on.
+ * Messages of one stream keep their order.
+ */
+PRIVATE int sctp_write_pick(os_sctp_sock_t *sctp, os_buf_t **bufs, int max)
+{
+    os_buf_t *cur[OS_SCTP_SEND_BATCH];
+    unsigned int i, s = 0;
+    int n = 0, picked, j, streams = 0;
+
+    for (i = 0; i < sctp->write.streams && n < max; i++) {
+        s = (sctp->write.next + i) % sctp->write.streams;
+        cur[streams] = os_list_first(&sctp->write.queue[s]);
+        if (cur[streams])
+            bufs[n++] = cur[streams++];
+    }
+    sctp->write.next = (s + 1) % sctp->write.streams;
+
+    do {
+        picked = n;
+        for (j = 0; j < streams && n < max; j++) {
+            if (cur[j] && (cur[j] = os_list_next(cur[j])))
+                bufs[n++] = cur[j];
+        }
+    } while (n < max && n > picked);
+
+    return n;
+}
+
+PRIVATE void sctp_write_done(os_sctp_sock_t *sctp, os_buf_t *buf)
+{
+    os_list_remove(&sctp->write.queue[os_sctp_stream_no_in_buf(buf)], buf);
+    sctp->write.pending--;
+    os_buf_free(buf);
+}
+
+/*
+ * Send queued messages, a batch per system call, until the socket would
+ * block or the budget is used up. A message that fails for any other
+ * reason is dropped on its own; the rest of the queues still go out.
+ * @return OS_DONE when every queue is empty, OS_RETRY otherwise
+ */
+PRIVATE int sctp_write_flush(os_sctp_sock_t *sctp)
+{
+    os_buf_t *bufs[OS_SCTP_SEND_BATCH];
+    int budget = SCTP_WRITE_BUDGET;
+    int n, sent, i;
+
+    os_assert(sctp->sock);
+
+    while (sctp->write.pending && budget > 0) {
+        n = sctp_write_pick(sctp, bufs, os_min(budget, OS_SCTP_SEND_BATCH));
+        os_assert(n > 0);
+
+        sent = os_sctp_sendmmsg(sctp->sock, bufs, n);
+        if (sent < 0) {
+            if (os_socket_errno == OS_EAGAIN || os_socket_errno == EINTR)
+                return OS_RETRY;
+
+            os_logsp(ERROR, ERRNOID, os_socket_errno,
+                    "sctp_write_flush(len:%d,ssn:%d)", bufs[0]->len,
+                    (int)os_sctp_stream_no_in_buf(bufs[0]));
+            sent = 1;
+        }
+
+        /* a short count leaves the rest to the next round */
+        for (i = 0; i < sent; i++)
+            sctp_write_done(sctp, bufs[i]);
+        budget -= sent;
+    }
+
+    return sctp->write.pending ? OS_RETRY : OS_DONE;
+}
+
 void os_sctp_write_to_buffer(os_pollset_t *pollset, os_sctp_sock_t *sctp, os_buf_t *buf)
 {
+    os_list_t *queue = NULL;
+
     os_assert(sctp);
     os_assert(buf);
 
-    os_list_add(&sctp->write_queue, buf);
-
-    if (!sctp->poll.write) {
-        os_assert(sctp->sock);
-        sctp->poll.write = os_pollset_add(pollset,
-            OS_POLLOUT, sctp->sock->fd, sctp_write_callback, sctp);
-        os_assert(sctp->poll.write);
+    queue = sctp_write_queue(sctp, os_sctp_stream_no_in_buf(buf));
+    if (!queue) {
+        os_buf_free(buf);
+        return;
     }
+    os_list_add(queue, buf);
+    sctp->write.pending++;
+
+    /* while POLLOUT is armed, the callback owns the queue */
+    if (sctp->poll.write)
+        return;
+
+    /* usually the socket has room and no poll is needed at all */
+    if (sctp_write_flush(sctp) == OS_DONE)
+        return;
+
+    sctp->poll.write = os_pollset_add(pollset,
+        OS_POLLOUT, sctp->sock->fd, sctp_write_callback, sctp);
+    os_assert(sctp->poll.write);
 }
 
 PRIVATE void sctp_write_callback(short when, os_socket_t fd, void *data)
 {
     os_sctp_sock_t *sctp = data;
-    os_buf_t *buf = NULL;
 
     os_assert(sctp);
-    if (os_list_empty(&sctp->write_queue) == true) {
-        os_assert(sctp->poll.write);
+    os_assert(sctp->poll.write);
+
+    if (sctp_write_flush(sctp) == OS_DONE) {
         os_pollset_remove(sctp->poll.write);
         sctp->poll.write = NULL;
-        return;
     }
-
-    buf = os_list_first(&sctp->write_queue);
-    os_assert(buf);
-    os_list_remove(&sctp->write_queue, buf);
-
-    os_assert(sctp->sock);
-    os_sctp_senddata(sctp->sock, buf, NULL);
 }
 
 void os_sctp_flush_and_destroy(os_sctp_sock_t *sctp)
 {
     os_buf_t *buf = NULL, *next_buf = NULL;
+    unsigned int i;
 
     os_assert(sctp);
 
@@ -163,9 +503,268 @@ void os_sctp_flush_and_destroy(os_sctp_sock_t *sctp)
 
         os_sctp_destroy(sctp->sock);
 
-        os_list_for_each_safe(&sctp->write_queue, next_buf, buf) {
-            os_list_remove(&sctp->write_queue, buf);
-            os_buf_free(buf);
+        for (i = 0; i < sctp->write.streams; i++) {
+            os_list_for_each_safe(&sctp->write.queue[i], next_buf, buf) {
+                os_list_remove(&sctp->write.queue[i], buf);
+                os_buf_free(buf);
+            }
         }
+        sctp->write.pending = 0;
+    }
+
+    if (sctp->write.queue) {
+        os_free(sctp->write.queue);
+        sctp->write.queue = NULL;
+        sctp->write.streams = 0;
+    }
+}
+
+/*
+ * Association tables.
+ *
+ * Notifications only say which socket they came from, so tables are
+ * kept in a list and found by socket; there is one per listening
+ * socket, so the list stays short. Tables are looked at before the
+ * handlers of os_sctp_notify_register(), which keep every event that
+ * no table takes.
+ */
+struct os_sctp_assoc_table_s {
+    os_lnode_t lnode;
+
+    os_sock_t *sock;
+    os_hash_u32_t *assocs;
+
+    os_sctp_assoc_f handler;
+    void *data;
+};
+
+PRIVATE OS_LIST(sctp_assoc_tables);
+PRIVATE os_rwlock_t sctp_assoc_lock;
+
+PRIVATE os_sctp_assoc_table_t *sctp_assoc_table_of(os_sock_t *sock)
+{
+    os_sctp_assoc_table_t *table = NULL;
+
+    os_list_for_each(&sctp_assoc_tables, table) {
+        if (table->sock == sock)
+            return table;
+    }
+
+    return NULL;
+}
+
+PRIVATE os_sctp_assoc_t *sctp_assoc_add(
+        os_sctp_assoc_table_t *table, uint32_t assoc_id)
+{
+    os_sctp_assoc_t *assoc = NULL;
+
+    assoc = os_calloc(1, sizeof(*assoc));
+    if (!assoc) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+    assoc->id = assoc_id;
+    os_hash_u32_set(table->assocs, assoc_id, assoc);
+
+    return assoc;
+}
+
+PRIVATE void sctp_assoc_remove(
+        os_sctp_assoc_table_t *table, os_sctp_assoc_t *assoc)
+{
+    os_hash_u32_set(table->assocs, assoc->id, NULL);
+    os_free(assoc);
+}
+
+PRIVATE void sctp_assoc_event(os_sctp_assoc_table_t *table,
+        os_sctp_assoc_t *assoc, os_sctp_assoc_event_e event)
+{
+    if (table->handler)
+        table->handler(table, assoc, event, table->data);
+}
+
+PRIVATE void sctp_assoc_change(os_sctp_assoc_table_t *table,
+        const struct sctp_assoc_change *change)
+{
+    os_sctp_assoc_t *assoc = NULL;
+
+    assoc = os_hash_u32_get(table->assocs, change->sac_assoc_id);
+
+    switch (change->sac_state) {
+    case SCTP_COMM_UP:
+    case SCTP_RESTART:
+        if (!assoc)
+            assoc = sctp_assoc_add(table, change->sac_assoc_id);
+        if (!assoc)
+            break;
+        assoc->inbound_streams = change->sac_inbound_streams;
+        assoc->outbound_streams = change->sac_outbound_streams;
+        sctp_assoc_event(table, assoc, OS_SCTP_ASSOC_UP);
+        break;
+    case SCTP_COMM_LOST:
+    case SCTP_SHUTDOWN_COMP:
+    case SCTP_CANT_STR_ASSOC:
+        if (!assoc)
+            break;
+        sctp_assoc_event(table, assoc, OS_SCTP_ASSOC_DOWN);
+        sctp_assoc_remove(table, assoc);
+        break;
+    default:
+        break;
+    }
+}
+
+PRIVATE void sctp_assoc_paddr_change(os_sctp_assoc_table_t *table,
+        const struct sctp_paddr_change *change)
+{
+    os_sctp_assoc_t *assoc = NULL;
+
+    assoc = os_hash_u32_get(table->assocs, change->spc_assoc_id);
+    if (!assoc)
+        return;
+
+    assoc->stat.addr_changes++;
+    if (change->spc_state == SCTP_ADDR_MADE_PRIM) {
+        memset(&assoc->addr, 0, sizeof(assoc->addr));
+        memcpy(&assoc->addr.ss, &change->spc_aaddr, sizeof(assoc->addr.ss));
+    }
+    sctp_assoc_event(table, assoc, OS_SCTP_ASSOC_ADDR);
+}
+
+/*
+ * Returns whether a table took the event. The table itself is only
+ * used by the thread reading its socket, so the lock covers the lookup.
+ */
+PRIVATE bool sctp_assoc_notify(os_sock_t *sock,
+        const union sctp_notification *not)
+{
+    os_sctp_assoc_table_t *table = NULL;
+    uint16_t type = not->sn_header.sn_type;
+
+    if (type != SCTP_ASSOC_CHANGE && type != SCTP_PEER_ADDR_CHANGE)
+        return false;
+
+    os_rwlock_rdlock(&sctp_assoc_lock);
+    table = sctp_assoc_table_of(sock);
+    os_rwlock_rdunlock(&sctp_assoc_lock);
+
+    if (!table)
+        return false;
+
+    if (type == SCTP_ASSOC_CHANGE)
+        sctp_assoc_change(table, &not->sn_assoc_change);
+    else
+        sctp_assoc_paddr_change(table, &not->sn_paddr_change);
+
+    return true;
+}
+
+os_sctp_assoc_table_t *os_sctp_assoc_table_create(
+        os_sock_t *sock, os_sctp_assoc_f handler, void *data)
+{
+    os_sctp_assoc_table_t *table = NULL;
+
+    os_assert(sock);
+
+    table = os_calloc(1, sizeof(*table));
+    if (!table) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    table->assocs = os_hash_u32_make();
+    if (!table->assocs) {
+        os_free(table);
+        return NULL;
+    }
+    table->sock = sock;
+    table->handler = handler;
+    table->data = data;
+
+    os_rwlock_wrlock(&sctp_assoc_lock);
+    os_assert(!sctp_assoc_table_of(sock));
+    os_list_add(&sctp_assoc_tables, table);
+    os_rwlock_wrunlock(&sctp_assoc_lock);
+
+    return table;
+}
+
+void os_sctp_assoc_table_destroy(os_sctp_assoc_table_t *table)
+{
+    os_hash_u32_index_t *hi = NULL;
+
+    os_assert(table);
+
+    os_rwlock_wrlock(&sctp_assoc_lock);
+    os_list_remove(&sctp_assoc_tables, table);
+    os_rwlock_wrunlock(&sctp_assoc_lock);
+
+    for (hi = os_hash_u32_first(table->assocs); hi;
+            hi = os_hash_u32_next(hi))
+        os_free(os_hash_u32_this_val(hi));
+    os_hash_u32_destroy(table->assocs);
+
+    os_free(table);
+}
+
+unsigned int os_sctp_assoc_count(os_sctp_assoc_table_t *table)
+{
+    os_assert(table);
+    return os_hash_u32_count(table->assocs);
+}
+
+os_sctp_assoc_t *os_sctp_assoc_find(
+        os_sctp_assoc_table_t *table, uint32_t assoc_id)
+{
+    os_assert(table);
+    return os_hash_u32_get(table->assocs, assoc_id);
+}
+
+os_sctp_assoc_t *os_sctp_assoc_rx(os_sctp_assoc_table_t *table,
+        const os_sctp_info_t *sinfo, const os_sockaddr_t *from,
+        unsigned int len)
+{
+    os_sctp_assoc_t *assoc = NULL;
+
+    os_assert(table);
+    os_assert(sinfo);
+
+    assoc = os_hash_u32_get(table->assocs, sinfo->assoc_id);
+    if (os_unlikely(!assoc)) {
+        /*
+         * data raced ahead of COMM_UP, or the table came late; received
+         * messages do not carry the stream counts, so ask the socket
+         */
+        assoc = sctp_assoc_add(table, sinfo->assoc_id);
+        if (!assoc)
+            return NULL;
+        os_sctp_assoc_streams(table->sock, sinfo->assoc_id,
+                &assoc->inbound_streams, &assoc->outbound_streams);
     }
+
+    if (os_unlikely(!assoc->addr.os_sa_family) && from)
+        memcpy(&assoc->addr.ss, &from->ss, sizeof(assoc->addr.ss));
+
+    assoc->stat.rx_msgs++;
+    assoc->stat.rx_bytes += len;
+
+    return assoc;
+}
+
+os_sock_t *os_sctp_assoc_peeloff(os_sctp_assoc_table_t *table,
+        os_sctp_assoc_t *assoc)
+{
+    os_sock_t *sock = NULL;
+
+    os_assert(table);
+    os_assert(assoc);
+
+    sock = os_sctp_peeloff(table->sock, assoc->id);
+    if (!sock)
+        return NULL;
+
+    /* its notifications now arrive on the new socket */
+    sctp_assoc_remove(table, assoc);
+
+    return sock;
 }
@@ -160,8 +160,10 @@ PRIVATE int select_process(os_pollset_t *pollset, os_time_t timeout)
         tp = &tv;
     }
 
+    os_rcu_thread_offline();
     rc = select(context->max_fd + 1,
             &context->work_read_fd_set, &context->work_write_fd_set, NULL, tp);
+    os_rcu_thread_online();
     if (rc < 0) {
         os_logsp(ERROR, ERRNOID, os_socket_errno, "select() failed");
         return OS_ERROR;
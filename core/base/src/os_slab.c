@@ -0,0 +1,520 @@
+/************************************************************************
+ *File name: os_slab.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#include "system_config.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "os_init.h"
+
+#define SLAB_MAGIC          0x5AB5
+#define SLAB_LARGE          0xFFFF
+#define SLAB_SPAN_SIZE      (64*1024)
+#define SLAB_SPAN_MIN_OBJS  16
+#define SLAB_BATCH          32
+#define SLAB_CACHE_MAX      (SLAB_BATCH * 2)
+
+/* 16 bytes in front of every block */
+typedef struct slab_hdr_s {
+    const char *file_line;  /* NULL while the block is free */
+    uint32_t size;          /* requested size */
+    uint16_t cls;           /* size class or SLAB_LARGE */
+    uint16_t magic;
+} slab_hdr_t;
+
+OS_STATIC_ASSERT(sizeof(slab_hdr_t) == 16);
+
+/* large blocks are mapped individually and linked for the leak report */
+typedef struct slab_large_s {
+    struct slab_large_s *prev, *next;
+    size_t map_size;
+    size_t pad;
+    slab_hdr_t hdr;
+} slab_large_t;
+
+typedef struct slab_span_s {
+    struct slab_span_s *next;
+    unsigned char *base;
+    size_t map_size;
+    unsigned int nobj;
+} slab_span_t;
+
+typedef struct slab_free_s {
+    struct slab_free_s *next;
+} slab_free_t;
+
+typedef struct slab_class_s {
+    os_thread_mutex_t mutex;
+    unsigned int size;      /* payload size */
+    unsigned int unit;      /* header + payload */
+    slab_free_t *free;
+    unsigned int nfree;
+    slab_span_t *span;
+    unsigned int nspan;
+    unsigned int total;
+} OS_CACHELINE_ALIGNED slab_class_t;
+
+/* 16..128 step 16, then 4 classes per power of two up to 4096 */
+PRIVATE const unsigned int class_size[] = {
+      16,   32,   48,   64,   80,   96,  112,  128,
+     160,  192,  224,  256,  320,  384,  448,  512,
+     640,  768,  896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096,
+};
+#define SLAB_NCLASS OS_ARRAY_SIZE(class_size)
+
+OS_STATIC_ASSERT(OS_SLAB_MAX_SIZE == 4096);
+
+typedef struct slab_tcache_s {
+    slab_free_t *head[SLAB_NCLASS];
+    unsigned int count[SLAB_NCLASS];
+} slab_tcache_t;
+
+PRIVATE slab_class_t slab_class[SLAB_NCLASS];
+PRIVATE uint8_t size_to_class[OS_SLAB_MAX_SIZE / 16 + 1];
+
+PRIVATE os_thread_mutex_t large_mutex;
+PRIVATE slab_large_t *large_list = NULL;
+PRIVATE unsigned int large_count = 0;
+
+PRIVATE int tcache_slot = OS_ERROR;  /* os_thread_ctx_t slot */
+/*
+ * Thread caches still alive. os_slab_final() leaves the spans mapped
+ * while other threads hold blocks in theirs; the last one to go
+ * releases them.
+ */
+PRIVATE unsigned int tcache_live = 0;
+PRIVATE unsigned int slab_release_pending = 0;
+PRIVATE pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+PRIVATE void slab_tcache_destroy(void *arg);
+PRIVATE void slab_release_if_last(void);
+
+PRIVATE void slab_setup(void)
+{
+    unsigned int i, c;
+
+    for (i = 0, c = 0; i <= OS_SLAB_MAX_SIZE / 16; i++) {
+        while (class_size[c] < i * 16)
+            c++;
+        size_to_class[i] = c;
+    }
+
+    for (c = 0; c < SLAB_NCLASS; c++) {
+        memset(&slab_class[c], 0, sizeof(slab_class[c]));
+        os_thread_mutex_init(&slab_class[c].mutex);
+        slab_class[c].size = class_size[c];
+        slab_class[c].unit = class_size[c] + sizeof(slab_hdr_t);
+    }
+
+    os_thread_mutex_init(&large_mutex);
+    tcache_slot = os_thread_slot_register(slab_tcache_destroy);
+    os_assert(tcache_slot >= 0);
+}
+
+void os_slab_init(void)
+{
+    pthread_once(&slab_once, slab_setup);
+}
+
+PRIVATE os_inline unsigned int slab_class_of(size_t size)
+{
+    return size_to_class[(size + 15) >> 4];
+}
+
+PRIVATE slab_tcache_t *slab_tcache_create(void)
+{
+    slab_tcache_t *cache = NULL;
+
+    os_slab_init();
+
+    cache = calloc(1, sizeof(*cache));
+    os_assert(cache);
+    os_atomic_inc(&tcache_live);
+    os_thread_slot_set(tcache_slot, cache);
+
+    return cache;
+}
+
+PRIVATE os_inline slab_tcache_t *slab_tcache(void)
+{
+    slab_tcache_t *cache = NULL;
+
+    if (os_likely(tcache_slot >= 0))
+        cache = os_thread_slot_get(tcache_slot);
+    if (os_unlikely(!cache))
+        cache = slab_tcache_create();
+
+    return cache;
+}
+
+/* carve a new span, called with the class mutex held */
+PRIVATE int slab_span_grow(slab_class_t *sc)
+{
+    slab_span_t *span = NULL;
+    size_t map_size;
+    unsigned int i;
+
+    map_size = SLAB_SPAN_SIZE;
+    if (map_size < (size_t)sc->unit * SLAB_SPAN_MIN_OBJS)
+        map_size = (size_t)sc->unit * SLAB_SPAN_MIN_OBJS;
+
+    span = malloc(sizeof(*span));
+    if (!span) {
+        os_log(ERROR, "malloc() failed");
+        return OS_ERROR;
+    }
+
+    span->base = mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (span->base == MAP_FAILED) {
+        os_logsp(ERROR, ERRNOID, os_errno, "mmap(%d) failed", (int)map_size);
+        free(span);
+        return OS_ERROR;
+    }
+    span->map_size = map_size;
+    span->nobj = map_size / sc->unit;
+
+    for (i = span->nobj; i > 0; i--) {
+        slab_hdr_t *hdr = (slab_hdr_t *)(span->base + (i - 1) * sc->unit);
+        slab_free_t *blk = (slab_free_t *)(hdr + 1);
+
+        hdr->file_line = NULL;
+        hdr->cls = sc - slab_class;
+        hdr->magic = SLAB_MAGIC;
+
+        blk->next = sc->free;
+        sc->free = blk;
+    }
+    sc->nfree += span->nobj;
+    sc->total += span->nobj;
+
+    span->next = sc->span;
+    sc->span = span;
+    sc->nspan++;
+
+    return OS_OK;
+}
+
+PRIVATE slab_free_t *slab_refill(slab_tcache_t *cache, unsigned int c)
+{
+    slab_class_t *sc = &slab_class[c];
+    slab_free_t *blk = NULL;
+    unsigned int n;
+
+    os_thread_mutex_lock(&sc->mutex);
+
+    if (!sc->free && slab_span_grow(sc) != OS_OK) {
+        os_thread_mutex_unlock(&sc->mutex);
+        return NULL;
+    }
+
+    /* first block is returned, the rest of the batch goes to the cache */
+    blk = sc->free;
+    sc->free = blk->next;
+    sc->nfree--;
+
+    for (n = 1; n < SLAB_BATCH && sc->free; n++) {
+        slab_free_t *next = sc->free->next;
+
+        sc->free->next = cache->head[c];
+        cache->head[c] = sc->free;
+        cache->count[c]++;
+
+        sc->free = next;
+        sc->nfree--;
+    }
+
+    os_thread_mutex_unlock(&sc->mutex);
+
+    return blk;
+}
+
+PRIVATE void slab_flush(slab_tcache_t *cache, unsigned int c, unsigned int n)
+{
+    slab_class_t *sc = &slab_class[c];
+    slab_free_t *first = NULL, *last = NULL;
+    unsigned int i;
+
+    if (!n)
+        return;
+
+    first = last = cache->head[c];
+    for (i = 1; i < n; i++)
+        last = last->next;
+
+    cache->head[c] = last->next;
+    cache->count[c] -= n;
+
+    os_thread_mutex_lock(&sc->mutex);
+    last->next = sc->free;
+    sc->free = first;
+    sc->nfree += n;
+    os_thread_mutex_unlock(&sc->mutex);
+}
+
+PRIVATE void slab_tcache_destroy(void *arg)
+{
+    slab_tcache_t *cache = arg;
+    unsigned int c;
+
+    if (!cache)
+        return;
+
+    for (c = 0; c < SLAB_NCLASS; c++)
+        slab_flush(cache, c, cache->count[c]);
+
+    free(cache);
+
+    os_atomic_dec(&tcache_live);
+    slab_release_if_last();
+}
+
+void os_slab_thread_flush(void)
+{
+    slab_tcache_t *cache = NULL;
+    unsigned int c;
+
+    if (tcache_slot >= 0)
+        cache = os_thread_slot_get(tcache_slot);
+    if (!cache)
+        return;
+
+    for (c = 0; c < SLAB_NCLASS; c++)
+        slab_flush(cache, c, cache->count[c]);
+}
+
+PRIVATE void *slab_large_alloc(size_t size, const char *file_line)
+{
+    slab_large_t *large = NULL;
+    size_t map_size;
+
+    map_size = sizeof(*large) + size;
+    large = mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (large == MAP_FAILED) {
+        os_logsp(ERROR, ERRNOID, os_errno, "mmap(%d) failed", (int)map_size);
+        return NULL;
+    }
+
+    large->map_size = map_size;
+    large->hdr.file_line = file_line;
+    large->hdr.size = size;
+    large->hdr.cls = SLAB_LARGE;
+    large->hdr.magic = SLAB_MAGIC;
+
+    os_thread_mutex_lock(&large_mutex);
+    large->prev = NULL;
+    large->next = large_list;
+    if (large_list)
+        large_list->prev = large;
+    large_list = large;
+    large_count++;
+    os_thread_mutex_unlock(&large_mutex);
+
+    return &large->hdr + 1;
+}
+
+PRIVATE void slab_large_free(slab_hdr_t *hdr)
+{
+    slab_large_t *large = os_container_of(hdr, slab_large_t, hdr);
+
+    os_thread_mutex_lock(&large_mutex);
+    if (large->prev)
+        large->prev->next = large->next;
+    else
+        large_list = large->next;
+    if (large->next)
+        large->next->prev = large->prev;
+    large_count--;
+    os_thread_mutex_unlock(&large_mutex);
+
+    munmap(large, large->map_size);
+}
+
+void *os_slab_alloc(size_t size, const char *file_line)
+{
+    slab_tcache_t *cache = NULL;
+    slab_free_t *blk = NULL;
+    slab_hdr_t *hdr = NULL;
+    unsigned int c;
+
+    if (size > OS_SLAB_MAX_SIZE)
+        return slab_large_alloc(size, file_line);
+
+    cache = slab_tcache();
+
+    c = slab_class_of(size);
+    blk = cache->head[c];
+    if (os_likely(blk)) {
+        cache->head[c] = blk->next;
+        cache->count[c]--;
+    } else {
+        blk = slab_refill(cache, c);
+        if (!blk) {
+            os_log(ERROR, "os_slab_alloc() failed [size=%d]", (int)size);
+            return NULL;
+        }
+    }
+
+    hdr = (slab_hdr_t *)blk - 1;
+    hdr->file_line = file_line;
+    hdr->size = size;
+
+    return blk;
+}
+
+void os_slab_free(void *ptr)
+{
+    slab_tcache_t *cache = NULL;
+    slab_free_t *blk = ptr;
+    slab_hdr_t *hdr = NULL;
+    unsigned int c;
+
+    os_assert(ptr);
+
+    hdr = (slab_hdr_t *)ptr - 1;
+    os_assert(hdr->magic == SLAB_MAGIC);
+    os_assert(hdr->file_line);
+
+    if (hdr->cls == SLAB_LARGE) {
+        slab_large_free(hdr);
+        return;
+    }
+
+    cache = slab_tcache();
+
+    c = hdr->cls;
+    os_assert(c < SLAB_NCLASS);
+    hdr->file_line = NULL;
+
+    blk->next = cache->head[c];
+    cache->head[c] = blk;
+    if (os_unlikely(++cache->count[c] > SLAB_CACHE_MAX))
+        slab_flush(cache, c, SLAB_BATCH);
+}
+
+size_t os_slab_size(const void *ptr)
+{
+    const slab_hdr_t *hdr = NULL;
+
+    os_assert(ptr);
+    hdr = (const slab_hdr_t *)ptr - 1;
+    os_assert(hdr->magic == SLAB_MAGIC);
+
+    return hdr->size;
+}
+
+bool os_slab_resize(void *ptr, size_t size)
+{
+    slab_hdr_t *hdr = NULL;
+    slab_large_t *large = NULL;
+
+    os_assert(ptr);
+    hdr = (slab_hdr_t *)ptr - 1;
+    os_assert(hdr->magic == SLAB_MAGIC);
+
+    if (hdr->cls == SLAB_LARGE) {
+        large = os_container_of(hdr, slab_large_t, hdr);
+        if (size <= OS_SLAB_MAX_SIZE || sizeof(*large) + size > large->map_size)
+            return false;
+    } else if (size > OS_SLAB_MAX_SIZE || slab_class_of(size) != hdr->cls) {
+        return false;
+    }
+
+    hdr->size = size;
+    return true;
+}
+
+PRIVATE void slab_release(void)
+{
+    slab_large_t *large = NULL, *next_large = NULL;
+    unsigned int c, i, leak = 0;
+
+    for (c = 0; c < SLAB_NCLASS; c++) {
+        slab_class_t *sc = &slab_class[c];
+        slab_span_t *span = NULL, *next_span = NULL;
+
+        os_thread_mutex_lock(&sc->mutex);
+        for (span = sc->span; span; span = next_span) {
+            next_span = span->next;
+
+            for (i = 0; i < span->nobj; i++) {
+                slab_hdr_t *hdr = (slab_hdr_t *)(span->base + i * sc->unit);
+                if (hdr->file_line) {
+                    os_log(ERROR, "SIZE[%d] is not freed. (%s)",
+                            hdr->size, hdr->file_line);
+                    leak++;
+                }
+            }
+
+            munmap(span->base, span->map_size);
+            free(span);
+        }
+        sc->span = NULL;
+        sc->free = NULL;
+        sc->nspan = sc->nfree = sc->total = 0;
+        os_thread_mutex_unlock(&sc->mutex);
+    }
+
+    os_thread_mutex_lock(&large_mutex);
+    for (large = large_list; large; large = next_large) {
+        next_large = large->next;
+        os_log(ERROR, "SIZE[%d] is not freed. (%s)",
+                large->hdr.size, large->hdr.file_line);
+        leak++;
+        munmap(large, large->map_size);
+    }
+    large_list = NULL;
+    large_count = 0;
+    os_thread_mutex_unlock(&large_mutex);
+
+    if (leak)
+        os_log(ERROR, "%d in 'os_slab' were not released", leak);
+}
+
+PRIVATE void slab_release_if_last(void)
+{
+    unsigned int pending = 1;
+
+    os_atomic_thread_fence();
+    if (os_atomic_load(&tcache_live) == 0 &&
+            os_atomic_cas(&slab_release_pending, &pending, 0))
+        slab_release();
+}
+
+void os_slab_final(void)
+{
+    slab_tcache_t *cache = NULL;
+
+    if (tcache_slot >= 0)
+        cache = os_thread_slot_get(tcache_slot);
+    if (cache) {
+        os_thread_slot_set(tcache_slot, NULL);
+        slab_tcache_destroy(cache);
+    }
+
+    os_atomic_store(&slab_release_pending, 1);
+    slab_release_if_last();
+}
+
+void os_slab_show_avail(void)
+{
+    unsigned int c;
+
+    for (c = 0; c < SLAB_NCLASS; c++) {
+        slab_class_t *sc = &slab_class[c];
+
+        if (!sc->nspan)
+            continue;
+        fprintf(stderr, "OS_SLAB_%-4d   span[%d], size[%d], central avail[%d]!\n",
+                sc->size, sc->nspan, sc->total, sc->nfree);
+    }
+    fprintf(stderr, "OS_SLAB_LARGE  size[%d]!\n", large_count);
+}
@@ -433,6 +433,62 @@ bool os_sockaddr_is_equal(const void *p, const void *q)
     }
 }
 
+PRIVATE uint64_t sockaddr_map_hash(const void *key, uint64_t seed)
+{
+    return os_sockaddr_key_hash(key, seed);
+}
+
+os_sockaddr_map_t *os_sockaddr_map_make(void)
+{
+    return os_flat_hash_make_custom(
+            sizeof(os_sockaddr_key_t), sizeof(void *), sockaddr_map_hash);
+}
+
+void os_sockaddr_map_destroy(os_sockaddr_map_t *map)
+{
+    os_flat_hash_destroy(map);
+}
+
+void os_sockaddr_map_set(os_sockaddr_map_t *map, const void *sa, void *obj)
+{
+    os_sockaddr_key_t key;
+
+    os_assert(map);
+    os_assert(sa);
+
+    os_sockaddr_key(&key, sa);
+    if (obj)
+        os_flat_hash_set(map, &key, &obj);
+    else
+        os_flat_hash_remove(map, &key);
+}
+
+void *os_sockaddr_map_get_key(os_sockaddr_map_t *map, const os_sockaddr_key_t *key)
+{
+    void **obj = NULL;
+
+    os_assert(map);
+    os_assert(key);
+
+    obj = os_flat_hash_get(map, key);
+    return obj ? *obj : NULL;
+}
+
+void *os_sockaddr_map_get(os_sockaddr_map_t *map, const void *sa)
+{
+    os_sockaddr_key_t key;
+
+    os_assert(sa);
+
+    os_sockaddr_key(&key, sa);
+    return os_sockaddr_map_get_key(map, &key);
+}
+
+unsigned int os_sockaddr_map_count(os_sockaddr_map_t *map)
+{
+    return os_flat_hash_count(map);
+}
+
 PRIVATE int parse_network(os_ipsubnet_t *ipsub, const char *network)
 {
     /* legacy syntax for ip addrs: a.b.c. ==> a.b.c.0/24 for example */
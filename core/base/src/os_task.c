@@ -0,0 +1,563 @@
+/************************************************************************
+ *File name: os_task.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+
+#include "os_init.h"
+
+#define TASK_DEQUE_SIZE     256     /* initial, doubles when full */
+#define TASK_SPIN           64      /* failed rounds before sleeping */
+#define TASK_MAP_SPLIT      8       /* map chunks per worker */
+
+typedef struct task_s {
+    struct task_s *next;            /* injection queue */
+    os_task_fn_f fn;
+    void *data;
+    os_task_group_t *group;
+} task_t;
+
+typedef struct deque_array_s {
+    struct deque_array_s *prev;     /* outgrown, freed with the deque */
+    int64_t mask;
+    task_t *buf[];
+} deque_array_t;
+
+/*
+ * Chase-Lev deque, in the C11 formulation of Le, Pop, Cohen and
+ * Zappa Nardelli. Only the owner touches bottom; thieves race on top.
+ */
+typedef struct task_deque_s {
+    int64_t top OS_CACHELINE_ALIGNED;
+    int64_t bottom OS_CACHELINE_ALIGNED;
+    deque_array_t *array;
+} task_deque_t;
+
+typedef struct task_worker_s {
+    task_deque_t deque;
+    os_task_sched_t *sched;
+    int index;
+    uint32_t seed;
+} OS_CACHELINE_ALIGNED task_worker_t;
+
+struct os_task_sched_s {
+    task_worker_t *workers;
+    int nworkers;
+    os_thread_pool_t *pool;
+    int stopping;
+
+    /* injection queue for tasks spawned outside the workers */
+    os_thread_mutex_t inject_mutex;
+    task_t *inject_head, *inject_tail;
+    unsigned int injected;
+
+    /* idle workers, same handshake as the thread pool */
+    os_thread_mutex_t idle_mutex;
+    os_thread_cond_t idle_cond;
+    unsigned int sleepers;
+
+    /* groups waited on from outside the workers */
+    os_thread_mutex_t done_mutex;
+    os_thread_cond_t done_cond;
+};
+
+PRIVATE __thread task_worker_t *task_self = NULL;
+
+PRIVATE deque_array_t *deque_array_alloc(int64_t size)
+{
+    deque_array_t *a;
+
+    a = malloc(sizeof(*a) + size * sizeof(task_t *));
+    os_assert(a);
+    a->prev = NULL;
+    a->mask = size - 1;
+
+    return a;
+}
+
+PRIVATE void deque_init(task_deque_t *d)
+{
+    d->top = 0;
+    d->bottom = 0;
+    d->array = deque_array_alloc(TASK_DEQUE_SIZE);
+}
+
+PRIVATE void deque_final(task_deque_t *d)
+{
+    deque_array_t *a, *prev;
+
+    for (a = d->array; a; a = prev) {
+        prev = a->prev;
+        free(a);
+    }
+}
+
+/*
+ * Thieves may still be reading the old array, so it is kept until the
+ * deque goes away. Growth is geometric: at most log2(n) arrays linger.
+ */
+PRIVATE deque_array_t *deque_grow(task_deque_t *d,
+        deque_array_t *a, int64_t top, int64_t bottom)
+{
+    deque_array_t *na;
+    int64_t i;
+
+    na = deque_array_alloc((a->mask + 1) * 2);
+    for (i = top; i < bottom; i++)
+        na->buf[i & na->mask] = os_atomic_load_relaxed(&a->buf[i & a->mask]);
+    na->prev = a;
+    os_atomic_store(&d->array, na);
+
+    return na;
+}
+
+PRIVATE void deque_push(task_deque_t *d, task_t *task)
+{
+    deque_array_t *a;
+    int64_t b, t;
+
+    b = os_atomic_load_relaxed(&d->bottom);
+    t = os_atomic_load(&d->top);
+    a = os_atomic_load_relaxed(&d->array);
+    if (b - t > a->mask)
+        a = deque_grow(d, a, t, b);
+
+    os_atomic_store_relaxed(&a->buf[b & a->mask], task);
+    __atomic_thread_fence(OS_MO_RELEASE);
+    os_atomic_store_relaxed(&d->bottom, b + 1);
+}
+
+PRIVATE task_t *deque_take(task_deque_t *d)
+{
+    deque_array_t *a;
+    task_t *task;
+    int64_t b, t;
+
+    b = os_atomic_load_relaxed(&d->bottom) - 1;
+    a = os_atomic_load_relaxed(&d->array);
+    os_atomic_store_relaxed(&d->bottom, b);
+    os_atomic_thread_fence();
+    t = os_atomic_load_relaxed(&d->top);
+
+    if (t > b) {
+        os_atomic_store_relaxed(&d->bottom, b + 1);
+        return NULL;
+    }
+
+    task = os_atomic_load_relaxed(&a->buf[b & a->mask]);
+    if (t == b) {
+        /* last one, race the thieves for it */
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                    OS_MO_SEQ_CST, OS_MO_RELAXED))
+            task = NULL;
+        os_atomic_store_relaxed(&d->bottom, b + 1);
+    }
+
+    return task;
+}
+
+PRIVATE task_t *deque_steal(task_deque_t *d)
+{
+    deque_array_t *a;
+    task_t *task;
+    int64_t b, t;
+
+    t = os_atomic_load(&d->top);
+    os_atomic_thread_fence();
+    b = os_atomic_load(&d->bottom);
+    if (t >= b)
+        return NULL;
+
+    a = os_atomic_load(&d->array);
+    task = os_atomic_load_relaxed(&a->buf[t & a->mask]);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                OS_MO_SEQ_CST, OS_MO_RELAXED))
+        return NULL;
+
+    return task;
+}
+
+PRIVATE int deque_empty(task_deque_t *d)
+{
+    return os_atomic_load(&d->top) >= os_atomic_load(&d->bottom);
+}
+
+PRIVATE void inject_push(os_task_sched_t *sched, task_t *task)
+{
+    task->next = NULL;
+
+    os_thread_mutex_lock(&sched->inject_mutex);
+    if (sched->inject_tail)
+        sched->inject_tail->next = task;
+    else
+        sched->inject_head = task;
+    sched->inject_tail = task;
+    os_atomic_inc(&sched->injected);
+    os_thread_mutex_unlock(&sched->inject_mutex);
+}
+
+PRIVATE task_t *inject_pop(os_task_sched_t *sched)
+{
+    task_t *task;
+
+    if (!os_atomic_load(&sched->injected))
+        return NULL;
+
+    os_thread_mutex_lock(&sched->inject_mutex);
+    task = sched->inject_head;
+    if (task) {
+        sched->inject_head = task->next;
+        if (!sched->inject_head)
+            sched->inject_tail = NULL;
+        os_atomic_dec(&sched->injected);
+    }
+    os_thread_mutex_unlock(&sched->inject_mutex);
+
+    return task;
+}
+
+PRIVATE uint32_t worker_random(task_worker_t *w)
+{
+    /* xorshift32 */
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    return w->seed;
+}
+
+PRIVATE task_t *worker_find(task_worker_t *w)
+{
+    os_task_sched_t *sched = w->sched;
+    task_t *task;
+    int i, n, victim;
+
+    task = deque_take(&w->deque);
+    if (task)
+        return task;
+
+    task = inject_pop(sched);
+    if (task)
+        return task;
+
+    n = sched->nworkers;
+    victim = worker_random(w) % n;
+    for (i = 0; i < n; i++, victim = (victim + 1) % n) {
+        if (victim == w->index)
+            continue;
+        task = deque_steal(&sched->workers[victim].deque);
+        if (task)
+            return task;
+    }
+
+    return NULL;
+}
+
+PRIVATE int sched_has_work(os_task_sched_t *sched)
+{
+    int i;
+
+    if (os_atomic_load(&sched->injected))
+        return 1;
+    for (i = 0; i < sched->nworkers; i++)
+        if (!deque_empty(&sched->workers[i].deque))
+            return 1;
+
+    return 0;
+}
+
+PRIVATE void task_run(os_task_sched_t *sched, task_t *task)
+{
+    os_task_group_t *group = task->group;
+
+    task->fn(task->data);
+    os_free(task);
+
+    /*
+     * The group may be gone as soon as pending hits zero, so it is not
+     * touched afterwards; outside waiters are woken unconditionally.
+     */
+    if (os_atomic_dec(&group->pending) == 0) {
+        os_thread_mutex_lock(&sched->done_mutex);
+        os_thread_cond_broadcast(&sched->done_cond);
+        os_thread_mutex_unlock(&sched->done_mutex);
+    }
+}
+
+PRIVATE void worker_main(void *arg)
+{
+    task_worker_t *w = arg;
+    os_task_sched_t *sched = w->sched;
+    task_t *task;
+    int spins = 0;
+
+    task_self = w;
+
+    while (!os_atomic_load(&sched->stopping)) {
+        task = worker_find(w);
+        if (task) {
+            task_run(sched, task);
+            spins = 0;
+            continue;
+        }
+
+        if (++spins < TASK_SPIN) {
+            os_cpu_relax();
+            continue;
+        }
+        spins = 0;
+
+        os_thread_mutex_lock(&sched->idle_mutex);
+        os_atomic_inc(&sched->sleepers);
+        os_atomic_thread_fence();
+        if (!sched_has_work(sched) && !sched->stopping)
+            os_thread_cond_wait(&sched->idle_cond, &sched->idle_mutex);
+        os_atomic_dec(&sched->sleepers);
+        os_thread_mutex_unlock(&sched->idle_mutex);
+    }
+
+    task_self = NULL;
+}
+
+os_task_sched_t *os_task_sched_create(const os_thread_attr_t *attr, int threads)
+{
+    os_task_sched_t *sched;
+    os_thread_attr_t wattr;
+    int i;
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0)
+            threads = 1;
+    }
+
+    sched = os_calloc(1, sizeof(*sched));
+    if (!sched) {
+        os_log(ERROR, "os_calloc() failed");
+        return NULL;
+    }
+
+    sched->workers = aligned_alloc(OS_CACHELINE_SIZE,
+            threads * sizeof(task_worker_t));
+    if (!sched->workers) {
+        os_log(ERROR, "aligned_alloc() failed");
+        os_free(sched);
+        return NULL;
+    }
+    memset(sched->workers, 0, threads * sizeof(task_worker_t));
+    sched->nworkers = threads;
+
+    for (i = 0; i < threads; i++) {
+        task_worker_t *w = &sched->workers[i];
+
+        deque_init(&w->deque);
+        w->sched = sched;
+        w->index = i;
+        w->seed = 0x9e3779b9u * (i + 1);
+    }
+
+    os_thread_mutex_init(&sched->inject_mutex);
+    os_thread_mutex_init(&sched->idle_mutex);
+    os_thread_cond_init(&sched->idle_cond);
+    os_thread_mutex_init(&sched->done_mutex);
+    os_thread_cond_init(&sched->done_cond);
+
+    /* each pool thread runs one worker loop until destroy */
+    if (attr)
+        wattr = *attr;
+    else
+        memset(&wattr, 0, sizeof(wattr));
+    if (!wattr.name)
+        wattr.name = "task";
+
+    sched->pool = os_thread_pool_create(&wattr, threads, threads);
+    if (!sched->pool) {
+        os_task_sched_destroy(sched);
+        return NULL;
+    }
+    for (i = 0; i < threads; i++)
+        os_assert(os_thread_pool_submit(sched->pool,
+                    worker_main, &sched->workers[i]) == OS_OK);
+
+    return sched;
+}
+
+void os_task_sched_destroy(os_task_sched_t *sched)
+{
+    int i;
+
+    os_assert(sched);
+
+    os_thread_mutex_lock(&sched->idle_mutex);
+    os_atomic_store(&sched->stopping, 1);
+    os_thread_cond_broadcast(&sched->idle_cond);
+    os_thread_mutex_unlock(&sched->idle_mutex);
+
+    if (sched->pool)
+        os_thread_pool_destroy(sched->pool);
+
+    os_assert(!sched->inject_head);
+    for (i = 0; i < sched->nworkers; i++)
+        deque_final(&sched->workers[i].deque);
+    free(sched->workers);
+
+    os_thread_cond_destroy(&sched->done_cond);
+    os_thread_mutex_destroy(&sched->done_mutex);
+    os_thread_cond_destroy(&sched->idle_cond);
+    os_thread_mutex_destroy(&sched->idle_mutex);
+    os_thread_mutex_destroy(&sched->inject_mutex);
+
+    os_free(sched);
+}
+
+int os_task_sched_threads(os_task_sched_t *sched)
+{
+    os_assert(sched);
+    return sched->nworkers;
+}
+
+int os_task_spawn(os_task_sched_t *sched,
+        os_task_group_t *group, os_task_fn_f fn, void *data)
+{
+    task_worker_t *w = task_self;
+    task_t *task;
+
+    os_assert(sched);
+    os_assert(group);
+    os_assert(fn);
+
+    task = os_malloc(sizeof(*task));
+    if (!task) {
+        os_log(ERROR, "os_malloc() failed");
+        return OS_ERROR;
+    }
+    task->fn = fn;
+    task->data = data;
+    task->group = group;
+
+    os_atomic_inc(&group->pending);
+
+    if (w && w->sched == sched)
+        deque_push(&w->deque, task);
+    else
+        inject_push(sched, task);
+
+    os_atomic_thread_fence();
+    if (os_atomic_load_relaxed(&sched->sleepers)) {
+        os_thread_mutex_lock(&sched->idle_mutex);
+        os_thread_cond_signal(&sched->idle_cond);
+        os_thread_mutex_unlock(&sched->idle_mutex);
+    }
+
+    return OS_OK;
+}
+
+void os_task_wait(os_task_sched_t *sched, os_task_group_t *group)
+{
+    task_worker_t *w = task_self;
+    task_t *task;
+
+    os_assert(sched);
+    os_assert(group);
+
+    if (w && w->sched == sched) {
+        /* help out rather than block the worker */
+        while (os_atomic_load(&group->pending)) {
+            task = worker_find(w);
+            if (task)
+                task_run(sched, task);
+            else
+                os_cpu_relax();
+        }
+        return;
+    }
+
+    os_thread_mutex_lock(&sched->done_mutex);
+    while (os_atomic_load(&group->pending))
+        os_thread_cond_wait(&sched->done_cond, &sched->done_mutex);
+    os_thread_mutex_unlock(&sched->done_mutex);
+}
+
+typedef struct task_map_s {
+    os_task_sched_t *sched;
+    os_task_group_t group;
+    os_buf_t **in;
+    os_buf_t **out;
+    os_task_buf_f fn;
+    void *data;
+    unsigned int grain;
+} task_map_t;
+
+typedef struct task_range_s {
+    task_map_t *map;
+    unsigned int lo, hi;
+} task_range_t;
+
+PRIVATE void task_map_range(void *data);
+
+/*
+ * Split off the upper half until the range is down to the grain, so
+ * thieves take big chunks and the owner keeps the small ones.
+ */
+PRIVATE void task_map_split(task_map_t *map, unsigned int lo, unsigned int hi)
+{
+    task_range_t *child;
+    unsigned int mid, i;
+
+    while (hi - lo > map->grain) {
+        mid = lo + (hi - lo) / 2;
+        child = os_malloc(sizeof(*child));
+        if (!child)
+            break;
+        child->map = map;
+        child->lo = mid;
+        child->hi = hi;
+        if (os_task_spawn(map->sched,
+                    &map->group, task_map_range, child) != OS_OK) {
+            os_free(child);
+            break;
+        }
+        hi = mid;
+    }
+
+    for (i = lo; i < hi; i++)
+        map->out[i] = map->fn(map->in[i], map->data);
+}
+
+PRIVATE void task_map_range(void *data)
+{
+    task_range_t range = *(task_range_t *)data;
+
+    os_free(data);
+    task_map_split(range.map, range.lo, range.hi);
+}
+
+void os_task_map_buf(os_task_sched_t *sched, os_buf_t *in[], os_buf_t *out[],
+        unsigned int n, os_task_buf_f fn, void *data)
+{
+    task_map_t map;
+
+    os_assert(sched);
+    os_assert(fn);
+
+    if (!n)
+        return;
+    os_assert(in);
+    os_assert(out);
+
+    map.sched = sched;
+    os_task_group_init(&map.group);
+    map.in = in;
+    map.out = out;
+    map.fn = fn;
+    map.data = data;
+    map.grain = n / (sched->nworkers * TASK_MAP_SPLIT);
+    if (!map.grain)
+        map.grain = 1;
+
+    /* the caller takes the first chunk itself */
+    task_map_split(&map, 0, n);
+
+    os_task_wait(sched, &map.group);
+}
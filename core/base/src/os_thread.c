@@ -0,0 +1,669 @@
+/************************************************************************
+ *File name: os_thread.c
+ *Description:
+ *
+ *Current Version:
+ *Author: Created by sjw --- 2024.03
+************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setname_np, pthread_attr_setaffinity_np */
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "os_init.h"
+
+#define THREAD_NAME_LEN 16
+
+#if defined(__linux__)
+int os_futex_wait(uint32_t *addr, uint32_t expected, os_time_t timeout)
+{
+    struct timespec ts, *tsp = NULL;
+    long r;
+
+    if (timeout >= 0) {
+        ts.tv_sec = os_time_sec(timeout);
+        ts.tv_nsec = os_time_usec(timeout) * 1000;
+        tsp = &ts;
+    }
+
+    /* FUTEX_WAIT measures a relative timeout on CLOCK_MONOTONIC */
+    r = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, tsp, NULL, 0);
+    if (r == -1 && errno == ETIMEDOUT)
+        return OS_TIMEUP;
+
+    /* woken, EAGAIN (value already changed) or EINTR */
+    return OS_OK;
+}
+
+int os_futex_wake(uint32_t *addr, int count)
+{
+    long r;
+
+    r = syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+
+    return r < 0 ? 0 : (int)r;
+}
+#endif
+
+/*
+ * seq is bumped under the mutex by every signal. A waiter samples it
+ * before dropping the mutex, so a signal sent in between makes the
+ * futex wait return at once instead of being lost.
+ */
+void os_thread_waitq_init(os_thread_waitq_t *wq)
+{
+    wq->seq = 0;
+    wq->waiters = 0;
+#if !defined(__linux__)
+    os_thread_cond_init(&wq->cond);
+#endif
+}
+
+void os_thread_waitq_destroy(os_thread_waitq_t *wq)
+{
+#if !defined(__linux__)
+    os_thread_cond_destroy(&wq->cond);
+#endif
+    (void)wq;
+}
+
+int os_thread_waitq_wait(os_thread_waitq_t *wq,
+        os_thread_mutex_t *mutex, os_time_t timeout)
+{
+    int rv;
+#if defined(__linux__)
+    uint32_t seq;
+
+    seq = wq->seq;
+    wq->waiters++;
+    os_thread_mutex_unlock(mutex);
+    rv = os_futex_wait(&wq->seq, seq, timeout);
+    os_thread_mutex_lock(mutex);
+    wq->waiters--;
+#else
+    wq->waiters++;
+    if (timeout < 0)
+        rv = os_thread_cond_wait(&wq->cond, mutex) == 0 ? OS_OK : OS_ERROR;
+    else
+        rv = os_thread_cond_timedwait(&wq->cond, mutex, timeout);
+    wq->waiters--;
+#endif
+
+    return rv;
+}
+
+void os_thread_waitq_signal(os_thread_waitq_t *wq)
+{
+    if (!wq->waiters)
+        return;
+#if defined(__linux__)
+    os_atomic_inc(&wq->seq);
+    os_futex_wake(&wq->seq, 1);
+#else
+    os_thread_cond_signal(&wq->cond);
+#endif
+}
+
+void os_thread_waitq_broadcast(os_thread_waitq_t *wq)
+{
+    if (!wq->waiters)
+        return;
+#if defined(__linux__)
+    os_atomic_inc(&wq->seq);
+    os_futex_wake(&wq->seq, INT_MAX);
+#else
+    os_thread_cond_broadcast(&wq->cond);
+#endif
+}
+
+struct os_thread_s {
+    os_thread_id_t id;
+    void (*func)(void *);
+    void *data;
+    char name[THREAD_NAME_LEN];
+
+    os_thread_mutex_t mutex;
+    os_thread_cond_t cond;
+    int done;       /* func has returned */
+    int detached;   /* nobody will join, the thread frees itself */
+};
+
+PRIVATE void thread_free(os_thread_t *thread)
+{
+    os_thread_cond_destroy(&thread->cond);
+    os_thread_mutex_destroy(&thread->mutex);
+    free(thread);
+}
+
+PRIVATE void *thread_main(void *arg)
+{
+    os_thread_t *thread = arg;
+    int detached;
+
+#if defined(__linux__)
+    if (thread->name[0])
+        pthread_setname_np(pthread_self(), thread->name);
+#endif
+
+    os_thread_ctx()->thread = thread;
+
+    thread->func(thread->data);
+
+    os_thread_ctx_exit();
+
+    os_thread_mutex_lock(&thread->mutex);
+    thread->done = 1;
+    detached = thread->detached;
+    if (!detached)
+        os_thread_cond_signal(&thread->cond);
+    os_thread_mutex_unlock(&thread->mutex);
+
+    if (detached)
+        thread_free(thread);
+
+    return NULL;
+}
+
+PRIVATE int thread_attr_init(pthread_attr_t *pattr,
+        const os_thread_attr_t *attr, int realtime)
+{
+    int rv;
+
+    rv = pthread_attr_init(pattr);
+    if (rv != 0)
+        return rv;
+
+    if (attr->stack_size) {
+        rv = pthread_attr_setstacksize(pattr, attr->stack_size);
+        if (rv != 0)
+            goto err;
+    }
+
+#if defined(__linux__)
+    if (attr->cpu_mask) {
+        cpu_set_t set;
+        int cpu;
+
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < 64; cpu++)
+            if (attr->cpu_mask & ((uint64_t)1 << cpu))
+                CPU_SET(cpu, &set);
+        rv = pthread_attr_setaffinity_np(pattr, sizeof(set), &set);
+        if (rv != 0)
+            goto err;
+    }
+#endif
+
+    if (realtime) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = attr->priority;
+        rv = pthread_attr_setinheritsched(pattr, PTHREAD_EXPLICIT_SCHED);
+        if (rv == 0)
+            rv = pthread_attr_setschedpolicy(pattr, SCHED_FIFO);
+        if (rv == 0)
+            rv = pthread_attr_setschedparam(pattr, &param);
+        if (rv != 0)
+            goto err;
+    }
+
+    return 0;
+
+err:
+    pthread_attr_destroy(pattr);
+    return rv;
+}
+
+os_thread_t *os_thread_create(void (*func)(void *), void *data)
+{
+    return os_thread_create_ex(NULL, func, data);
+}
+
+os_thread_t *os_thread_create_ex(const os_thread_attr_t *attr,
+        void (*func)(void *), void *data)
+{
+    os_thread_attr_t defaults;
+    os_thread_t *thread;
+    pthread_attr_t pattr;
+    int realtime, rv;
+
+    os_assert(func);
+
+    if (!attr) {
+        memset(&defaults, 0, sizeof(defaults));
+        attr = &defaults;
+    }
+    realtime = attr->priority > 0;
+
+    thread = calloc(1, sizeof(*thread));
+    if (!thread) {
+        os_log(ERROR, "calloc() failed");
+        return NULL;
+    }
+
+    thread->func = func;
+    thread->data = data;
+    if (attr->name)
+        os_cpystrn(thread->name, attr->name, sizeof(thread->name));
+    os_thread_mutex_init(&thread->mutex);
+    os_thread_cond_init(&thread->cond);
+
+    rv = thread_attr_init(&pattr, attr, realtime);
+    if (rv == 0) {
+        rv = pthread_create(&thread->id, &pattr, thread_main, thread);
+        pthread_attr_destroy(&pattr);
+    }
+
+    if (rv == EPERM && realtime) {
+        os_log(WARN, "thread [%s] SCHED_FIFO %d not permitted, "
+                "using SCHED_OTHER", thread->name, attr->priority);
+        rv = thread_attr_init(&pattr, attr, 0);
+        if (rv == 0) {
+            rv = pthread_create(&thread->id, &pattr, thread_main, thread);
+            pthread_attr_destroy(&pattr);
+        }
+    }
+
+    if (rv != 0) {
+        os_log(ERROR, "pthread_create() [%s] failed (%d:%s)",
+                thread->name, rv, strerror(rv));
+        thread_free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+int os_thread_join_timeout(os_thread_t *thread, os_time_t timeout)
+{
+    os_time_t deadline, now;
+    int rv = OS_OK;
+
+    os_assert(thread);
+
+    deadline = os_get_monotonic_time() + timeout;
+
+    os_thread_mutex_lock(&thread->mutex);
+    while (!thread->done) {
+        if (timeout < 0) {
+            os_thread_cond_wait(&thread->cond, &thread->mutex);
+            continue;
+        }
+        now = os_get_monotonic_time();
+        if (now >= deadline) {
+            rv = OS_TIMEUP;
+            break;
+        }
+        os_thread_cond_timedwait(&thread->cond, &thread->mutex, deadline - now);
+    }
+    os_thread_mutex_unlock(&thread->mutex);
+
+    if (rv == OS_OK)
+        pthread_join(thread->id, NULL);
+
+    return rv;
+}
+
+void os_thread_destroy(os_thread_t *thread, int delay)
+{
+    os_assert(thread);
+
+    if (os_thread_join_timeout(thread, os_time_from_msec(delay)) == OS_OK) {
+        thread_free(thread);
+        return;
+    }
+
+    os_log(WARN, "thread [%s] still running after %d ms, detached",
+            thread->name, delay);
+
+    os_thread_mutex_lock(&thread->mutex);
+    if (thread->done) {
+        /* returned between the timeout and here */
+        os_thread_mutex_unlock(&thread->mutex);
+        pthread_join(thread->id, NULL);
+        thread_free(thread);
+        return;
+    }
+    thread->detached = 1;
+    pthread_detach(thread->id);
+    os_thread_mutex_unlock(&thread->mutex);
+}
+
+os_thread_id_t os_thread_id(os_thread_t *thread)
+{
+    os_assert(thread);
+    return thread->id;
+}
+
+/*
+ * Thread context.
+ *
+ * The pthread key is only there to get ctx_destroy() called at thread
+ * exit; lookups go through os_thread_ctx_self.
+ */
+__thread os_thread_ctx_t *os_thread_ctx_self
+    __attribute__((tls_model("initial-exec"))) = NULL;
+
+PRIVATE pthread_key_t ctx_key;
+PRIVATE pthread_once_t ctx_once = PTHREAD_ONCE_INIT;
+PRIVATE os_thread_slot_free_f ctx_slot_free[OS_THREAD_CTX_SLOTS];
+PRIVATE unsigned int ctx_slot_count = 0;
+PRIVATE unsigned int ctx_next_id = 0;
+
+PRIVATE void ctx_destroy(void *arg)
+{
+    os_thread_ctx_t *ctx = arg;
+    void *data = NULL;
+    int i;
+
+    /* a callback may use other slots, so they stay until their turn */
+    for (i = OS_THREAD_CTX_SLOTS - 1; i >= 0; i--) {
+        data = ctx->slot[i];
+        if (!data)
+            continue;
+        ctx->slot[i] = NULL;
+        if (ctx_slot_free[i])
+            ctx_slot_free[i](data);
+    }
+
+    if (os_thread_ctx_self == ctx)
+        os_thread_ctx_self = NULL;
+    free(ctx);
+}
+
+PRIVATE void ctx_key_create(void)
+{
+    pthread_key_create(&ctx_key, ctx_destroy);
+}
+
+os_thread_ctx_t *os_thread_ctx_create(void)
+{
+    os_thread_ctx_t *ctx = os_thread_ctx_self;
+
+    if (ctx)
+        return ctx;
+
+    pthread_once(&ctx_once, ctx_key_create);
+
+    ctx = calloc(1, sizeof(*ctx));
+    os_assert(ctx);
+    ctx->id = os_atomic_add_fetch(&ctx_next_id, 1);
+
+    pthread_setspecific(ctx_key, ctx);
+    os_thread_ctx_self = ctx;
+
+    return ctx;
+}
+
+void os_thread_ctx_exit(void)
+{
+    os_thread_ctx_t *ctx = os_thread_ctx_self;
+
+    if (!ctx)
+        return;
+
+    pthread_setspecific(ctx_key, NULL);
+    ctx_destroy(ctx);
+}
+
+int os_thread_slot_register(os_thread_slot_free_f fn)
+{
+    unsigned int slot = os_atomic_fetch_add(&ctx_slot_count, 1);
+
+    if (slot >= OS_THREAD_CTX_SLOTS) {
+        os_log(ERROR, "Too many thread slots [%d]", OS_THREAD_CTX_SLOTS);
+        return OS_ERROR;
+    }
+
+    /* no thread can have data in the slot before it is returned */
+    ctx_slot_free[slot] = fn;
+
+    return (int)slot;
+}
+
+/*
+ * Thread pool.
+ *
+ * The task queue is Vyukov's bounded MPMC ring: each cell carries a
+ * sequence number telling producers and consumers whose turn it is, so
+ * head and tail are claimed with a single CAS and no lock is taken.
+ *
+ * Idle workers park on a condition variable. A worker announces itself
+ * in sleepers, then re-checks the queue before waiting; a submitter
+ * enqueues, then reads sleepers. The full fences between the two steps
+ * guarantee one side sees the other, and submitters skip the mutex
+ * entirely while every worker is busy.
+ */
+typedef struct pool_cell_s {
+    uint64_t seq;
+    os_task_f task;
+    void *data;
+} pool_cell_t;
+
+struct os_thread_pool_s {
+    uint64_t tail OS_CACHELINE_ALIGNED;
+    uint64_t head OS_CACHELINE_ALIGNED;
+
+    pool_cell_t *cells OS_CACHELINE_ALIGNED;
+    uint64_t mask;
+
+    unsigned int sleepers;
+    int stopping;
+    os_thread_mutex_t mutex;
+    os_thread_cond_t cond;
+
+    os_thread_t **threads;
+    int nthreads;
+};
+
+PRIVATE int pool_push(os_thread_pool_t *pool, os_task_f task, void *data)
+{
+    pool_cell_t *cell;
+    uint64_t pos, seq;
+    int64_t dif;
+
+    pos = os_atomic_load_relaxed(&pool->tail);
+    for ( ;; ) {
+        cell = &pool->cells[pos & pool->mask];
+        seq = os_atomic_load(&cell->seq);
+        dif = (int64_t)seq - (int64_t)pos;
+        if (dif == 0) {
+            if (os_atomic_cas_weak(&pool->tail, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return OS_RETRY;
+        } else {
+            pos = os_atomic_load_relaxed(&pool->tail);
+        }
+    }
+
+    cell->task = task;
+    cell->data = data;
+    os_atomic_store(&cell->seq, pos + 1);
+
+    return OS_OK;
+}
+
+PRIVATE int pool_pop(os_thread_pool_t *pool, os_task_f *task, void **data)
+{
+    pool_cell_t *cell;
+    uint64_t pos, seq;
+    int64_t dif;
+
+    pos = os_atomic_load_relaxed(&pool->head);
+    for ( ;; ) {
+        cell = &pool->cells[pos & pool->mask];
+        seq = os_atomic_load(&cell->seq);
+        dif = (int64_t)seq - (int64_t)(pos + 1);
+        if (dif == 0) {
+            if (os_atomic_cas_weak(&pool->head, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return OS_RETRY;
+        } else {
+            pos = os_atomic_load_relaxed(&pool->head);
+        }
+    }
+
+    *task = cell->task;
+    *data = cell->data;
+    os_atomic_store(&cell->seq, pos + pool->mask + 1);
+
+    return OS_OK;
+}
+
+PRIVATE int pool_empty(os_thread_pool_t *pool)
+{
+    return os_atomic_load(&pool->head) == os_atomic_load(&pool->tail);
+}
+
+PRIVATE void pool_worker(void *arg)
+{
+    os_thread_pool_t *pool = arg;
+    os_task_f task;
+    void *data;
+
+    for ( ;; ) {
+        if (pool_pop(pool, &task, &data) == OS_OK) {
+            task(data);
+            continue;
+        }
+
+        os_thread_mutex_lock(&pool->mutex);
+        os_atomic_inc(&pool->sleepers);
+        os_atomic_thread_fence();
+        if (pool_empty(pool)) {
+            if (pool->stopping) {
+                os_atomic_dec(&pool->sleepers);
+                os_thread_mutex_unlock(&pool->mutex);
+                break;
+            }
+            os_thread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        os_atomic_dec(&pool->sleepers);
+        os_thread_mutex_unlock(&pool->mutex);
+    }
+}
+
+os_thread_pool_t *os_thread_pool_create(const os_thread_attr_t *attr,
+        int threads, unsigned int capacity)
+{
+    os_thread_pool_t *pool;
+    os_thread_attr_t wattr;
+    char name[THREAD_NAME_LEN];
+    uint64_t size, i;
+
+    os_assert(threads > 0);
+
+    /* the struct is cacheline aligned, so its size is a multiple of it */
+    pool = aligned_alloc(OS_CACHELINE_SIZE, sizeof(*pool));
+    if (!pool) {
+        os_log(ERROR, "aligned_alloc() failed");
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    for (size = 2; size < capacity; size <<= 1)
+        ;
+    pool->mask = size - 1;
+    pool->cells = calloc(size, sizeof(pool_cell_t));
+    pool->threads = calloc(threads, sizeof(os_thread_t *));
+    if (!pool->cells || !pool->threads) {
+        os_log(ERROR, "calloc() failed");
+        goto err;
+    }
+    for (i = 0; i < size; i++)
+        pool->cells[i].seq = i;
+
+    os_thread_mutex_init(&pool->mutex);
+    os_thread_cond_init(&pool->cond);
+
+    if (attr)
+        wattr = *attr;
+    else
+        memset(&wattr, 0, sizeof(wattr));
+    wattr.name = name;
+
+    for (pool->nthreads = 0; pool->nthreads < threads; pool->nthreads++) {
+        os_snprintf(name, sizeof(name), "%.10s-%d",
+                attr && attr->name ? attr->name : "pool", pool->nthreads);
+        pool->threads[pool->nthreads] =
+            os_thread_create_ex(&wattr, pool_worker, pool);
+        if (!pool->threads[pool->nthreads])
+            break;
+    }
+    if (pool->nthreads != threads) {
+        os_thread_pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+
+err:
+    if (pool->cells)
+        free(pool->cells);
+    if (pool->threads)
+        free(pool->threads);
+    free(pool);
+    return NULL;
+}
+
+void os_thread_pool_destroy(os_thread_pool_t *pool)
+{
+    int i;
+
+    os_assert(pool);
+
+    os_thread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    os_thread_cond_broadcast(&pool->cond);
+    os_thread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        os_thread_join(os_thread_id(pool->threads[i]));
+        thread_free(pool->threads[i]);
+    }
+
+    os_thread_cond_destroy(&pool->cond);
+    os_thread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->cells);
+    free(pool);
+}
+
+int os_thread_pool_submit(os_thread_pool_t *pool, os_task_f task, void *data)
+{
+    int rv;
+
+    os_assert(pool);
+    os_assert(task);
+
+    rv = pool_push(pool, task, data);
+    if (rv != OS_OK)
+        return rv;
+
+    os_atomic_thread_fence();
+    if (os_atomic_load_relaxed(&pool->sleepers)) {
+        os_thread_mutex_lock(&pool->mutex);
+        os_thread_cond_signal(&pool->cond);
+        os_thread_mutex_unlock(&pool->mutex);
+    }
+
+    return OS_OK;
+}
+
+unsigned int os_thread_pool_pending(os_thread_pool_t *pool)
+{
+    uint64_t head;
+
+    os_assert(pool);
+
+    /* head first: it may only move towards tail */
+    head = os_atomic_load(&pool->head);
+    return (unsigned int)(os_atomic_load(&pool->tail) - head);
+}
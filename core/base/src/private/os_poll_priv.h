@@ -30,7 +30,7 @@ typedef struct os_poll_s {
 
 typedef struct os_pollset_s {
     void *context;
-    OS_POOL(pool, os_poll_t);
+    OS_CPOOL(pool, os_poll_t);
 
     struct {
         os_socket_t fd[2];
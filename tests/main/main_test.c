@@ -52,6 +52,58 @@ void test_3(void)
     memcpy(buf1, buf2, 10);
 }
 
+PRIVATE os_buf_t *test_4_job(os_buf_t *in, void *data)
+{
+    os_buf_t *out = os_buf_alloc(NULL, sizeof(uint64_t));
+    uint64_t h = 0;
+    int r, i;
+
+    /* stand-in for decode/crypto work: a few passes over the payload */
+    for (r = 0; r < 128; r++)
+        for (i = 0; i < in->len; i++)
+            h = (h ^ in->data[i]) * 0x100000001b3ULL;
+
+    os_buf_put_data(out, &h, sizeof(h));
+    return out;
+}
+
+void test_4(void)
+{
+#define TASK_TEST_JOBS 1024
+    os_buf_t *in[TASK_TEST_JOBS], *out[TASK_TEST_JOBS];
+    os_task_sched_t *sched;
+    int64_t time_start, base = 0;
+    int i, j, threads, ncpu;
+
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 0; i < TASK_TEST_JOBS; i++) {
+        in[i] = os_buf_alloc(NULL, 1024);
+        for (j = 0; j < 1024; j++)
+            os_buf_put_u8(in[i], (uint8_t)(i + j));
+    }
+
+    for (threads = 1; threads <= ncpu; threads *= 2) {
+        sched = os_task_sched_create(NULL, threads);
+
+        time_start = os_get_monotonic_time();
+        os_task_map_buf(sched, in, out, TASK_TEST_JOBS, test_4_job, NULL);
+        time_start = os_get_monotonic_time() - time_start;
+        if (threads == 1)
+            base = time_start;
+
+        printf("task threads = %d, %ldus, speedup %.2f\n", threads,
+                time_start, time_start ? (double)base / time_start : 0.0);
+
+        for (i = 0; i < TASK_TEST_JOBS; i++)
+            os_buf_free(out[i]);
+        os_task_sched_destroy(sched);
+    }
+
+    for (i = 0; i < TASK_TEST_JOBS; i++)
+        os_buf_free(in[i]);
+}
+
 void term(void)
 {
     os_buf_default_destroy();
@@ -71,6 +123,7 @@ int main(void){
 
     test_1();
     //test_2();
+    test_4();
     test_3();
 
     printf("daemon running...\n");